@@ -7,8 +7,26 @@
 #include <cstring>
 #include <cmath>
 #include <algorithm>
+#include <cerrno>
+#include <cstdio>
+
+#if defined(_WIN32) || defined(__WIN32__) || defined(_WIN64)
+    #define EAGLE_CAMERA_FSEEK _fseeki64 // 64-bit offsets for spool file
+    #define EAGLE_CAMERA_THREADS_WIN
+    #define EAGLE_CAMERA_MAX_CPU_NUMBER static_cast<int>(8*sizeof(DWORD_PTR)) // bits of thread affinity mask
+#else
+    #define EAGLE_CAMERA_FSEEK fseeko
+    #include <pthread.h>
+    #include <sched.h>
+    #ifdef CPU_SETSIZE
+        #define EAGLE_CAMERA_MAX_CPU_NUMBER CPU_SETSIZE
+    #else
+        #define EAGLE_CAMERA_MAX_CPU_NUMBER 1024
+    #endif
+#endif
 
 #include <iostream>
+#include <fstream>
 
                         /*********************************************
                         *                                            *
@@ -55,11 +73,10 @@ static std::string get_float_fmt(double value, int num_digits)
 }
 
 
-static std::string time_stamp(const char* fmt = nullptr, bool utc = false,
-                              std::chrono::system_clock::time_point *now_point = nullptr)
+// format given time point
+static std::string time_stamp_at(const std::chrono::system_clock::time_point &now,
+                                 const char* fmt = nullptr, bool utc = false)
 {
-    auto now = std::chrono::system_clock::now();
-    if ( now_point ) *now_point = now;
     auto now_c = std::chrono::system_clock::to_time_t(now);
 
     char time_stamp[100];
@@ -95,6 +112,16 @@ static std::string time_stamp(const char* fmt = nullptr, bool utc = false,
 }
 
 
+static std::string time_stamp(const char* fmt = nullptr, bool utc = false,
+                              std::chrono::system_clock::time_point *now_point = nullptr)
+{
+    auto now = std::chrono::system_clock::now();
+    if ( now_point ) *now_point = now;
+
+    return time_stamp_at(now, fmt, utc);
+}
+
+
 static std::string pointer_to_str(void* ptr)
 {
     char addr[20];
@@ -110,7 +137,10 @@ static std::string pointer_to_str(void* ptr)
 
                 /*  INIT STATIC MEMBERS  */
 
+std::mutex EagleCamera::grabberContextMutex;
 size_t EagleCamera::createdObjects = 0;
+std::string EagleCamera::grabberVideoFormat;
+int EagleCamera::grabberUsedUnitmap = 0;
 
                 /*  CONSTRUCTORS AND DESTRUCTOR  */
 
@@ -119,20 +149,48 @@ EagleCamera::EagleCamera(const char *epix_video_fmt_filename):
     cameraVideoFormatFilename(""),
     cameraUnitmap(-1),
     logLevel(EagleCamera::LOG_LEVEL_VERBOSE), cameraLog(nullptr), logMutex(),
-    logMessageStream(), logMessageStreamMutex(),
 
     CL_ACK_BIT_ENABLED(CL_DEFAULT_ACK_ENABLED), CL_CHK_SUM_BIT_ENABLED(CL_DEFAULT_CK_SUM_ENABLED),
+    _registerShadowEnabled(false), _registerShadow(), _registerShadowHits(0), _sequenceStopped(false),
 
     _imageStartX(0), _imageStartY(0), _imageXDim(0), _imageYDim(0),
     _imagePixelsNumber(0),
     _frameBuffersNumber(EAGLE_CAMERA_DEFAULT_NUMBER_OF_BUFFERS),
-    _frameCounts(1),
-    _startExpTimestamp(), _expTime(0),
-    _ccdTemp(), _pcbTemp(),
+    _frameCounts(1), _acquisitionFramesNumber(1),
+    _preTriggerFrames(EAGLE_CAMERA_DEFAULT_PRE_TRIGGER_FRAMES), _recorderTriggered(false),
+    _expTime(0),
+    _frameMetadata(), _cubeMetadata(),
     _startExpTimepoint(), _stopExpTimepoint(),
-    _imageBuffer(), _currentBufferLength(0), _usedBuffersNumber(0),
+    _frameBufferPool(), _imageBuffer(), _currentBufferLength(0),
+    _hugePagesMode(EAGLE_CAMERA_FEATURE_BUFFERS_MEMORY_OFF),
+    _prefaultBuffersMode(EAGLE_CAMERA_FEATURE_BUFFERS_MEMORY_ON),
+    _lockBuffersMode(EAGLE_CAMERA_FEATURE_BUFFERS_MEMORY_OFF), _acquisitionBuffersNumber(0),
+    _numaNode(EAGLE_CAMERA_DEFAULT_NUMA_NODE), _numaCpus(),
+    _grabberBuffersNumber(1),
+    _acquisitionMode(EAGLE_CAMERA_FEATURE_ACQUISITION_MODE_SNAPSHOT), _lostFrames(0),
+    _backpressurePolicy(EAGLE_CAMERA_FEATURE_BACKPRESSURE_POLICY_BLOCK), _scratchBuffer(-1),
+    _droppedFrames(0), _spilledFrames(0),
+    _spoolFilename(), _spoolFilePath(), _spoolWriteFile(nullptr), _spoolReadFile(nullptr), _spoolWritten(0), _spoolFlushed(0), _spoolRead(0), _spoolPending(0), _spoolBuffer(),
+    _spillBuffers(), _spillRing(), _freeSpillBuffers(), _spillThread(), _spillStopped(true),
+    _zeroCopyMode(EAGLE_CAMERA_FEATURE_ZERO_COPY_OFF), _zeroCopyFrames(false), _zeroCopyChunk(),
+    _telemetryRing(), _telemetryThread(), _telemetryMutex(), _telemetryCond(), _telemetryStop(false), _snapshotPending(false),
+    _telemetryRate(EAGLE_CAMERA_DEFAULT_TELEMETRY_RATE),
+    _acquisitionStarted(true), _acquisitionStartError(),
     _capturingTimeoutGap(EAGLE_CAMERA_DEFAULT_CAPTURING_TIMEOUT_GAP),
-    _acquisitionProccessThreadFuture(),
+    _acquisitionProccessThreadFuture(), _acquisitionProccessThread(),
+    _publishedFrames(0), _savedFrames(0), _bytesWritten(0), _progressCallback(), _progressMutex(),
+    _captureQueue(), _frameRing(), _freeBuffers(), _captureThread(), _grabberFieldEvent(),
+    _processingStages(), _stageRings(), _pipelineThreads(), _cubeWriterThreads(), _restoreBuffer(-1), _restoreBufferBusy(false),
+    _captureThreadScheduling{EAGLE_CAMERA_FEATURE_THREAD_POLICY_OTHER, 0, ""},
+    _writerThreadScheduling{EAGLE_CAMERA_FEATURE_THREAD_POLICY_OTHER, 0, ""},
+    _telemetryThreadScheduling{EAGLE_CAMERA_FEATURE_THREAD_POLICY_OTHER, 0, ""},
+    _processingThreadScheduling{EAGLE_CAMERA_FEATURE_THREAD_POLICY_OTHER, 0, ""},
+    _frameConsumers(), _imageReadyConsumer(), _consumerWorkers(), _fanOutStage(0), _bufferRefs(), _frameHandlesNumber(0), _freeBuffersMutex(),
+    _acquisitionStateMutex(), _acquisitionStateCond(),
+    _capturedFrames(0), _snappedFrames(0), _copyQueue(), _copyThread(), _captureError(), _savingError(),
+    _captureDispatchLatencySum(0), _captureDispatchLatencyMax(0),
+    _frameTiming(), _latencyHistogram(),
+    _abortReadoutTimeout(0), _snapAborted(false),
 
     _acquisitionProccessPollingInterval(EAGLE_CAMERA_DEFAULT_ACQUISITION_POLL_INTERVAL),
     _stopCapturing(true), _acquiringFinished(true),
@@ -142,6 +200,13 @@ EagleCamera::EagleCamera(const char *epix_video_fmt_filename):
     _fitsFilePtr(nullptr),
     _fitsFilename(""), _fitsHdrFilename(""),
     _fitsDataFormat(EAGLE_CAMERA_FEATURE_FITS_DATA_FORMAT_EXTEN),
+    _fitsWriterMode(EAGLE_CAMERA_FEATURE_FITS_WRITER_CFITSIO), _nativeFitsWriting(false),
+    _fitsStreamWriter(), _fitsPrimaryHeader(EAGLE_CAMERA_FITS_PRIMARY_HEADER_CARDS),
+    _fitsDataOffset(0), _fitsWriteOffset(0), _fitsFrameBuffer(),
+    _riceFitsFormat(false), _fitsWriterThreads(EAGLE_CAMERA_DEFAULT_FITS_WRITER_THREADS),
+    _fitsWorkerPool(), _fitsTileCompressor(), _fitsTileImage(),
+    _fitsFileMappingMode(EAGLE_CAMERA_FEATURE_FITS_FILE_MAPPING_OFF), _fitsCubeMap(nullptr),
+    _fitsCubeWriters(0), _fitsCubeInputMutex(), _fitsCubeMutex(),
 
     _ccdDimension(), _bitsPerPixel(0),
     _serialNumber(0), _buildDate(), _buildCode(),
@@ -155,7 +220,12 @@ EagleCamera::EagleCamera(const char *epix_video_fmt_filename):
     PREDEFINED_CAMERA_COMMANDS(),
     cameraFeature(this), currentCameraFeature(nullptr)
 {
+    std::lock_guard<std::mutex> lock(grabberContextMutex);
+
     if ( !createdObjects ) {
+        grabberVideoFormat = epix_video_fmt_filename ? epix_video_fmt_filename : "";
+        grabberUsedUnitmap = 0;
+
         if ( epix_video_fmt_filename != nullptr ) {
             cameraVideoFormatFilename = epix_video_fmt_filename;
             std::string log_str = std::string("pxd_PIXCIopen(\"\",NULL,") + cameraVideoFormatFilename + ")";
@@ -172,6 +242,13 @@ EagleCamera::EagleCamera(const char *epix_video_fmt_filename):
             XCLIB_API_CALL(  pxd_videoFormatAsIncluded(0), log_str);
 
         }
+    } else { // the library is already opened by another camera object
+        std::string fmt = epix_video_fmt_filename ? epix_video_fmt_filename : "";
+        if ( fmt != grabberVideoFormat ) {
+            throw EagleCameraException(0,EagleCamera::Error_VideoFormatMismatch,
+                                       "Grabber is already opened with another video format");
+        }
+        cameraVideoFormatFilename = fmt;
     }
 
     ++createdObjects;
@@ -200,10 +277,18 @@ EagleCamera::~EagleCamera()
                 _acquisitionProccessThreadFuture.get(); // wait for acquiring ...  TODO: stop proccess ???!!!
             } catch ( EagleCameraException &ex ) {
                 logToFile(ex);
+            } catch ( ... ) {
             }
         }
     }
 
+    // acquisition thread may still be finishing (the flag is set before its exit)
+    if ( _acquisitionProccessThread.joinable() ) _acquisitionProccessThread.join();
+
+    std::lock_guard<std::mutex> lock(grabberContextMutex);
+
+    if ( cameraUnitmap > 0 ) grabberUsedUnitmap &= ~cameraUnitmap;
+
     --createdObjects;
 
     if ( !createdObjects ) {
@@ -259,17 +344,46 @@ void EagleCamera::initCamera(const int unitmap, std::ostream *log_file)
     logToFile(EagleCamera::LOG_IDENT_CAMERA_INFO, "INITIALIZATION OF CCD CAMERA ...");
     logToFile(EagleCamera::LOG_IDENT_CAMERA_INFO, "Try to configure CameraLink serial connection ...", 1);
 
+    bool units_claimed = false;
+
+    // on error the camera object stays uninitialized and it does not hold any grabber unit
+    auto release_units = [&]() {
+        if ( !units_claimed ) return;
+        std::lock_guard<std::mutex> lock(grabberContextMutex);
+        grabberUsedUnitmap &= ~unitmap;
+        cameraUnitmap = -1;
+    };
+
     try {
         if ( unitmap <= 0 ) {
             log_str = "Unitmap must be greater than 0! (trying to set to " + std::to_string(unitmap) + ")";
             throw EagleCameraException(0,EagleCamera::Error_InvalidUnitmap, log_str);
         }
 
+        { // claim the units: they must exist and must not be controlled by another camera object
+            std::lock_guard<std::mutex> lock(grabberContextMutex);
+
+            int units = pxd_infoUnits();
+            if ( (units > 0) && (units < 31) && (unitmap >= (1 << units)) ) {
+                log_str = "Unitmap " + std::to_string(unitmap) + " refers to absent grabber unit (" +
+                          std::to_string(units) + " units are opened)";
+                throw EagleCameraException(0,EagleCamera::Error_InvalidUnitmap, log_str);
+            }
+
+            int used = grabberUsedUnitmap & ~(cameraUnitmap > 0 ? cameraUnitmap : 0);
+            if ( used & unitmap ) {
+                log_str = "Grabber unit(s) of unitmap " + std::to_string(unitmap) + " are used by another camera object";
+                throw EagleCameraException(0,EagleCamera::Error_InvalidUnitmap, log_str);
+            }
+
+            grabberUsedUnitmap = used | unitmap;
+            units_claimed = true;
+        }
+
         cameraUnitmap = unitmap;
 
-        formatLogMessage("pxd_serialConfigure",0,CL_DEFAULT_BAUD_RATE,CL_DEFAULT_DATA_BITS,0,CL_DEFAULT_STOP_BIT,0,0,0);
-        XCLIB_API_CALL( pxd_serialConfigure(cameraUnitmap,0,CL_DEFAULT_BAUD_RATE,CL_DEFAULT_DATA_BITS,0,CL_DEFAULT_STOP_BIT,0,0,0),
-                        logMessageStream.str());
+        XCLIB_API_CALL( XCLIB_SERIALIZED(pxd_serialConfigure(cameraUnitmap,0,CL_DEFAULT_BAUD_RATE,CL_DEFAULT_DATA_BITS,0,CL_DEFAULT_STOP_BIT,0,0,0)),
+                        formatLogMessage("pxd_serialConfigure",0,CL_DEFAULT_BAUD_RATE,CL_DEFAULT_DATA_BITS,0,CL_DEFAULT_STOP_BIT,0,0,0));
 
         logToFile(EagleCamera::LOG_IDENT_CAMERA_INFO, "Try to reset FPGA ...", 1);
         bool status = resetFPGA();
@@ -293,27 +407,25 @@ void EagleCamera::initCamera(const int unitmap, std::ostream *log_file)
         // get framebuffer dimensions
 
         log_str = "pxd_imageYdim()";
-        XCLIB_API_CALL( _ccdDimension[0] = pxd_imageXdim(), log_str );
+        XCLIB_API_CALL( _ccdDimension[0] = XCLIB_SERIALIZED(pxd_imageXdim()), log_str );
         log_str = "pxd_imageYdim()";
-        XCLIB_API_CALL( _ccdDimension[1] = pxd_imageYdim(), log_str );
+        XCLIB_API_CALL( _ccdDimension[1] = XCLIB_SERIALIZED(pxd_imageYdim()), log_str );
         log_str = "pxd_imageBdim()";
-        XCLIB_API_CALL( _bitsPerPixel = pxd_imageBdim(), log_str ); // Eagle-V is non-color camera. do not read number of colors
+        XCLIB_API_CALL( _bitsPerPixel = XCLIB_SERIALIZED(pxd_imageBdim()), log_str ); // Eagle-V is non-color camera. do not read number of colors
 //        log_str = "pxd_imageCdim()";
 //        XCLIB_API_CALL( cc = pxd_imageCdim(), log_str );
 
         log_str = "pxd_imageZdim()";
 //        XCLIB_API_CALL( _frameBuffersNumber = pxd_imageZdim(), log_str);
-        int Nbuff;
-        XCLIB_API_CALL( Nbuff = pxd_imageZdim(), log_str);
+        XCLIB_API_CALL( _grabberBuffersNumber = XCLIB_SERIALIZED(pxd_imageZdim()), log_str);
 
-        _imageBuffer.resize(_frameBuffersNumber);
 //        _copyFramebuffersFuture.resize(_frameBuffersNumber);
 //        _currentBufferLength = _ccdDimension[0]*_ccdDimension[1];
 
         logToFile(EagleCamera::LOG_IDENT_CAMERA_INFO, "CCD dimensions: [" +
                   std::to_string(_ccdDimension[0]) + ", " + std::to_string(_ccdDimension[1]) + "] pixels", ntab);
         logToFile(EagleCamera::LOG_IDENT_CAMERA_INFO, "CCD bits per pixel: " + std::to_string(_bitsPerPixel), ntab);
-        logToFile(EagleCamera::LOG_IDENT_CAMERA_INFO, "Number of frame buffers: " + std::to_string(Nbuff), ntab);
+        logToFile(EagleCamera::LOG_IDENT_CAMERA_INFO, "Number of frame buffers: " + std::to_string(_grabberBuffersNumber), ntab);
 //        logToFile(EagleCamera::LOG_IDENT_CAMERA_INFO, "Number of frame buffers: " + std::to_string(_frameBuffersNumber), ntab);
 
         logToFile(EagleCamera::LOG_IDENT_CAMERA_INFO, "Set initial camera configuration ...", 1);
@@ -321,9 +433,13 @@ void EagleCamera::initCamera(const int unitmap, std::ostream *log_file)
         setInitialState();
 
     } catch ( EagleCameraException &ex ) {
+        release_units();
         logToFile(ex);
         logToFile(EagleCamera::LOG_IDENT_CAMERA_ERROR, "CANNOT INITIALIZE CAMERA");
         throw;
+    } catch ( ... ) {
+        release_units();
+        throw;
     }
 
     logToFile(EagleCamera::LOG_IDENT_CAMERA_INFO, "INITIALIZATION COMPLETED SUCCESSFULLY");
@@ -396,6 +512,12 @@ void EagleCamera::startAcquisition()
 
     if ( !_acquiringFinished ) throw EagleCameraException(0,EagleCamera::Error_CameraIsAcquiring,"Camera is acquiring");
 
+    // image buffers of the previous acquisition are re-used
+    if ( _frameHandlesNumber ) {
+        throw EagleCameraException(0,EagleCamera::Error_CameraIsAcquiring,
+                                   "Frame handles of the previous acquisition are still held");
+    }
+
     if ( _fitsFilename.empty() ) return;
 
     _stopCapturing = false;
@@ -416,15 +538,27 @@ void EagleCamera::startAcquisition()
 
     _imagePixelsNumber = _imageXDim*_imageYDim;
 
+    // after exposure abort the camera reads out partial frame. estimate time of the readout
+
+    double pixel_rate = EAGLE_CAMERA_SLOW_READOUT_PIXEL_RATE;
+    try {
+        if ( !getReadoutRate().compare(EAGLE_CAMERA_FEATURE_READOUT_RATE_FAST) ) {
+            pixel_rate = EAGLE_CAMERA_FAST_READOUT_PIXEL_RATE;
+        }
+    } catch ( EagleCameraException &ex ) { // use the slowest rate
+        logToFile(ex);
+    }
+    _abortReadoutTimeout = static_cast<ulong>(1000.0*_imagePixelsNumber/pixel_rate) + EAGLE_CAMERA_DEFAULT_ABORT_READOUT_GAP;
+
     // compute number of grabber framebuffer lines one needs to store whole image.
     // This API does not reconfigure grabber in case of changing binning factor or
     // ROI size. Thus, read image will be stored in the same initial (binning 1x1,
-    // ROI = full resoluion CCD image) framebuffer. In this case, to compute size of
-    // image buffer for 'pxd_readushort' XCLIB API function one needs to know
-    // how many whole framebuffer lines read image occupys.
+    // ROI = full resoluion CCD image) framebuffer as a packed sequence of pixels.
+    // Image buffers are sized exactly to the image and only its pixels are read
+    // from the framebuffer (see readGrabberPixels).
 
     _frameBufferLines = static_cast<IntegerType>(std::ceil(1.0*_imagePixelsNumber/_ccdDimension[0]));
-    IntegerType Nelem = _frameBufferLines*_ccdDimension[0];
+    IntegerType Nelem = _imagePixelsNumber;
 
 #ifndef NDEBUG
     std::cout << "IMAGE DIMENSION: [" << _imageXDim << ", " << _imageYDim << "] ([Width, Height])\n";
@@ -434,38 +568,128 @@ void EagleCamera::startAcquisition()
     std::cout << "NUMBER OF API FRAME BUFFERS: " << _frameBuffersNumber << "\n";
 #endif
 
+    // in RECORDER mode the last _preTriggerFrames frames are kept in image buffers
+    // until trigger, after that _frameCounts frames are saved as usual
+
+    bool recorder = !_acquisitionMode.compare(EAGLE_CAMERA_FEATURE_ACQUISITION_MODE_RECORDER);
+
+    _acquisitionFramesNumber = _frameCounts;
+    if ( recorder ) _acquisitionFramesNumber += _preTriggerFrames;
+
+    _recorderTriggered = false;
+
+    // in zero-copy mode images are kept in grabber framebuffers until they are saved,
+    // so image buffers are not needed. it is possible only for snapshot mode: in streaming
+    // one grabber re-writes its framebuffers continuously
+
+    // for all policies except of BLOCK one extra (scratch) buffer is needed to capture
+    // frames to be dropped or spilled. in zero-copy mode it is the grabber framebuffer
+
+    size_t Nscratch = _backpressurePolicy.compare(EAGLE_CAMERA_FEATURE_BACKPRESSURE_POLICY_BLOCK) ? 1 : 0;
+
+    // processing stages and frame consumers need images in memory, so zero-copy mode is not used with them
+
+    _zeroCopyFrames = !_zeroCopyMode.compare(EAGLE_CAMERA_FEATURE_ZERO_COPY_ON) &&
+                      !_acquisitionMode.compare(EAGLE_CAMERA_FEATURE_ACQUISITION_MODE_SNAPSHOT) &&
+                      (static_cast<size_t>(_grabberBuffersNumber) > Nscratch) && _processingStages.empty() && _frameConsumers.empty();
+
+    // spooled frames pass processing stages in one more extra buffer
+
+    size_t Nrestore = (Nscratch && !_backpressurePolicy.compare(EAGLE_CAMERA_FEATURE_BACKPRESSURE_POLICY_SPILL) &&
+                       !_processingStages.empty()) ? 1 : 0;
+
     size_t Nbuffs = (_frameBuffersNumber <= _frameCounts) ? _frameBuffersNumber : _frameCounts;
+    if ( recorder ) Nbuffs += _preTriggerFrames;
+
+    // each frame occupies its own grabber framebuffer until it is saved
+    if ( _zeroCopyFrames && ((Nbuffs + Nscratch) > static_cast<size_t>(_grabberBuffersNumber)) ) {
+        Nbuffs = _grabberBuffersNumber - Nscratch;
+    }
+
+    _acquisitionBuffersNumber = Nbuffs;
+
+    // compressed extensions are written by native writer only
+
+    _riceFitsFormat = !_fitsDataFormat.compare(EAGLE_CAMERA_FEATURE_FITS_DATA_FORMAT_RICE);
+    _nativeFitsWriting = !_fitsWriterMode.compare(EAGLE_CAMERA_FEATURE_FITS_WRITER_NATIVE) || _riceFitsFormat;
+    _fitsCubeWriters = 0; // native writer decides it when the file is opened
+    _scratchBuffer = Nscratch ? Nbuffs : -1;
+    _restoreBuffer = Nrestore ? Nbuffs + Nscratch : -1;
+
+    Nbuffs += Nscratch + Nrestore;
+
+    // take image buffers from the pool. the pool allocates memory only if there are
+    // no suitable free blocks (e.g. the first acquisition or larger image or more buffers)
+
+    _frameBufferPool.releaseAll();
+    _imageBuffer.clear();
+    _currentBufferLength = Nelem;
+
+    // acquisition threads without explicit affinity run on CPUs of the node of image buffers
+
+    _numaCpus.clear();
+    if ( (_numaNode >= 0) && !numaNodeCpus(static_cast<int>(_numaNode), _numaCpus) ) {
+        logToFile(EagleCamera::LOG_IDENT_CAMERA_ERROR, "Cannot get CPUs of NUMA node " + std::to_string(_numaNode));
+    }
+
+    _frameTiming.assign(Nbuffs, FrameTiming());
+
+    // metadata ring: frames in image buffers (or grabber framebuffers) and in spool file
+
+    size_t Nmeta = Nbuffs + _grabberBuffersNumber + 1;
+    if ( !_backpressurePolicy.compare(EAGLE_CAMERA_FEATURE_BACKPRESSURE_POLICY_SPILL) ) {
+        Nmeta += EAGLE_CAMERA_DEFAULT_SPOOL_CAPACITY;
+    }
+    _frameMetadata.assign(Nmeta, FrameMetadata());
+    _cubeMetadata.clear();
+
+    while ( _bufferRefs.size() < Nbuffs ) _bufferRefs.emplace_back(0);
+    for ( auto &refs: _bufferRefs ) refs = 0;
+    for ( auto &hist: _latencyHistogram ) hist.reset();
+
     try {
-        if ( Nelem != _currentBufferLength ) {
-            _currentBufferLength = Nelem;
-//            Nbuffs = (_frameBuffersNumber <= _frameCounts) ? _frameBuffersNumber : _frameCounts;
+        if ( !_zeroCopyFrames ) {
+            bool huge_pages = !_hugePagesMode.compare(EAGLE_CAMERA_FEATURE_BUFFERS_MEMORY_ON);
+            bool prefault = !_prefaultBuffersMode.compare(EAGLE_CAMERA_FEATURE_BUFFERS_MEMORY_ON);
+            bool lock = !_lockBuffersMode.compare(EAGLE_CAMERA_FEATURE_BUFFERS_MEMORY_ON);
+
+            size_t lock_failures = _frameBufferPool.lockFailures();
+            size_t numa_failures = _frameBufferPool.numaFailures();
+
             for ( size_t i = 0; i < Nbuffs; ++i ) {
-                _imageBuffer[i] = std::unique_ptr<ushort[]>(new ushort[_currentBufferLength]);
+                _imageBuffer.push_back(_frameBufferPool.acquire(_currentBufferLength, huge_pages, prefault, lock,
+                                                                static_cast<int>(_numaNode)));
             }
-        } else {
-            if ( _usedBuffersNumber < Nbuffs ) {
-                for ( size_t i = _usedBuffersNumber; i < Nbuffs; ++i ) {
-                    _imageBuffer[i] = std::unique_ptr<ushort[]>(new ushort[_currentBufferLength]);
-                }
+
+            if ( _frameBufferPool.lockFailures() > lock_failures ) {
+                logToFile(EagleCamera::LOG_IDENT_CAMERA_ERROR, "Cannot lock image buffers in RAM");
+            }
+            if ( _frameBufferPool.numaFailures() > numa_failures ) {
+                logToFile(EagleCamera::LOG_IDENT_CAMERA_ERROR, "Cannot place image buffers on NUMA node " +
+                          std::to_string(_numaNode));
             }
         }
-        _usedBuffersNumber = Nbuffs;
     } catch ( std::bad_alloc ) {
         throw EagleCameraException(0, EagleCamera::Error_MemoryAllocation, "Cannot allocate memory for image buffer");
     }
 
 
     _acquiringFinished = false;
-    _startExpTimestamp.resize(_frameCounts);
-    _ccdTemp.resize(_frameCounts);
-    _pcbTemp.resize(_frameCounts);
+    _acquisitionStarted = false;
+    _acquisitionStartError = nullptr;
+    _publishedFrames = 0;
+    _savedFrames = 0;
+    _bytesWritten = 0;
 
-    // start acquisition proccess in separate thread ...
+    // start acquisition proccess in separate thread. it is a dedicated thread (not std::async
+    // one which can be taken from a pool, e.g. by MSVC) since its scheduling is changed
 
-    _acquisitionProccessThreadFuture = std::async(std::launch::async, [&]{
-        try {
+    if ( _acquisitionProccessThread.joinable() ) _acquisitionProccessThread.join(); // the previous one is finished
+
+    std::packaged_task<void()> acquisition_task([&]{
+        applyThreadScheduling(_captureThreadScheduling, "acquisition");
 
-            double digits_temp_factor = pow(10.0,EAGLE_CAMERA_DEFAULT_TEMP_VALUE_DIGITS);
+        try {
 
             // create FITS file
 
@@ -478,732 +702,2215 @@ void EagleCamera::startAcquisition()
             bool exten_format = (!_fitsDataFormat.compare(EAGLE_CAMERA_FEATURE_FITS_DATA_FORMAT_EXTEN)) ? true : false;
 
 
-            if ( !exten_format && (_frameCounts > 1) ) {
+            if ( !exten_format && !_riceFitsFormat && (_acquisitionFramesNumber > 1) ) {
                 naxis = 3;
-                naxes[2] = _frameCounts;
+                naxes[2] = _acquisitionFramesNumber;
             }
 
-            exten_format = exten_format && (_frameCounts > 1);
-
-            std::string filename = "!" + _fitsFilename; // add '!' to overwrite existing file
-
-            formatFitsLogMessage("fits_create_file",filename,(void*)&status);
-
-            CFITSIO_API_CALL( fits_create_file(&_fitsFilePtr, filename.c_str(), &status), logMessageStream.str() );
+            // compressed image can not be primary HDU, so it is always extension
+            exten_format = (exten_format && (_acquisitionFramesNumber > 1)) || _riceFitsFormat;
 
             std::string date_str = time_stamp(EAGLE_CAMERA_FITS_DATE_KEYWORD_FORMAT, true);
 
-            if ( exten_format ) { // multi-extension FITS file
-                // creating empty primary array
-                formatFitsLogMessage("fits_create_img",USHORT_IMG,0,0,(void*)&status);
-                CFITSIO_API_CALL( fits_create_img(_fitsFilePtr,USHORT_IMG,0,0,&status), logMessageStream.str());
+            if ( _nativeFitsWriting ) { // CFITSIO opens the file after acquisition only
+                openNativeFitsFile(naxis, naxes, exten_format, date_str);
+            } else {
+                std::string filename = "!" + _fitsFilename; // add '!' to overwrite existing file
 
-                // write 'DATE' keyword into primary HDU
+                CFITSIO_API_CALL( fits_create_file(&_fitsFilePtr, filename.c_str(), &status),
+                                  formatFitsLogMessage("fits_create_file",filename,(void*)&status) );
 
-                formatFitsLogMessage("fits_update_key", TSTRING, "DATE", date_str,
-                                     EAGLE_CAMERA_FITS_KEYWORD_COMMENT_DATE, (void*)&status);
-                CFITSIO_API_CALL( fits_update_key(_fitsFilePtr, TSTRING, "DATE", (void*)date_str.c_str(),
-                                                  EAGLE_CAMERA_FITS_KEYWORD_COMMENT_DATE, &status),
-                                  logMessageStream.str());
+                if ( exten_format ) { // multi-extension FITS file
+                    // creating empty primary array
+                    CFITSIO_API_CALL( fits_create_img(_fitsFilePtr,USHORT_IMG,0,0,&status),
+                                      formatFitsLogMessage("fits_create_img",USHORT_IMG,0,0,(void*)&status));
 
-            } else {
-                formatFitsLogMessage("fits_create_img",USHORT_IMG,naxis,(void*)naxes,(void*)&status);
-                CFITSIO_API_CALL( fits_create_img(_fitsFilePtr,USHORT_IMG,naxis,naxes,&status),
-                                  logMessageStream.str());
+                    // write 'DATE' keyword into primary HDU
 
-                // write 'DATE' keyword
+                    CFITSIO_API_CALL( fits_update_key(_fitsFilePtr, TSTRING, "DATE", (void*)date_str.c_str(),
+                                                      EAGLE_CAMERA_FITS_KEYWORD_COMMENT_DATE, &status),
+                                      formatFitsLogMessage("fits_update_key", TSTRING, "DATE", date_str,
+                                                           EAGLE_CAMERA_FITS_KEYWORD_COMMENT_DATE, (void*)&status));
 
-                formatFitsLogMessage("fits_update_key", TSTRING, "DATE", date_str,
-                                     EAGLE_CAMERA_FITS_KEYWORD_COMMENT_DATE, (void*)&status);
-                CFITSIO_API_CALL( fits_update_key(_fitsFilePtr, TSTRING, "DATE", (void*)date_str.c_str(),
-                                                  EAGLE_CAMERA_FITS_KEYWORD_COMMENT_DATE, &status),
-                                  logMessageStream.str());
-            }
+                } else {
+                    CFITSIO_API_CALL( fits_create_img(_fitsFilePtr,USHORT_IMG,naxis,naxes,&status),
+                                      formatFitsLogMessage("fits_create_img",USHORT_IMG,naxis,(void*)naxes,(void*)&status));
 
-            ulong timeout = (_expTime + _capturingTimeoutGap)*1000; // to milliseconds
+                    // write 'DATE' keyword
 
-            IntegerType Nbuffers;
-            if (_frameCounts < _frameBuffersNumber ) {
-                Nbuffers = _frameCounts;
-            } else {
-                Nbuffers = _frameBuffersNumber;
+                    CFITSIO_API_CALL( fits_update_key(_fitsFilePtr, TSTRING, "DATE", (void*)date_str.c_str(),
+                                                      EAGLE_CAMERA_FITS_KEYWORD_COMMENT_DATE, &status),
+                                      formatFitsLogMessage("fits_update_key", TSTRING, "DATE", date_str,
+                                                           EAGLE_CAMERA_FITS_KEYWORD_COMMENT_DATE, (void*)&status));
+                }
             }
 
+            ulong timeout = (_expTime + _capturingTimeoutGap)*1000; // to milliseconds
 
-            std::future<void> run_saving;
-            std::future<void> run_capture;
-
-            _currentBuffer = 0;
-            IntegerType lastSavingBuffer = 0;
-            IntegerType i_frameSaving = 0;
-            IntegerType i_frame;
-
-            std::chrono::system_clock::time_point startSavingTimepoint;
+            IntegerType Nbuffers = _acquisitionBuffersNumber;
 
-            for ( i_frame = 0; i_frame < _frameCounts; ++i_frame ) {
-                if ( run_capture.valid() ) { // wait for previous capturing&copying thread
-                    auto wstatus = run_capture.wait_for(std::chrono::milliseconds(timeout));
+            // start long-lived capturing and saving threads. they live for the whole
+            // acquisition: the capturing thread gets jobs through the queue, the saving
+            // one gets filled image buffers through the ring of frames and returns them
+            // back through the ring of free buffers. the ring of frames must also keep
+            // spooled frames
 
-                    if ( wstatus == std::future_status::timeout ) { // something is wrong!
-                        throw EagleCameraException(0,EagleCamera::Error_AcquisitionProccessError,
-                                                   "A timeout occured while waiting for copying of image from framebuffer");
-                    } else if ( wstatus == std::future_status::ready ) {
-                        run_capture.get();
-                    } else { // something is wrong!
-                        throw EagleCameraException(0,EagleCamera::Error_AcquisitionProccessError,
-                                                   "Acquisition proccess failed");
-                    }
-                }
+            bool spill = !_backpressurePolicy.compare(EAGLE_CAMERA_FEATURE_BACKPRESSURE_POLICY_SPILL);
 
-                // check for exposure abort signal
-                if ( _stopCapturing ) { // recompute exposure duration
-#ifndef NDEBUG
-                    std::cout << "\n(stop before capturing) i_frame = " << i_frame << "\n";
-#endif
-                    std::chrono::duration<double> fp_s = _stopExpTimepoint-_startExpTimepoint;
-                    stopFrameExpTime = fp_s.count();
-                    break; // break cycle
-                }
+            _frameRing.reset(Nbuffers + (spill ? EAGLE_CAMERA_DEFAULT_SPOOL_CAPACITY : 0));
+            _freeBuffers.reset(Nbuffers);
+            for ( IntegerType i = 0; i < Nbuffers; ++i ) _freeBuffers.push(-1, i);
 
-                if ( (i_frame - i_frameSaving) < _imageBuffer.size() ) { // read buffer should not overrun save buffer
-                                                                         // more than a circle (number of buffers)
-                    // 'arm' grabber, capture image and copy it to my buffer
-                    run_capture = std::async(std::launch::async,
-                                             &EagleCamera::doSnapAndCopy, this, timeout, i_frame, _currentBuffer);
+            _droppedFrames = 0;
+            _spilledFrames = 0;
+            _lostFrames = 0;
 
+            if ( spill ) openSpoolFile();
 
-                    // trigger single exposure
-                    _startExpTimestamp[i_frame] = time_stamp(EAGLE_CAMERA_FITS_DATE_KEYWORD_FORMAT, true, &_startExpTimepoint);
-                    setTriggerMode(CL_TRIGGER_MODE_SNAPSHOT);
-#ifndef NDEBUG
-                    std::cout << "\nSTART TRIGGER\n";
-#endif
+            try {
+                startAcquisitionWorkers(timeout, exten_format);
+            } catch ( ... ) {
+                closeSpoolFile();
+                throw;
+            }
 
-                    // read temperature values
+            setAcquisitionStarted(); // release the caller of startAcquisition
 
-                    double temp = (*this)[EAGLE_CAMERA_FEATURE_CCD_TEMP_NAME];
-                    // rounding to required numbers of digits after floating point
-                    temp = std::round(temp*digits_temp_factor)/digits_temp_factor;
-                    _ccdTemp[i_frame] = temp;
+            IntegerType i_frame = 0;
 
+            bool recorder = !_acquisitionMode.compare(EAGLE_CAMERA_FEATURE_ACQUISITION_MODE_RECORDER);
+            bool streaming = recorder || !_acquisitionMode.compare(EAGLE_CAMERA_FEATURE_ACQUISITION_MODE_STREAMING);
 
-                    temp = (*this)[EAGLE_CAMERA_FEATURE_PCB_TEMP_NAME];
-                    // rounding to required numbers of digits after floating point
-                    temp = std::round(temp*digits_temp_factor)/digits_temp_factor;
-                    _pcbTemp[i_frame] = temp;
+            try {
+                if ( streaming ) { // the camera runs itself, no per-frame trigger
+                    i_frame = doStreamingAcquisition(timeout, recorder);
+                }
 
-                    if ( i_frame == 0 ) run_capture.get(); // wait for the first image
+                // the previous frame is published after the next one was captured:
+                // it is copied from grabber framebuffer during the next exposure
+                IntegerType pending_buff = -1;
+                auto publish_pending = [&]() {
+                    if ( pending_buff < 0 ) return;
+                    waitForCapturedFrames(i_frame, timeout);
+                    publishFrame(i_frame - 1, pending_buff);
+                    pending_buff = -1;
+                };
 
-                    ++_currentBuffer;
-                    if ( _currentBuffer == _frameBuffersNumber ) _currentBuffer = 0;
+                for ( ; !streaming && (i_frame < _frameCounts); ++i_frame ) {
 
-                } else --i_frame;
+                    // check for exposure abort signal
+                    if ( _stopCapturing ) { // recompute exposure duration
+#ifndef NDEBUG
+                        std::cout << "\n(stop before capturing) i_frame = " << i_frame << "\n";
+#endif
+                        std::chrono::duration<double> fp_s = _stopExpTimepoint-_startExpTimepoint;
+                        stopFrameExpTime = fp_s.count();
+                        break; // break cycle
+                    }
 
-                // save images to FITS file asynchronously
+                    // if all image buffers are still not saved it waits or
+                    // gives scratch buffer (according to backpressure policy).
+                    // the pending frame can hold the last free buffer or scratch one
+                    if ( _freeBuffers.empty() ) publish_pending();
+                    IntegerType buff_no = takeFrameBuffer();
+                    _frameTiming[buff_no] = FrameTiming();
 
-                if ( run_saving.valid() ) { // is saving thread still working?
+                    // 'arm' grabber, capture image and copy it to my buffer
+                    _captureQueue.push({i_frame, buff_no, std::chrono::steady_clock::now(), 0});
 
-                    // check for writing timeout
-                    std::chrono::duration<double> diff = std::chrono::system_clock::now() - startSavingTimepoint;
-                    if ( std::chrono::duration_cast<std::chrono::milliseconds>(diff).count() >= _fitsWritingTimeout ) {
-                        throw EagleCameraException(0,EagleCamera::Error_FitsWritingTimeout,
-                                                   "A timeout occured while writing image buffer into FITS file");
+                    // trigger single exposure
+                    _startExpTimepoint = std::chrono::system_clock::now();
+                    auto trigger_timepoint = std::chrono::steady_clock::now();
+
+                    FrameMetadata &meta = frameMetadata(i_frame);
+                    meta = FrameMetadata();
+                    meta.startUtc = _startExpTimepoint;
+                    meta.startMonotonic = trigger_timepoint;
+                    meta.expTime = _expTime;
+
+                    setSnapshotPending(true);
+                    try {
+                        setTriggerMode(CL_TRIGGER_MODE_SNAPSHOT);
+                        _frameTiming[buff_no].triggered = std::chrono::steady_clock::now();
+                        if ( _stopCapturing ) { // the abort could be sent before the trigger
+                            setTriggerMode(CL_TRIGGER_MODE_ABORT_CURRENT_EXP);
+                        }
+                    } catch ( ... ) {
+                        setSnapshotPending(false);
+                        throw;
                     }
+                    setSnapshotPending(false);
+#ifndef NDEBUG
+                    std::cout << "\nSTART TRIGGER\n";
+#endif
 
-                    auto wstatus = run_saving.wait_for(std::chrono::milliseconds(10));
+                    // wait for the image (it is copied in background)
+                    waitForSnappedFrames(i_frame + 1, timeout);
 
-                    // CFITSIO API does not allow parallel writing so just start next capturing
-                    if ( wstatus == std::future_status::timeout ) {
-                        continue; // capture next image
-                    }
-                    if ( wstatus != std::future_status::ready ) { // something wrong!
-                        throw EagleCameraException(0,EagleCamera::Error_AcquisitionProccessError,
-                                                   "Acquisition proccess failed");
+                    if ( _snapAborted ) { // no partial frame: nothing to save and to correct
+#ifndef NDEBUG
+                        std::cout << "\n(stop without partial frame) i_frame = " << i_frame << "\n";
+#endif
+                        break;
                     }
 
-                    // here wstatus == std::future_status::ready
-                    run_saving.get();
+                    // temperatures are sampled by telemetry thread
+                    setFrameTelemetry(i_frame, trigger_timepoint);
 
-                    ++lastSavingBuffer; // ready to save next image
-                    if ( lastSavingBuffer == _frameBuffersNumber ) lastSavingBuffer = 0;
-                    ++i_frameSaving;
+                    publish_pending();
+                    pending_buff = buff_no;
+                }
 
-                    if ( i_frameSaving >= i_frame ) continue; // capture next image
+                if ( (pending_buff >= 0) && (stopFrameExpTime < _expTime) ) { // the last frame was stopped
+                    FrameMetadata &meta = frameMetadata(i_frame - 1);
+                    meta.expTime = stopFrameExpTime;
+                    meta.flags |= FRAME_FLAG_ABORTED;
                 }
 
-                startSavingTimepoint = std::chrono::system_clock::now();
-                run_saving = std::async(std::launch::async,
-                                        &EagleCamera::saveToFitsFile, this, i_frameSaving,
-                                        lastSavingBuffer, _expTime, exten_format);
+                publish_pending();
 
+                // saving thread writes the remainder of the ring and exits
+                stopAcquisitionWorkers();
+            } catch ( ... ) {
+                stopAcquisitionWorkers(true);
+                closeSpoolFile();
+                throw;
             }
 
-            if ( run_capture.valid() ) {
-                run_capture.get(); // wait for the last capturing
+            closeSpoolFile();
+
+            if ( _droppedFrames || _spilledFrames ) {
+                logToFile(EagleCamera::LOG_IDENT_CAMERA_INFO, "Backpressure policy " + _backpressurePolicy +
+                          ": dropped frames = " + std::to_string(_droppedFrames) +
+                          ", spilled frames = " + std::to_string(_spilledFrames));
             }
 
-            if ( run_saving.valid() ) {
-                run_saving.get();
-                ++i_frameSaving;
+#ifndef NDEBUG
+            std::cout << "\nEND OF ACQUISITION LOOP: i_frame = " << i_frame <<
+                         ", i_frameSaving = " << _frameRing.popped() << "\n";
+#endif
 
-                ++lastSavingBuffer; // ready to save next image
-                if ( lastSavingBuffer == _frameBuffersNumber ) lastSavingBuffer = 0;
+            if ( _capturedFrames ) {
+                logToFile(EagleCamera::LOG_IDENT_CAMERA_INFO, "Capture dispatch latency: mean = " +
+                          std::to_string(_captureDispatchLatencySum/_capturedFrames) + " mksec, max = " +
+                          std::to_string(_captureDispatchLatencyMax) + " mksec");
             }
+            logLatencyStatistics();
 
+            // natively written file is complete now: its primary header (with camera info keywords)
+            // and "CUBE INFO" table are written by one write each. CFITSIO is needed for user keywords only
 
-#ifndef NDEBUG
-            std::cout << "\nEND OF ACQUISITION LOOP: _currentBuffer = " << _currentBuffer <<
-                         ", lastSavingBuffer = " << lastSavingBuffer << "\n" <<
-                         "             i_frame = " << i_frame <<
-                         ", i_frameSaving = " << i_frameSaving << "\n";
-#endif
+            bool cfitsio_file = !_nativeFitsWriting || !_fitsHdrFilename.empty();
 
-            if ( i_frameSaving < i_frame ) { // save remainder of buffers list
-                if ( _currentBuffer > lastSavingBuffer ) {
-                    for ( IntegerType i = lastSavingBuffer; i < _currentBuffer; ++i ) {
-                        saveToFitsFile(i_frameSaving++, i, _expTime, exten_format);
-                    }
-                } else {
-                    for ( IntegerType i = lastSavingBuffer; i < _frameBuffersNumber; ++i ) {
-                        saveToFitsFile(i_frameSaving++, i, _expTime, exten_format);
-                    }
-                    for ( IntegerType i = 0; i < _currentBuffer; ++i ) {
-                        saveToFitsFile(i_frameSaving++, i, _expTime, exten_format);
-                    }
+            if ( _nativeFitsWriting ) {
+                closeNativeFitsFile(i_frame, exten_format);
+
+                if ( cfitsio_file ) {
+                    CFITSIO_API_CALL( fits_open_file(&_fitsFilePtr, _fitsFilename.c_str(), READWRITE, &status),
+                                      formatFitsLogMessage("fits_open_file", _fitsFilename, READWRITE, (void*)&status) );
                 }
             }
 
-            if ( _stopCapturing && (stopFrameExpTime < _expTime)) { // re-write exposure duration keyword for the last image
+            if ( !_nativeFitsWriting && _stopCapturing && (stopFrameExpTime < _expTime)) { // re-write exposure duration keyword for the last image
                                                                     // if (stopFrameExpTime > _expTime) then
                                                                     // exposure was not active when it was stopped!
                 if ( exten_format || i_frame == 1 ) {
-                    formatFitsLogMessage("fits_update_key", TDOUBLE, EAGLE_CAMERA_FITS_KEYWORD_NAME_EXPTIME,
-                                         _expTime, EAGLE_CAMERA_FITS_KEYWORD_COMMENT_EXPTIME, (void*)&status);
                     CFITSIO_API_CALL( fits_update_key(_fitsFilePtr, TDOUBLE, EAGLE_CAMERA_FITS_KEYWORD_NAME_EXPTIME,
                                                       (void*)&stopFrameExpTime, EAGLE_CAMERA_FITS_KEYWORD_COMMENT_EXPTIME,
                                                       &status),
-                                      logMessageStream.str());
+                                      formatFitsLogMessage("fits_update_key", TDOUBLE, EAGLE_CAMERA_FITS_KEYWORD_NAME_EXPTIME,
+                                                           _expTime, EAGLE_CAMERA_FITS_KEYWORD_COMMENT_EXPTIME, (void*)&status));
                 }
             }
 
-            if ( !exten_format && _stopCapturing ) { // re-write NAXIS3 value for "CUBE" data format
+            // re-write NAXIS3 value for "CUBE" data format (acquisition was stopped or
+            // RECORDER ring was not full at trigger)
+            if ( !_nativeFitsWriting && !exten_format && (i_frame < _acquisitionFramesNumber) ) {
                 long val;
                 if ( i_frame > 1 ) { // just re-write
                     val = i_frame ;
-                    formatFitsLogMessage("fits_update_key", TLONG ,"NAXIS3", val,NULL,(void*)&status);
                     CFITSIO_API_CALL( fits_update_key(_fitsFilePtr, TLONG ,"NAXIS3", &val, NULL, &status),
-                                      logMessageStream.str() );
+                                      formatFitsLogMessage("fits_update_key", TLONG ,"NAXIS3", val,NULL,(void*)&status) );
                 } else { // delete keyword because of it is now just 2-dim image, and update "NAXIS" keyword
-                    if ( _frameCounts > 1 ) {
+                    if ( _acquisitionFramesNumber > 1 ) {
                         val = 2;
-                        formatFitsLogMessage("fits_update_key", TLONG ,"NAXIS", val,NULL,(void*)&status);
                         CFITSIO_API_CALL( fits_update_key(_fitsFilePtr, TLONG ,"NAXIS", &val, NULL, &status),
-                                          logMessageStream.str() );
-                        formatFitsLogMessage("fits_delete_key","NAXIS3",(void*)&status);
+                                          formatFitsLogMessage("fits_update_key", TLONG ,"NAXIS", val,NULL,(void*)&status) );
                         CFITSIO_API_CALL( fits_delete_key(_fitsFilePtr,"NAXIS3",&status),
-                                          logMessageStream.str());
+                                          formatFitsLogMessage("fits_delete_key","NAXIS3",(void*)&status));
                     }
                 }
             }
 
 
-            // save fits keywords values in separate ASCII-table for "CUBE" data format
-            if ( !exten_format && (i_frame > 1) ) {
-                int tfields = 4; // number of columns
-                const char* ttype[] = {"DATE-OBS", EAGLE_CAMERA_FITS_KEYWORD_NAME_EXPTIME,
-                                      EAGLE_CAMERA_FITS_KEYWORD_NAME_CCD_TEMP, EAGLE_CAMERA_FITS_KEYWORD_NAME_PCB_TEMP};
+            // save fits keywords values in separate ASCII-table for "CUBE" data format
+            if ( !_nativeFitsWriting && !exten_format && (i_frame > 1) ) {
+                int tfields = 5; // number of columns
+                const char* ttype[] = {"DATE-OBS", EAGLE_CAMERA_FITS_KEYWORD_NAME_EXPTIME,
+                                      EAGLE_CAMERA_FITS_KEYWORD_NAME_CCD_TEMP, EAGLE_CAMERA_FITS_KEYWORD_NAME_PCB_TEMP,
+                                      "DROPPED"};
+
+                std::vector<std::string> fmt = cubeInfoFormats(i_frame);
+                const char* tform[] = {fmt[0].c_str(),fmt[1].c_str(),fmt[2].c_str(),fmt[3].c_str(),fmt[4].c_str()};
+
+                CFITSIO_API_CALL( fits_create_tbl(_fitsFilePtr,ASCII_TBL,i_frame,tfields,(char**)ttype,
+                                                  (char**)tform,NULL,"CUBE INFO",&status),
+                                  formatFitsLogMessage("fits_create_tbl",ASCII_TBL,0,tfields,(void*)ttype,(void*)tform,NULL,
+                                                       "CUBE INFO",(void*)&status));
+
+                std::string timestamp;
+                const char* str;
+                int icol;
+                for ( IntegerType i = 0; i < i_frame; ++i ) {
+                    FrameMetadata &meta = _cubeMetadata[i];
+
+                    // empty for dropped frame
+                    timestamp = meta.startUtc.time_since_epoch().count() ? formatTimestamp(meta.startUtc) : "";
+                    str = timestamp.c_str();
+                    icol = 1;
+                    CFITSIO_API_CALL( fits_write_col(_fitsFilePtr,TSTRING,icol,i+1,1,1,&str,&status),
+                                      formatFitsLogMessage("fits_write_col",TSTRING,icol,i+1,1,1,str,(void*)&status));
+
+                    ++icol;
+
+                    CFITSIO_API_CALL( fits_write_col(_fitsFilePtr,TDOUBLE,icol,i+1,1,1,&meta.expTime,&status),
+                                      formatFitsLogMessage("fits_write_col",TDOUBLE,icol,i+1,1,1,meta.expTime,(void*)&status));
+
+                    ++icol;
+
+                    CFITSIO_API_CALL( fits_write_col(_fitsFilePtr,TDOUBLE,icol,i+1,1,1,&meta.ccdTemp,&status),
+                                      formatFitsLogMessage("fits_write_col",TDOUBLE,icol,i+1,1,1,meta.ccdTemp,(void*)&status));
+
+                    ++icol;
+
+                    CFITSIO_API_CALL( fits_write_col(_fitsFilePtr,TDOUBLE,icol,i+1,1,1,&meta.pcbTemp,&status),
+                                      formatFitsLogMessage("fits_write_col",TDOUBLE,icol,i+1,1,1,meta.pcbTemp,(void*)&status));
+
+                    ++icol;
+
+                    int dropped = (meta.flags & FRAME_FLAG_DROPPED) ? 1 : 0; // the plane is zero-filled
+                    CFITSIO_API_CALL( fits_write_col(_fitsFilePtr,TINT,icol,i+1,1,1,&dropped,&status),
+                                      formatFitsLogMessage("fits_write_col",TINT,icol,i+1,1,1,dropped,(void*)&status));
+                }
+
+                if ( _stopCapturing  && (stopFrameExpTime < _expTime)) { // re-write value of EXPTIME if user abort exposure
+                    CFITSIO_API_CALL( fits_write_col(_fitsFilePtr,TDOUBLE,2,i_frame,1,1,&stopFrameExpTime,&status),
+                                      formatFitsLogMessage("fits_write_col",TDOUBLE,2,i_frame,1,1,stopFrameExpTime,(void*)&status));
+                }
+            }
+
+#ifndef NDEBUG
+            std::cout << "Save FITS keywords ...\n";
+#endif
+
+            if ( !_nativeFitsWriting ) {
+                // move to primary HDU (needs if multiple extensions format was used)
+                CFITSIO_API_CALL( fits_movabs_hdu(_fitsFilePtr, 1, NULL, &status),
+                                  formatFitsLogMessage("fits_movabs_hdu", 1, 0, (void*)&status));
+
+                // write camera info FITS keywords (the header is built in memory at once)
+                FitsStreamWriter::Header info_hdr;
+                fitsCameraInfoHeader(info_hdr);
+                writeFitsHeaderCards(info_hdr, true);
+            }
+
+            if ( cfitsio_file ) {
+                // write user FITS keywords
+                if ( !_fitsHdrFilename.empty() ) {
+                    CFITSIO_API_CALL( fits_write_key_template(_fitsFilePtr, _fitsHdrFilename.c_str(),&status),
+                                      formatFitsLogMessage("fits_write_key_template", _fitsHdrFilename, (void*)&status));
+                }
+
+                CFITSIO_API_CALL( fits_close_file(_fitsFilePtr,&status),
+                                  formatFitsLogMessage("fits_close_file",(void*)&status));
+            }
+
+#ifndef NDEBUG
+            std::cout << "  OK (FITS keywords)\n";
+#endif
+        } catch ( EagleCameraException ex ) {
+#ifndef NDEBUG
+            std::cout << "ACQ PROCCESS ERROR: " << ex.XCLIB_Error() << ", " << ex.Camera_Error() << "\n";
+            std::cout << "ACQ PROCCESS ERROR: " << ex.what() << "\n";
+#endif
+            _fitsWorkerPool.stop();
+            _fitsCubeMap = nullptr;
+            _fitsStreamWriter.close();
+            setAcquisitionStarted(std::make_exception_ptr(ex));
+            notifyProgress(true); // the callback is called before waiters of _acquiringFinished are released
+            _acquiringFinished = true;
+            throw ex;
+        } catch ( ... ) {
+            _fitsWorkerPool.stop();
+            _fitsCubeMap = nullptr;
+            _fitsStreamWriter.close();
+            setAcquisitionStarted(std::current_exception());
+            notifyProgress(true);
+            _acquiringFinished = true;
+            throw;
+        }
+
+#ifndef NDEBUG
+        std::cout << "END OF ACQUSITION\n";
+#endif
+        notifyProgress(true);
+        _acquiringFinished = true;
+    });
+
+    _acquisitionProccessThreadFuture = acquisition_task.get_future().share();
+    _acquisitionProccessThread = std::thread(std::move(acquisition_task));
+
+
+    // wait until FITS file is created and acquisition workers are started
+    // (or an error occured) and re-throw possible error
+
+    {
+        std::unique_lock<std::mutex> lock(_acquisitionStateMutex);
+        _acquisitionStateCond.wait(lock, [this]{return _acquisitionStarted;});
+    }
+
+    if ( _acquisitionStartError ) std::rethrow_exception(_acquisitionStartError);
+}
+
+
+std::shared_future<void> EagleCamera::acquisitionCompletion() const
+{
+    return _acquisitionProccessThreadFuture;
+}
+
+
+bool EagleCamera::waitForAcquisition(const long timeout)
+{
+    std::shared_future<void> completion = _acquisitionProccessThreadFuture;
+    if ( !completion.valid() ) return true; // nothing to wait for
+
+    if ( timeout < 0 ) {
+        completion.wait();
+    } else if ( completion.wait_for(std::chrono::milliseconds(timeout)) != std::future_status::ready ) {
+        return false;
+    }
+
+    completion.get(); // re-throw an error of acquisition
+
+    return true;
+}
+
+
+EagleCamera::AcquisitionProgress EagleCamera::acquisitionProgress()
+{
+    AcquisitionProgress progress;
+
+    progress.capturedFrames = _publishedFrames;
+    progress.savedFrames = _savedFrames;
+    progress.bytesWritten = _bytesWritten;
+    progress.finished = _acquiringFinished;
+
+    return progress;
+}
+
+
+void EagleCamera::setProgressCallback(const progress_callback_t &callback)
+{
+    if ( !_acquiringFinished ) throw EagleCameraException(0,EagleCamera::Error_CameraIsAcquiring,"Camera is acquiring");
+
+    _progressCallback = callback;
+}
+
+
+void EagleCamera::notifyProgress(const bool finished)
+{
+    if ( !_progressCallback ) return;
+
+    AcquisitionProgress progress = acquisitionProgress();
+    progress.finished = finished;
+
+    try {
+        std::lock_guard<std::mutex> lock(_progressMutex);
+        _progressCallback(progress);
+    } catch ( ... ) { // an error of user code must not break acquisition
+        logToFile(EagleCamera::LOG_IDENT_CAMERA_ERROR, "Progress callback throws an exception");
+    }
+}
+
+
+void EagleCamera::setAcquisitionStarted(const std::exception_ptr &err)
+{
+    {
+        std::lock_guard<std::mutex> lock(_acquisitionStateMutex);
+        if ( _acquisitionStarted ) return; // an error after start will be re-thrown by the future
+        _acquisitionStartError = err;
+        _acquisitionStarted = true;
+    }
+    _acquisitionStateCond.notify_all();
+}
+
+
+std::string EagleCamera::formatTimestamp(const std::chrono::system_clock::time_point &tp)
+{
+    return time_stamp_at(tp, EAGLE_CAMERA_FITS_DATE_KEYWORD_FORMAT, true);
+}
+
+
+void EagleCamera::triggerRecorder()
+{
+    _recorderTriggered = true;
+}
+
+
+const EagleCamera::LatencyHistogram& EagleCamera::latencyHistogram(const EagleCameraLatencyStage stage) const
+{
+    if ( (stage < 0) || (stage >= LATENCY_STAGES_NUMBER) ) {
+        throw EagleCameraException(0, EagleCamera::Error_InvalidFeatureValue, "Invalid latency stage!");
+    }
+
+    return _latencyHistogram[stage];
+}
+
+
+void EagleCamera::stopAcquisition()
+{
+#ifndef NDEBUG
+    std::cout << "\nABORT EXPOSURE!!!\n";
+#endif
+    _stopExpTimepoint = std::chrono::system_clock::now();
+    setTriggerMode(CL_TRIGGER_MODE_ABORT_CURRENT_EXP); // set abort exp bit
+    _stopCapturing = true;
+    _sequenceStopped = true;
+
+    notifyAcquisitionState(); // wake up capturing thread waiting for the end of exposure
+    _grabberFieldEvent.wakeUp(); // or waiting for captured field
+}
+
+
+void EagleCamera::imageReady(const IntegerType frame_no, const ushort *image_buffer, const size_t buffer_len)
+{
+}
+
+
+EagleCamera::CameraFeatureProxy & EagleCamera::operator [](const std::string & name)
+{
+    if ( cameraUnitmap <= 0 ) {
+        throw EagleCameraException(0,EagleCamera::Error_Uninitialized,"Try to access feature for uninitialized camera!");
+    }
+
+    auto search = PREDEFINED_CAMERA_FEATURES.find(name);
+
+    if ( search != PREDEFINED_CAMERA_FEATURES.end() ) {
+        currentCameraFeature = (search->second).get();
+    } else {
+        currentCameraFeature = nullptr;
+        std::string log_str = "'" + name + "' is unknown camera feature!";
+        throw EagleCameraException(0,EagleCamera::Error_UnknowFeature,log_str);
+    }
+
+    return cameraFeature;
+}
+
+
+EagleCamera::CameraFeatureProxy & EagleCamera::operator[](const char* name)
+{
+    return operator [](std::string(name));
+}
+
+
+
+void EagleCamera::logToFile(const EagleCamera::EagleCameraLogIdent ident, const std::string &log_str, const int indent_tabs)
+{
+    if ( !cameraLog ) return;
+
+    if ( logLevel == EagleCamera::LOG_LEVEL_QUIET ) return;
+
+    logMutex.lock();
+
+    std::string tab;
+    if ( indent_tabs > 0 ) tab.resize(indent_tabs*EAGLE_CAMERA_DEFAULT_LOG_TAB, ' ');
+
+    std::string str = "[" + time_stamp() + "]";
+
+    switch ( ident ) {
+    case EagleCamera::LOG_IDENT_BLANK:
+        *cameraLog  << log_str << std::endl << std::flush;
+        return;
+    case EagleCamera::LOG_IDENT_CAMERA_INFO:
+        str += "[CAMERA INFO] ";
+        break;
+    case EagleCamera::LOG_IDENT_CAMERA_ERROR:
+        str += "[CAMERA ERROR] ";
+        break;
+    case EagleCamera::LOG_IDENT_XCLIB_INFO:
+        str += "[XCLIB INFO] ";
+        break;
+    case EagleCamera::LOG_IDENT_XCLIB_ERROR:
+        str += "[XCLIB ERROR] ";
+        break;
+    default:
+        break;
+    }
+
+
+    *cameraLog << str << tab << log_str << std::endl << std::flush;
+
+    logMutex.unlock();
+}
+
+
+
+void EagleCamera::logToFile(const EagleCameraException &ex, const int indent_tabs)
+{
+    if ( ex.XCLIB_Error() < 0 ) { // XCLIB errors
+        std::string log_str = ex.what();
+        log_str += " [XCLIB ERROR CODE: " + std::to_string(ex.XCLIB_Error()) + "]";
+
+        logToFile(EagleCamera::LOG_IDENT_XCLIB_ERROR, log_str, indent_tabs);
+    }
+
+    if ( ex.Camera_Error() != EagleCamera::Error_OK ) {
+        std::string log_str = ex.what();
+        if ( ex.Camera_Error() == EagleCamera::Error_FITS_ERR ) {
+            log_str += " [CFITSIO ERROR CODE: " + std::to_string(ex.XCLIB_Error()) + "]";
+        } else {
+            log_str += " [CAMERA ERROR CODE: " + std::to_string(ex.Camera_Error()) + "]";
+        }
+
+        logToFile(EagleCamera::LOG_IDENT_CAMERA_ERROR, log_str, indent_tabs);
+    }
+}
+
+
+
+                            /*  PROTECTED METHODS  */
+
+bool EagleCamera::doSnap(const ulong timeout, const IntegerType frame_no, const IntegerType buff_no, const long grabber_buff)
+{
+    try {
+#ifndef NDEBUG
+        std::cout << "\nCAPTURE (frame_no = " << frame_no << ", buff_no = " << buff_no <<
+                     ", grabber_buff = " << grabber_buff << ") ";
+#endif
+
+        if ( !snapFrame(grabber_buff, timeout) ) return false;
+        _frameTiming[buff_no].snapped = std::chrono::steady_clock::now();
+
+#ifndef NDEBUG
+        std::cout << "OK CAPTURE\n";
+#endif
+    } catch ( EagleCameraException &ex ) {
+        throw;
+    }
+
+    return true;
+}
+
+
+bool EagleCamera::snapFrame(const long grabber_buff, const ulong timeout)
+{
+    XCLIB_API_CALL( XCLIB_SERIALIZED(pxd_goSnap(cameraUnitmap, grabber_buff)),
+                    formatLogMessage("pxd_goSnap", grabber_buff));
+
+    auto now = std::chrono::steady_clock::now();
+    auto deadline = now + std::chrono::milliseconds(timeout);
+
+    // do not poll grabber until the expected end of exposure, but wake up on abort request
+    auto exp_end = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>
+                           (std::chrono::duration<double>(_expTime));
+    bool aborted = false;
+
+    while ( XCLIB_SERIALIZED(pxd_goneLive(cameraUnitmap, 0)) ) {
+        now = std::chrono::steady_clock::now();
+
+        if ( !aborted && _stopCapturing ) { // exposure is aborted: the camera reads out partial frame
+            aborted = true;
+            deadline = now + std::chrono::milliseconds(_abortReadoutTimeout);
+            exp_end = now;
+        }
+
+        if ( now >= deadline ) {
+            XCLIB_SERIALIZED(pxd_goAbortLive(cameraUnitmap));
+            if ( aborted ) {
+                logToFile(EagleCamera::LOG_IDENT_CAMERA_ERROR, "Partial frame has not been read out after exposure abort");
+                return false;
+            }
+            throw EagleCameraException(0,EagleCamera::Error_AcquisitionProccessError,
+                                       "A timeout occured while waiting for snapping of image");
+        }
+
+        if ( _grabberFieldEvent.isOpen() ) { // the grabber signals the captured field, stopAcquisition wakes up
+            _grabberFieldEvent.wait(deadline);
+            continue;
+        }
+
+        auto wake = now + std::chrono::milliseconds(EAGLE_CAMERA_DEFAULT_SNAP_POLL_INTERVAL);
+        if ( exp_end > wake ) wake = exp_end;
+        if ( wake > deadline ) wake = deadline;
+
+        std::unique_lock<std::mutex> lock(_acquisitionStateMutex);
+        _acquisitionStateCond.wait_until(lock, wake, [&]{return !aborted && _stopCapturing;});
+    }
+
+    return true;
+}
+
+
+void EagleCamera::copyFrameBuffer(const long grabber_buff, const IntegerType frame_no, const IntegerType buff_no)
+{
+#ifndef NDEBUG
+    std::cout << "AND READ IMAGE TO BUFFER ...";
+#endif
+
+    readGrabberPixels(grabber_buff, 0, _imagePixelsNumber, _imageBuffer[buff_no]);
+    _frameTiming[buff_no].copied = std::chrono::steady_clock::now();
+}
+
+
+void EagleCamera::readGrabberPixels(const long grabber_buff, const IntegerType first_line,
+                                    const size_t npix, ushort *buff)
+{
+    char col[] = "Gray";
+
+    // whole framebuffer lines
+
+    IntegerType n_lines = npix/_ccdDimension[0];
+    size_t len = n_lines*_ccdDimension[0];
+
+    if ( n_lines ) {
+        XCLIB_API_CALL(XCLIB_SERIALIZED(pxd_readushort(cameraUnitmap, grabber_buff, 0, first_line, -1, first_line+n_lines,
+                                                       buff, len, (char*)col)),
+                       formatLogMessage("pxd_readushort", grabber_buff, 0, first_line, -1, first_line+n_lines,
+                                        (void*)buff, len, col));
+    }
+
+    // the rest of pixels in incomplete line
+
+    IntegerType rest = npix - len;
+
+    if ( rest ) {
+        XCLIB_API_CALL(XCLIB_SERIALIZED(pxd_readushort(cameraUnitmap, grabber_buff, 0, first_line+n_lines, rest, first_line+n_lines+1,
+                                                       buff+len, rest, (char*)col)),
+                       formatLogMessage("pxd_readushort", grabber_buff, 0, first_line+n_lines, rest, first_line+n_lines+1,
+                                        (void*)(buff+len), rest, col));
+    }
+}
+
+
+EagleCamera::IntegerType EagleCamera::doStreamingAcquisition(const ulong timeout, const bool recorder)
+{
+    double frame_rate = (*this)[EAGLE_CAMERA_FEATURE_FRAME_RATE_NAME];
+    std::chrono::duration<double> frame_period(1.0/frame_rate);
+
+    // start grabber continuous capturing into all its frame buffers (1, 2, ..., Nbuffs, 1, 2, ...)
+
+    uint32_t start_field;
+    long Nbuffs = _grabberBuffersNumber;
+
+    XCLIB_API_CALL( XCLIB_SERIALIZED(pxd_goLiveSeq(cameraUnitmap, 1, Nbuffs, 1, 0, 1)),
+                    formatLogMessage("pxd_goLiveSeq", 1, Nbuffs, 1, 0, 1));
+
+    start_field = XCLIB_SERIALIZED(pxd_capturedFieldCount(cameraUnitmap));
+
+    IntegerType i_frame = 0;    // number of delivered frames
+    IntegerType next_field = 0; // sequence number (since start) of the next frame to be read
+    _lostFrames = 0;
+
+    try {
+        // start camera once. it generates frames with rate given by 'FrameRate' feature
+        setTriggerMode(CL_TRIGGER_MODE_FIXED_FRAME_RATE | CL_TRIGGER_MODE_CONTINUOUS_SEQ);
+        _startExpTimepoint = std::chrono::system_clock::now();
+        auto start_timepoint = std::chrono::steady_clock::now();
+        auto last_frame_timepoint = start_timepoint;
+
+        IntegerType buff_no = -1; // image buffer for the next frame
+
+        IntegerType frames_to_save = _acquisitionFramesNumber;
+
+        // RECORDER mode: frames (image buffer and field sequence number) waiting for trigger
+        std::deque<std::pair<IntegerType, IntegerType>> held_frames;
+        bool holding = recorder;
+
+        // frames are generated with fixed rate
+        auto publish = [&](const IntegerType buff, const IntegerType field) {
+            auto frame_start = _startExpTimepoint + std::chrono::duration_cast<std::chrono::system_clock::duration>
+                                                     (frame_period*field);
+            auto frame_start_monotonic = start_timepoint + std::chrono::duration_cast<std::chrono::steady_clock::duration>
+                                                           (frame_period*field);
+
+            FrameMetadata &meta = frameMetadata(i_frame);
+            meta = FrameMetadata();
+            meta.startUtc = frame_start;
+            meta.startMonotonic = frame_start_monotonic;
+            meta.expTime = _expTime;
+
+            setFrameTelemetry(i_frame, frame_start_monotonic);
+
+            publishFrame(i_frame, buff);
+            ++i_frame;
+        };
+
+        while ( (i_frame < frames_to_save) && !_stopCapturing ) {
+            if ( holding && _recorderTriggered ) { // flush memory ring and save the next _frameCounts frames
+                holding = false;
+                for ( auto &held: held_frames ) publish(held.first, held.second);
+                held_frames.clear();
+                frames_to_save = i_frame + _frameCounts;
+
+                logToFile(EagleCamera::LOG_IDENT_CAMERA_INFO, "Recorder is triggered: " +
+                          std::to_string(i_frame) + " pre-trigger frames are flushed");
+                continue;
+            }
+
+            IntegerType grabbed = static_cast<uint32_t>(XCLIB_SERIALIZED(pxd_capturedFieldCount(cameraUnitmap)) - start_field);
+
+            if ( grabbed == next_field ) { // no new frames
+                auto waiting = std::chrono::steady_clock::now() - last_frame_timepoint;
+                if ( waiting >= std::chrono::milliseconds(timeout) ) {
+                    throw EagleCameraException(0,EagleCamera::Error_AcquisitionProccessError,
+                                               "A timeout occured while waiting for the next frame of streaming");
+                }
+
+                if ( _grabberFieldEvent.isOpen() ) { // wake up on captured field or on stop request
+                    _grabberFieldEvent.wait(last_frame_timepoint + std::chrono::milliseconds(timeout));
+                    continue;
+                }
+
+                // no event: sleep until the expected time of the next frame readout
+                // (but not too long to be responsive to stop request)
+                auto expected = start_timepoint + std::chrono::duration_cast<std::chrono::steady_clock::duration>
+                                                     (frame_period*(grabbed + 1));
+                auto now = std::chrono::steady_clock::now();
+                auto max_sleep = std::chrono::milliseconds(EAGLE_CAMERA_DEFAULT_STREAMING_MAX_SLEEP);
+                if ( expected > now + max_sleep ) expected = now + max_sleep;
+                if ( expected <= now ) expected = now + std::chrono::microseconds(EAGLE_CAMERA_SERIAL_BYTE_TIME);
+                std::this_thread::sleep_until(expected);
+                continue;
+            }
+            last_frame_timepoint = std::chrono::steady_clock::now();
+
+            // field 'grabbed' is being captured into grabber buffer of field 'grabbed' - Nbuffs,
+            // so the oldest readable field is 'grabbed' - Nbuffs + 1
+            if ( (grabbed - next_field) >= Nbuffs ) { // grabber has already re-written the frames
+                _lostFrames += grabbed - next_field - Nbuffs + 1;
+                next_field = grabbed - Nbuffs + 1;
+            }
+
+            if ( buff_no < 0 ) {
+                if ( holding && (held_frames.size() == static_cast<size_t>(_preTriggerFrames)) ) { // forget the oldest frame
+                    buff_no = held_frames.front().first;
+                    held_frames.pop_front();
+                } else {
+                    buff_no = takeFrameBuffer();
+                }
+            }
+
+            // there is no trigger command in streaming mode: the stages start from frame detection
+            _frameTiming[buff_no] = FrameTiming();
+            _frameTiming[buff_no].snapped = last_frame_timepoint;
+
+            bool drop = (buff_no == _scratchBuffer) &&
+                        _backpressurePolicy.compare(EAGLE_CAMERA_FEATURE_BACKPRESSURE_POLICY_SPILL);
+
+            if ( !drop ) { // do not copy a frame to be dropped
+                copyFrameBuffer(next_field % Nbuffs + 1, i_frame, buff_no);
+
+                // was grabber buffer re-written during reading?
+                grabbed = static_cast<uint32_t>(XCLIB_SERIALIZED(pxd_capturedFieldCount(cameraUnitmap)) - start_field);
+                if ( (grabbed - next_field) >= Nbuffs ) { // the image buffer will be used for the next frame
+                    ++_lostFrames;
+                    ++next_field;
+                    continue;
+                }
+            }
+
+            if ( holding ) { // there are always free buffers here, so it is not scratch one
+                held_frames.push_back(std::make_pair(buff_no, next_field));
+            } else {
+                publish(buff_no, next_field);
+            }
+            buff_no = -1;
+
+            ++next_field;
+        }
+    } catch ( ... ) {
+        setTriggerMode(0x0); // IDLE mode
+        XCLIB_SERIALIZED(pxd_goUnLive(cameraUnitmap));
+        throw;
+    }
+
+    setTriggerMode(0x0); // stop sequence (IDLE mode)
+
+    XCLIB_API_CALL( XCLIB_SERIALIZED(pxd_goUnLive(cameraUnitmap)),
+                    formatLogMessage("pxd_goUnLive"));
+
+    if ( _lostFrames ) {
+        logToFile(EagleCamera::LOG_IDENT_CAMERA_ERROR, "Number of lost frames during streaming: " +
+                  std::to_string(_lostFrames));
+    }
+
+    return i_frame;
+}
+
+
+void EagleCamera::sampleTelemetry()
+{
+    TelemetrySample sample;
+
+    // call getters directly: camera feature proxy is not thread-safe
+    sample.ccdTemp = getCCDTemp();
+    sample.pcbTemp = getPCBTemp();
+    sample.time = std::chrono::steady_clock::now();
+
+    _telemetryRing.push(sample);
+}
+
+
+// camera whose telemetry is sampled by the current thread (if any)
+static thread_local const EagleCamera *telemetry_camera = nullptr;
+
+
+void EagleCamera::setSnapshotPending(const bool pending)
+{
+    {
+        std::lock_guard<std::mutex> lock(_telemetryMutex);
+        _snapshotPending = pending;
+    }
+
+    if ( !pending ) _telemetryCond.notify_all();
+}
+
+
+void EagleCamera::waitForSnapshotTrigger()
+{
+    if ( telemetry_camera != this ) return;
+
+    std::unique_lock<std::mutex> lock(_telemetryMutex);
+    _telemetryCond.wait(lock, [this]{return !_snapshotPending || _telemetryStop;});
+}
+
+
+void EagleCamera::startTelemetrySampler()
+{
+    _telemetryRing.reset();
+    _telemetryStop = false;
+
+    sampleTelemetry(); // each frame must have a sample
+
+    _telemetryThread = std::thread([this]() {
+        applyThreadScheduling(_telemetryThreadScheduling, "telemetry");
+        telemetry_camera = this;
+
+        std::chrono::duration<double> period(1.0/_telemetryRate);
+
+        std::unique_lock<std::mutex> lock(_telemetryMutex);
+        while ( !_telemetryCond.wait_for(lock, period, [this]{return _telemetryStop;}) ) {
+            lock.unlock();
+            try {
+                sampleTelemetry();
+            } catch ( EagleCameraException &ex ) { // frames will get the previous sample
+                logToFile(ex);
+            }
+            lock.lock();
+        }
+    });
+}
+
+
+void EagleCamera::applyThreadScheduling(const ThreadScheduling &sched, const std::string &thread_name)
+{
+    std::vector<int> cpus;
+    parseCpuList(sched.affinity, cpus); // it was checked by feature setter
+    if ( cpus.empty() ) cpus = _numaCpus;
+
+    bool realtime = sched.policy.compare(EAGLE_CAMERA_FEATURE_THREAD_POLICY_OTHER) != 0;
+
+#ifdef EAGLE_CAMERA_THREADS_WIN
+    HANDLE thread = GetCurrentThread();
+
+    if ( realtime ) {
+        int priority = (sched.priority >= 50) ? THREAD_PRIORITY_TIME_CRITICAL : THREAD_PRIORITY_HIGHEST;
+        if ( !SetThreadPriority(thread, priority) ) {
+            logToFile(EagleCamera::LOG_IDENT_CAMERA_ERROR, "Cannot set priority of " + thread_name +
+                      " thread (error " + std::to_string(GetLastError()) + ")");
+        }
+    }
+
+    if ( !cpus.empty() ) {
+        DWORD_PTR mask = 0;
+        for ( int cpu: cpus ) {
+            if ( cpu < static_cast<int>(8*sizeof(DWORD_PTR)) ) mask |= static_cast<DWORD_PTR>(1) << cpu;
+        }
+        if ( !SetThreadAffinityMask(thread, mask) ) {
+            logToFile(EagleCamera::LOG_IDENT_CAMERA_ERROR, "Cannot set CPU affinity of " + thread_name +
+                      " thread (error " + std::to_string(GetLastError()) + ")");
+        }
+    }
+#else
+    if ( realtime ) {
+        int policy = sched.policy.compare(EAGLE_CAMERA_FEATURE_THREAD_POLICY_FIFO) ? SCHED_RR : SCHED_FIFO;
+
+        sched_param param;
+        param.sched_priority = std::max(sched_get_priority_min(policy),
+                                        std::min(static_cast<int>(sched.priority), sched_get_priority_max(policy)));
+
+        int err = pthread_setschedparam(pthread_self(), policy, &param);
+        if ( err ) { // e.g. no CAP_SYS_NICE or RLIMIT_RTPRIO is exceeded
+            logToFile(EagleCamera::LOG_IDENT_CAMERA_ERROR, "Cannot set " + sched.policy + " scheduling policy of " +
+                      thread_name + " thread: " + strerror(err));
+        }
+    }
+
+#ifdef __linux__
+    if ( !cpus.empty() ) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for ( int cpu: cpus ) {
+            if ( cpu < CPU_SETSIZE ) CPU_SET(cpu, &set);
+        }
+
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if ( err ) {
+            logToFile(EagleCamera::LOG_IDENT_CAMERA_ERROR, "Cannot set CPU affinity of " + thread_name +
+                      " thread: " + strerror(err));
+        }
+    }
+#endif
+#endif
+}
+
+
+bool EagleCamera::numaNodeCpus(const int node, std::vector<int> &cpus)
+{
+    cpus.clear();
+    if ( node < 0 ) return false;
+
+#ifdef EAGLE_CAMERA_THREADS_WIN
+    ULONGLONG mask = 0;
+    if ( (node > 255) || !GetNumaNodeProcessorMask(static_cast<UCHAR>(node), &mask) ) return false;
+
+    for ( int cpu = 0; cpu < static_cast<int>(8*sizeof(mask)); ++cpu ) {
+        if ( mask & (static_cast<ULONGLONG>(1) << cpu) ) cpus.push_back(cpu);
+    }
+#else
+    std::ifstream cpulist("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string list;
+    if ( !std::getline(cpulist, list) || !parseCpuList(list, cpus) ) {
+        cpus.clear();
+        return false;
+    }
+#endif
+
+    return !cpus.empty();
+}
+
+
+bool EagleCamera::parseCpuList(const std::string &list, std::vector<int> &cpus)
+{
+    cpus.clear();
+
+    std::istringstream ist(list);
+    std::string item;
+
+    while ( std::getline(ist, item, ',') ) {
+        item = trim_spaces(item);
+        if ( item.empty() ) return false;
+
+        size_t pos = item.find('-');
+        int first, last;
+        try {
+            size_t n;
+            first = std::stoi(item.substr(0, pos), &n);
+            if ( n != item.substr(0, pos).size() ) return false;
+            if ( pos == std::string::npos ) {
+                last = first;
+            } else {
+                last = std::stoi(item.substr(pos+1), &n);
+                if ( n != item.substr(pos+1).size() ) return false;
+            }
+        } catch ( std::exception & ) {
+            return false;
+        }
+
+        // reject CPUs the affinity mask can not hold (it also limits the list length)
+        if ( (first < 0) || (last < first) || (last >= EAGLE_CAMERA_MAX_CPU_NUMBER) ) return false;
+
+        for ( int cpu = first; cpu <= last; ++cpu ) cpus.push_back(cpu);
+    }
+
+    return true;
+}
+
+
+void EagleCamera::stopTelemetrySampler()
+{
+    {
+        std::lock_guard<std::mutex> lock(_telemetryMutex);
+        _telemetryStop = true;
+    }
+    _telemetryCond.notify_all();
+
+    if ( _telemetryThread.joinable() ) _telemetryThread.join();
+}
+
+
+void EagleCamera::setFrameTelemetry(const IntegerType frame_no, const std::chrono::steady_clock::time_point &tp)
+{
+    TelemetrySample sample;
+
+    if ( !_telemetryRing.nearest(tp, sample) ) return;
+
+    // rounding to required numbers of digits after floating point
+    double digits_temp_factor = pow(10.0,EAGLE_CAMERA_DEFAULT_TEMP_VALUE_DIGITS);
+
+    FrameMetadata &meta = frameMetadata(frame_no);
+    meta.ccdTemp = std::round(sample.ccdTemp*digits_temp_factor)/digits_temp_factor;
+    meta.pcbTemp = std::round(sample.pcbTemp*digits_temp_factor)/digits_temp_factor;
+    meta.flags |= FRAME_FLAG_TELEMETRY;
+}
+
+
+void EagleCamera::startAcquisitionWorkers(const ulong timeout, const bool as_extension)
+{
+    startTelemetrySampler();
+
+    if ( !_grabberFieldEvent.open(cameraUnitmap) ) {
+        logToFile(EagleCamera::LOG_IDENT_CAMERA_INFO, "XCLIB captured field event is not available: poll grabber");
+    }
+
+    _captureQueue.reset();
+    _copyQueue.reset();
+
+    _capturedFrames = 0;
+    _snappedFrames = 0;
+    _captureError = nullptr;
+    _savingError = nullptr;
+    _snapAborted = false;
+
+    _captureDispatchLatencySum = 0;
+    _captureDispatchLatencyMax = 0;
+
+    _captureThread = std::thread([this, timeout]() {
+        applyThreadScheduling(_captureThreadScheduling, "capturing");
+
+        AcquisitionJob job;
+        try {
+            while ( _captureQueue.pop(job) ) {
+                // time elapsed from job submission to start of capturing (the cost of a thread dispatching)
+                int64_t latency = std::chrono::duration_cast<std::chrono::microseconds>
+                                    (std::chrono::steady_clock::now() - job.submitted).count();
+                _captureDispatchLatencySum += latency;
+                if ( latency > _captureDispatchLatencyMax ) _captureDispatchLatencyMax = latency;
+
+                // frames are captured into grabber framebuffers in round-robin order (in zero-copy
+                // mode into the framebuffer of image buffer). a framebuffer is re-armed only after
+                // the previous image in it was copied
+                long grabber_buff;
+                if ( _zeroCopyFrames ) {
+                    grabber_buff = job.buff_no + 1;
+                } else {
+                    grabber_buff = job.frame_no % _grabberBuffersNumber + 1;
+                    if ( job.frame_no >= _grabberBuffersNumber ) {
+                        waitForCapturedFrames(job.frame_no - _grabberBuffersNumber + 1, timeout);
+                    }
+                }
+
+                if ( doSnap(timeout, job.frame_no, job.buff_no, grabber_buff) ) {
+                    _copyQueue.push({job.frame_no, job.buff_no, std::chrono::steady_clock::now(), grabber_buff});
+                } else {
+                    _snapAborted = true;
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(_acquisitionStateMutex);
+                    ++_snappedFrames;
+                }
+                _acquisitionStateCond.notify_all();
+            }
+        } catch ( ... ) {
+            {
+                std::lock_guard<std::mutex> lock(_acquisitionStateMutex);
+                if ( !_captureError ) _captureError = std::current_exception();
+            }
+            _acquisitionStateCond.notify_all();
+        }
+    });
+
+    _copyThread = std::thread([this]() {
+        applyThreadScheduling(_captureThreadScheduling, "copying");
+
+        AcquisitionJob job;
+        try {
+            while ( _copyQueue.pop(job) ) {
+                if ( !_zeroCopyFrames ) copyFrameBuffer(job.grabber_buff, job.frame_no, job.buff_no);
+
+                {
+                    std::lock_guard<std::mutex> lock(_acquisitionStateMutex);
+                    ++_capturedFrames;
+                }
+                _acquisitionStateCond.notify_all();
+            }
+        } catch ( ... ) {
+            {
+                std::lock_guard<std::mutex> lock(_acquisitionStateMutex);
+                if ( !_captureError ) _captureError = std::current_exception();
+            }
+            _acquisitionStateCond.notify_all();
+        }
+    });
+
+    if ( _spoolWriteFile ) { // SPILL backpressure policy
+        _spillStopped = false;
+        _spillThread = std::thread(&EagleCamera::runSpillThread, this);
+    }
+
+    // the pipeline: user processing stages and FITS writer as the last one. the first
+    // stage gets frames from _frameRing, the others from bounded rings of previous stages
+
+    size_t Nstages = _processingStages.size() + 1;
+    size_t Nbuffers = _acquisitionBuffersNumber + ((_restoreBuffer < 0) ? 0 : 1);
+
+    _stageRings.resize(Nstages - 1);
+    for ( size_t i = 1; i < Nstages; ++i ) {
+        size_t capacity = (i < _processingStages.size()) ? _processingStages[i]->queueCapacity() : Nbuffers;
+        if ( !capacity ) capacity = 1;
+        if ( capacity > Nbuffers ) capacity = Nbuffers;
+
+        if ( !_stageRings[i-1] ) _stageRings[i-1] = std::unique_ptr<FrameRing>(new FrameRing());
+        _stageRings[i-1]->reset(capacity);
+    }
+
+    _restoreBufferBusy = false;
+
+    // consumers get frames after the last stage which modifies pixels
+
+    _fanOutStage = 0;
+    for ( size_t i = 0; i < _processingStages.size(); ++i ) {
+        if ( _processingStages[i]->modifiesPixels() ) _fanOutStage = i + 1;
+    }
+
+    startFrameConsumers();
+
+    _pipelineThreads.clear();
+    for ( size_t i = 0; i < Nstages; ++i ) {
+        _pipelineThreads.push_back(std::thread(&EagleCamera::runPipelineStage, this, i, as_extension));
+    }
+
+    // frames of mapped cube are written concurrently: each writer pops the next frame of the same input
+    _cubeWriterThreads.clear();
+    for ( size_t i = 1; i < _fitsCubeWriters; ++i ) {
+        _cubeWriterThreads.push_back(std::thread(&EagleCamera::runPipelineStage, this, Nstages - 1, as_extension));
+    }
+}
+
+
+void EagleCamera::stopAcquisitionWorkers(const bool abort)
+{
+    stopTelemetrySampler();
+
+    _captureQueue.close(abort);
+    if ( _captureThread.joinable() ) _captureThread.join();
+
+    _grabberFieldEvent.close();
+
+    _copyQueue.close(abort);
+    if ( _copyThread.joinable() ) _copyThread.join();
+
+    // frames are published by the caller, so all the spilled ones are already queued
+    _spillRing.close(abort);
+    notifyAcquisitionState();
+    if ( _spillThread.joinable() ) _spillThread.join();
+
+    // stages are stopped in order: each one drains its input and closes the next one
+
+    if ( abort ) {
+        for ( size_t i = 0; i < _pipelineThreads.size(); ++i ) pipelineInput(i).close(true);
+    }
+
+    for ( size_t i = 0; i < _pipelineThreads.size(); ++i ) {
+        pipelineInput(i).close(abort);
+        notifyAcquisitionState();
+        if ( _pipelineThreads[i].joinable() ) _pipelineThreads[i].join();
+    }
+    _pipelineThreads.clear();
+
+    for ( auto &thread: _cubeWriterThreads ) { // their input is already closed
+        if ( thread.joinable() ) thread.join();
+    }
+    _cubeWriterThreads.clear();
+
+    stopFrameConsumers(abort);
+
+    if ( abort ) return;
+
+    if ( _captureError ) std::rethrow_exception(_captureError);
+    if ( _savingError ) std::rethrow_exception(_savingError);
+}
+
+
+void EagleCamera::notifyAcquisitionState()
+{
+    // lock the mutex to not lose a wakeup of a thread which checked the ring
+    // state under the mutex but has not started to wait yet
+    {
+        std::lock_guard<std::mutex> lock(_acquisitionStateMutex);
+    }
+    _acquisitionStateCond.notify_all();
+}
+
+
+void EagleCamera::waitForCapturedFrames(const IntegerType frames_number, const ulong timeout)
+{
+    std::unique_lock<std::mutex> lock(_acquisitionStateMutex);
+
+    bool ok = _acquisitionStateCond.wait_for(lock, std::chrono::milliseconds(timeout),
+                                             [&]{return _captureError || (_capturedFrames >= frames_number);});
+
+    if ( _captureError ) std::rethrow_exception(_captureError);
+
+    if ( !ok ) { // something is wrong!
+        throw EagleCameraException(0,EagleCamera::Error_AcquisitionProccessError,
+                                   "A timeout occured while waiting for copying of image from framebuffer");
+    }
+}
+
+
+void EagleCamera::waitForSnappedFrames(const IntegerType frames_number, const ulong timeout)
+{
+    std::unique_lock<std::mutex> lock(_acquisitionStateMutex);
+
+    bool ok = _acquisitionStateCond.wait_for(lock, std::chrono::milliseconds(timeout),
+                                             [&]{return _captureError || (_snappedFrames >= frames_number);});
+
+    if ( _captureError ) std::rethrow_exception(_captureError);
+
+    if ( !ok ) { // something is wrong!
+        throw EagleCameraException(0,EagleCamera::Error_AcquisitionProccessError,
+                                   "A timeout occured while waiting for capturing of image");
+    }
+}
+
+
+void EagleCamera::waitForFreeFrameSlot()
+{
+    if ( !_freeBuffers.empty() ) return; // fast path: no locking
+
+    std::unique_lock<std::mutex> lock(_acquisitionStateMutex);
+
+    // the saving thread must write at least one image buffer within the timeout
+    bool ok = _acquisitionStateCond.wait_for(lock, std::chrono::milliseconds(_fitsWritingTimeout),
+                                             [this]{return _savingError || !_freeBuffers.empty();});
+
+    if ( _savingError ) std::rethrow_exception(_savingError);
+
+    if ( !ok ) {
+        throw EagleCameraException(0,EagleCamera::Error_FitsWritingTimeout,
+                                   "A timeout occured while writing image buffer into FITS file");
+    }
+}
+
+
+EagleCamera::IntegerType EagleCamera::takeFrameBuffer()
+{
+    IntegerType frame_no, buff_no;
+
+    if ( _freeBuffers.pop(frame_no, buff_no) ) return buff_no;
+
+    // all buffers are busy: saving thread falls behind
+
+    if ( !_backpressurePolicy.compare(EAGLE_CAMERA_FEATURE_BACKPRESSURE_POLICY_BLOCK) ) {
+        waitForFreeFrameSlot();
+        _freeBuffers.pop(frame_no, buff_no);
+        return buff_no;
+    }
+
+    {   // do not drop frames forever if saving thread is dead
+        std::lock_guard<std::mutex> lock(_acquisitionStateMutex);
+        if ( _savingError ) std::rethrow_exception(_savingError);
+    }
+
+    if ( !_backpressurePolicy.compare(EAGLE_CAMERA_FEATURE_BACKPRESSURE_POLICY_DROP_OLDEST) ) {
+        // take buffer of the oldest frame still not taken by saving thread
+        while ( _frameRing.pop(frame_no, buff_no) ) {
+            ++_droppedFrames;
+            if ( buff_no < 0 ) {
+                --_spoolPending;
+                continue;
+            }
+            releaseFrameBuffer(buff_no); // frame consumers can still hold the buffer
+            if ( _freeBuffers.pop(frame_no, buff_no) ) return buff_no;
+        }
+        // saving thread is writing the only frame: the new one will be dropped
+    }
+
+    return _scratchBuffer;
+}
+
+
+void EagleCamera::publishFrame(const IntegerType frame_no, const IntegerType buff_no)
+{
+    FrameTiming &timing = _frameTiming[buff_no];
+    timing.published = std::chrono::steady_clock::now();
+
+    ++_publishedFrames;
+
+    recordLatency(LATENCY_STAGE_SNAP, timing.triggered, timing.snapped);
+    recordLatency(LATENCY_STAGE_COPY, timing.snapped, timing.copied);
+
+    if ( buff_no != _scratchBuffer ) {
+        _bufferRefs[buff_no] = 1; // the reference of saving pipeline
+        if ( !_fanOutStage ) fanOutFrame(frame_no, buff_no);
+
+        _frameRing.push(frame_no, buff_no);
+    } else if ( _backpressurePolicy.compare(EAGLE_CAMERA_FEATURE_BACKPRESSURE_POLICY_SPILL) || !spillFrame(frame_no) ) {
+        ++_droppedFrames;
+    }
+
+    notifyAcquisitionState();
+}
+
+
+void EagleCamera::recordLatency(const EagleCameraLatencyStage stage,
+                                const std::chrono::steady_clock::time_point &start,
+                                const std::chrono::steady_clock::time_point &stop)
+{
+    const std::chrono::steady_clock::time_point unset;
+
+    if ( (start == unset) || (stop == unset) || (stop < start) ) return; // the stage was skipped
+
+    _latencyHistogram[stage].record(std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count());
+}
+
+
+void EagleCamera::logLatencyStatistics()
+{
+    static const char* stage_name[LATENCY_STAGES_NUMBER] = {"snap", "copy", "imageReady", "saving queue",
+                                                            "FITS writing", "total"};
+
+    for ( int stage = 0; stage < LATENCY_STAGES_NUMBER; ++stage ) {
+        const LatencyHistogram &hist = _latencyHistogram[stage];
+        if ( !hist.count() ) continue;
+
+        logToFile(EagleCamera::LOG_IDENT_CAMERA_INFO, std::string("Latency of ") + stage_name[stage] + " stage: " +
+                  "min = " + std::to_string(hist.min()) + ", median = " + std::to_string(hist.percentile(50.0)) +
+                  ", 99% = " + std::to_string(hist.percentile(99.0)) + ", max = " + std::to_string(hist.max()) +
+                  " mksec (" + std::to_string(hist.count()) + " frames)");
+    }
+}
+
+
+void EagleCamera::openSpoolFile()
+{
+    _spoolFilePath = _spoolFilename.empty() ? _fitsFilename + ".spool" : _spoolFilename;
+
+    // acquisition and saving threads use their own file streams, so no locking is needed
+
+    _spoolWriteFile = std::fopen(_spoolFilePath.c_str(), "w+b");
+    if ( _spoolWriteFile ) _spoolReadFile = std::fopen(_spoolFilePath.c_str(), "rb");
+
+    if ( !_spoolReadFile ) {
+        std::string err = strerror(errno);
+        closeSpoolFile();
+        throw EagleCameraException(0, EagleCamera::Error_SpoolFileIO,
+                                   "Cannot create spool file '" + _spoolFilePath + "': " + err);
+    }
+
+    _spoolWritten = 0;
+    _spoolFlushed = 0;
+    _spoolRead = 0;
+    _spoolPending = 0;
+
+    _spillBuffers.resize(EAGLE_CAMERA_DEFAULT_SPILL_BUFFERS);
+    for ( auto &buff: _spillBuffers ) buff.resize(_imagePixelsNumber);
+
+    _spillRing.reset(EAGLE_CAMERA_DEFAULT_SPILL_BUFFERS);
+    _freeSpillBuffers.reset(EAGLE_CAMERA_DEFAULT_SPILL_BUFFERS);
+    for ( IntegerType i = 0; i < EAGLE_CAMERA_DEFAULT_SPILL_BUFFERS; ++i ) _freeSpillBuffers.push(-1, i);
+}
+
+
+void EagleCamera::closeSpoolFile()
+{
+    if ( _spoolReadFile ) std::fclose(_spoolReadFile);
+    _spoolReadFile = nullptr;
+
+    if ( _spoolWriteFile ) {
+        std::fclose(_spoolWriteFile);
+        std::remove(_spoolFilePath.c_str()); // the file is needed only during acquisition
+    }
+    _spoolWriteFile = nullptr;
+}
+
+
+bool EagleCamera::spillFrame(const IntegerType frame_no)
+{
+    IntegerType idx, spill_buff;
+
+    // spool file is full or spill thread falls behind too
+    if ( (_spoolPending >= EAGLE_CAMERA_DEFAULT_SPOOL_CAPACITY) || !_freeSpillBuffers.pop(idx, spill_buff) ) return false;
+
+    ushort *data = _spillBuffers[spill_buff].data();
+
+    if ( _zeroCopyFrames ) { // the frame is in the scratch grabber framebuffer
+        readGrabberPixels(_scratchBuffer+1, 0, _imagePixelsNumber, data);
+    } else {
+        memcpy(data, _imageBuffer[_scratchBuffer], _imagePixelsNumber*sizeof(ushort));
+    }
+
+    // spool file is a ring of frames. it is drained by saving thread in order of spilling
+    IntegerType spool_slot = _spoolWritten % EAGLE_CAMERA_DEFAULT_SPOOL_CAPACITY;
+
+    ++_spoolWritten;
+    ++_spoolPending;
+    ++_spilledFrames;
+
+    _spillRing.push(spool_slot, spill_buff); // it has room: the number of spill buffers is its capacity
+    _frameRing.push(frame_no, -1 - spool_slot); // negative index means spooled frame
+
+    return true;
+}
+
+
+void EagleCamera::runSpillThread()
+{
+    applyThreadScheduling(_writerThreadScheduling, "spilling");
+
+    size_t len = _imagePixelsNumber*sizeof(ushort);
+    IntegerType spool_slot, spill_buff;
+
+    try {
+        for (;;) {
+            if ( _spillRing.discarded() ) break;
+
+            if ( !_spillRing.pop(spool_slot, spill_buff) ) {
+                std::unique_lock<std::mutex> lock(_acquisitionStateMutex);
+                _acquisitionStateCond.wait(lock, [this]{return !_spillRing.empty() || _spillRing.closed();});
+                if ( _spillRing.empty() ) break; // the ring is closed and all frames are written
+                continue;
+            }
+
+            if ( EAGLE_CAMERA_FSEEK(_spoolWriteFile, spool_slot*len, SEEK_SET) ||
+                 (std::fwrite(_spillBuffers[spill_buff].data(), 1, len, _spoolWriteFile) != len) ||
+                 std::fflush(_spoolWriteFile) ) {
+                throw EagleCameraException(0, EagleCamera::Error_SpoolFileIO,
+                                           std::string("Cannot write frame into spool file: ") + strerror(errno));
+            }
+
+            _freeSpillBuffers.push(-1, spill_buff);
+            ++_spoolFlushed;
+
+            notifyAcquisitionState(); // the frame can be read by saving thread
+        }
+    } catch ( ... ) {
+        std::lock_guard<std::mutex> lock(_acquisitionStateMutex);
+        if ( !_captureError ) _captureError = std::current_exception();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_acquisitionStateMutex);
+        _spillStopped = true;
+    }
+    _acquisitionStateCond.notify_all();
+}
+
+
+void EagleCamera::readSpooledFrame(const IntegerType buff_no, ushort *buff)
+{
+    size_t len = _imagePixelsNumber*sizeof(ushort);
+
+    if ( !buff ) {
+        if ( _spoolBuffer.size() < static_cast<size_t>(_imagePixelsNumber) ) _spoolBuffer.resize(_imagePixelsNumber);
+        buff = _spoolBuffer.data();
+    }
+
+    // frames are read in order of spilling
+    if ( _spoolFlushed <= _spoolRead ) { // spill thread has not written the frame yet
+        std::unique_lock<std::mutex> lock(_acquisitionStateMutex);
+        _acquisitionStateCond.wait(lock, [this]{return (_spoolFlushed > _spoolRead) || _spillStopped;});
+        if ( _spoolFlushed <= _spoolRead ) {
+            throw EagleCameraException(0, EagleCamera::Error_SpoolFileIO,
+                                       "Spooled frame is lost: spill thread is stopped");
+        }
+    }
+
+    if ( EAGLE_CAMERA_FSEEK(_spoolReadFile, (-1 - buff_no)*len, SEEK_SET) ) {
+        throw EagleCameraException(0, EagleCamera::Error_SpoolFileIO,
+                                   std::string("Cannot read frame from spool file: ") + strerror(errno));
+    }
+
+    if ( std::fread(buff, 1, len, _spoolReadFile) != len ) {
+        std::string err = std::ferror(_spoolReadFile) ? strerror(errno) : "unexpected end of file";
+        std::clearerr(_spoolReadFile);
+        throw EagleCameraException(0, EagleCamera::Error_SpoolFileIO, "Cannot read frame from spool file: " + err);
+    }
+
+    ++_spoolRead;
+}
+
+
+void EagleCamera::saveToFitsFile(const IntegerType frame_no, const IntegerType buff_no,
+                                 const double exp_time, bool as_extension)
+{
+    if ( _nativeFitsWriting ) {
+        saveToNativeFitsFile(frame_no, buff_no, exp_time, as_extension);
+        return;
+    }
+
+    int status = 0;
+
+    const FrameMetadata &meta = frameMetadata(frame_no);
+
+    try {
+#ifndef NDEBUG
+        std::cout << "\nSave FITS (i_frameSaving = " << frame_no <<
+                     ", lastBufferSaving = " << buff_no << ")  ...";
+#endif
+
+        if ( as_extension ) {
+            long naxes[2] = {_imageXDim, _imageYDim};
+
+            CFITSIO_API_CALL( fits_create_img(_fitsFilePtr,USHORT_IMG,2,naxes,&status),
+                              formatFitsLogMessage("fits_create_img",USHORT_IMG,2,(void*)naxes,&status));
+
+            // keywords of the frame are appended before the image, so the header is complete
+            // when CFITSIO flushes it
+
+            FitsStreamWriter::Header hdr;
+            fitsFrameHeader(hdr, meta, exp_time);
+            writeFitsHeaderCards(hdr, false);
+
+            // write image
+            writeImageData(1, buff_no);
+        } else {
+            if ( frame_no == 0 ) {
+                // write 'DATE-OBS'
+                std::string date_obs = formatTimestamp(meta.startUtc);
+
+                CFITSIO_API_CALL( fits_update_key(_fitsFilePtr, TSTRING, "DATE-OBS",
+                                                  (void*)date_obs.c_str(),
+                                                  EAGLE_CAMERA_FITS_KEYWORD_COMMENT_DATEOBS, &status),
+                                  formatFitsLogMessage("fits_update_key", TSTRING, "DATE-OBS", date_obs,
+                                                       EAGLE_CAMERA_FITS_KEYWORD_COMMENT_DATEOBS, (void*)&status));
+            }
+            long first_pix = frame_no*_imagePixelsNumber + 1;
+            writeImageData(first_pix, buff_no);
+
+            // write exposure duration keyword
+
+            CFITSIO_API_CALL( fits_update_key(_fitsFilePtr, TDOUBLE, EAGLE_CAMERA_FITS_KEYWORD_NAME_EXPTIME,
+                                              (void*)&exp_time, EAGLE_CAMERA_FITS_KEYWORD_COMMENT_EXPTIME, &status),
+                              formatFitsLogMessage("fits_update_key", TDOUBLE, EAGLE_CAMERA_FITS_KEYWORD_NAME_EXPTIME,
+                                                   exp_time, EAGLE_CAMERA_FITS_KEYWORD_COMMENT_EXPTIME, (void*)&status));
+        }
+
+        _bytesWritten += _imagePixelsNumber*sizeof(ushort); // CFITSIO writes headers and padding itself
+
+#ifndef NDEBUG
+        std::cout << "  OK (Save FITS)\n";
+#endif
+    } catch ( EagleCameraException &ex ) {
+        throw;
+    }
+
+}
+
+
+void EagleCamera::fitsCameraInfoHeader(FitsStreamWriter::Header &hdr)
+{
+    // origin
+    hdr.setString("ORIGIN", std::string(EAGLE_CAMERA_SOFTWARE_NAME) + ", v" + std::to_string(EAGLE_CAMERA_VERSION_MAJOR) +
+                  "." + std::to_string(EAGLE_CAMERA_VERSION_MINOR), EAGLE_CAMERA_FITS_KEYWORD_COMMENT_ORIGIN);
 
-                // format for exposure time
-                std::string fmt1 = get_float_fmt(_expTime, EAGLE_CAMERA_DEFAULT_EXPTIME_VALUE_DIGITS);
+    // start pixels coordinates
+    hdr.setInteger(EAGLE_CAMERA_FITS_KEYWORD_NAME_STARTX, _imageStartX, EAGLE_CAMERA_FITS_KEYWORD_COMMENT_STARTX);
+    hdr.setInteger(EAGLE_CAMERA_FITS_KEYWORD_NAME_STARTY, _imageStartY, EAGLE_CAMERA_FITS_KEYWORD_COMMENT_STARTY);
 
-                // format for temperature values
-                auto res = std::max_element(_ccdTemp.begin(),_ccdTemp.end(),
-                                            [](double &a, double &b){return std::abs(a) < std::abs(b);});
-                std::string fmt2 = get_float_fmt(*res,EAGLE_CAMERA_DEFAULT_TEMP_VALUE_DIGITS);
+    // binning
+    int xbin = (*this)[EAGLE_CAMERA_FEATURE_HBIN_NAME];
+    int ybin = (*this)[EAGLE_CAMERA_FEATURE_VBIN_NAME];
+    hdr.setInteger(EAGLE_CAMERA_FITS_KEYWORD_NAME_XBIN, xbin, EAGLE_CAMERA_FITS_KEYWORD_COMMENT_XBIN);
+    hdr.setInteger(EAGLE_CAMERA_FITS_KEYWORD_NAME_YBIN, ybin, EAGLE_CAMERA_FITS_KEYWORD_COMMENT_YBIN);
+    hdr.setString(EAGLE_CAMERA_FITS_KEYWORD_NAME_BINNING, std::to_string(xbin) + "x" + std::to_string(ybin),
+                  EAGLE_CAMERA_FITS_KEYWORD_COMMENT_BINNING);
 
-                res = std::max_element(_pcbTemp.begin(),_pcbTemp.end(),
-                                       [](double &a, double &b){return std::abs(a) < std::abs(b);});
-                std::string fmt3 = get_float_fmt(*res,EAGLE_CAMERA_DEFAULT_TEMP_VALUE_DIGITS);
+    // shutter state
+    EagleCamera_StringFeature str_f = (*this)[EAGLE_CAMERA_FEATURE_SHUTTER_STATE_NAME];
+    std::string comment = std::string(EAGLE_CAMERA_FITS_KEYWORD_COMMENT_SHUTTER_STATE) + ": ";
+    if ( !str_f.value().compare(EAGLE_CAMERA_FEATURE_SHUTTER_STATE_EXP) ) {
+        comment += "open for duration exposure time";
+    } else if ( !str_f.value().compare(EAGLE_CAMERA_FEATURE_SHUTTER_STATE_CLOSED) ) {
+        comment += "always closed";
+    } else if ( !str_f.value().compare(EAGLE_CAMERA_FEATURE_SHUTTER_STATE_OPEN) ) {
+        comment += "always open";
+    }
+    hdr.setString(EAGLE_CAMERA_FITS_KEYWORD_NAME_SHUTTER_STATE, str_f.value(), comment);
+
+    // readout rate
+    str_f = (*this)[EAGLE_CAMERA_FEATURE_READOUT_RATE_NAME];
+    comment = EAGLE_CAMERA_FITS_KEYWORD_COMMENT_READOUT_RATE;
+    if ( !str_f.value().compare(EAGLE_CAMERA_FEATURE_READOUT_RATE_FAST) ) {
+        comment += " (2 MHz)";
+    } else if ( !str_f.value().compare(EAGLE_CAMERA_FEATURE_READOUT_RATE_SLOW) ){
+        comment += " (75 kHz)";
+    }
+    hdr.setString(EAGLE_CAMERA_FITS_KEYWORD_NAME_READOUT_RATE, str_f.value(), comment);
 
-                const char* tform[] = {"A30",fmt1.c_str(),fmt2.c_str(),fmt3.c_str()};
+    // readout mode
+    str_f = (*this)[EAGLE_CAMERA_FEATURE_READOUT_MODE_NAME];
+    hdr.setString(EAGLE_CAMERA_FITS_KEYWORD_NAME_READOUT_MODE, str_f.value(), EAGLE_CAMERA_FITS_KEYWORD_COMMENT_READOUT_MODE);
 
-                formatFitsLogMessage("fits_create_tbl",ASCII_TBL,0,tfields,(void*)ttype,(void*)tform,NULL,
-                                     "CUBE INFO",(void*)&status);
-                CFITSIO_API_CALL( fits_create_tbl(_fitsFilePtr,ASCII_TBL,i_frame,tfields,(char**)ttype,
-                                                  (char**)tform,NULL,"CUBE INFO",&status),
-                                  logMessageStream.str());
+    // TEC state and temperatures (2 digits after the floating point)
+    str_f = (*this)[EAGLE_CAMERA_FEATURE_TEC_STATE_NAME];
+    hdr.setString(EAGLE_CAMERA_FITS_KEYWORD_NAME_TEC_STATE, str_f.value(), EAGLE_CAMERA_FITS_KEYWORD_COMMENT_TEC_STATE);
 
-                const char* str;
-                int icol;
-                for ( IntegerType i = 0; i < i_frame; ++i ) {
-                    str = _startExpTimestamp[i].c_str();
-                    icol = 1;
-                    formatFitsLogMessage("fits_write_col",TSTRING,icol,i+1,1,1,str,(void*)&status);
-                    CFITSIO_API_CALL( fits_write_col(_fitsFilePtr,TSTRING,icol,i+1,1,1,&str,&status),
-                                      logMessageStream.str());
+    double temp = (*this)[EAGLE_CAMERA_FEATURE_CCD_TEMP_NAME];
+    hdr.setDouble(EAGLE_CAMERA_FITS_KEYWORD_NAME_CCD_TEMP, std::round(temp*100)/100.0,
+                  EAGLE_CAMERA_FITS_KEYWORD_COMMENT_CCD_TEMP);
 
-                    ++icol;
+    temp = (*this)[EAGLE_CAMERA_FEATURE_PCB_TEMP_NAME];
+    hdr.setDouble(EAGLE_CAMERA_FITS_KEYWORD_NAME_PCB_TEMP, std::round(temp*100)/100.0,
+                  EAGLE_CAMERA_FITS_KEYWORD_COMMENT_PCB_TEMP);
 
-                    formatFitsLogMessage("fits_write_col",TDOUBLE,icol,i+1,1,1,_expTime,(void*)&status);
-                    CFITSIO_API_CALL( fits_write_col(_fitsFilePtr,TDOUBLE,icol,i+1,1,1,&_expTime,&status),
-                                      logMessageStream.str());
+    // versions info keywords
+    hdr.setInteger(EAGLE_CAMERA_FITS_KEYWORD_NAME_SERIAL_NUMBER, _serialNumber, EAGLE_CAMERA_FITS_KEYWORD_COMMENT_SERIAL_NUMBER);
+    hdr.setString(EAGLE_CAMERA_FITS_KEYWORD_NAME_MICRO_VERSION, _microVersion, EAGLE_CAMERA_FITS_KEYWORD_COMMENT_MICRO_VERSION);
+    hdr.setString(EAGLE_CAMERA_FITS_KEYWORD_NAME_FPGA_VERSION, _FPGAVersion, EAGLE_CAMERA_FITS_KEYWORD_COMMENT_FPGA_VERSION);
+    hdr.setString(EAGLE_CAMERA_FITS_KEYWORD_NAME_BUILD_DATE, _buildDate, EAGLE_CAMERA_FITS_KEYWORD_COMMENT_BUILD_DATE);
+    hdr.setString(EAGLE_CAMERA_FITS_KEYWORD_NAME_BUILD_CODE, _buildCode, EAGLE_CAMERA_FITS_KEYWORD_COMMENT_BUILD_CODE);
+}
 
-                    ++icol;
 
-                    formatFitsLogMessage("fits_write_col",TDOUBLE,icol,i+1,1,1,_ccdTemp[i],(void*)&status);
-                    CFITSIO_API_CALL( fits_write_col(_fitsFilePtr,TDOUBLE,icol,i+1,1,1,&_ccdTemp[i],&status),
-                                      logMessageStream.str());
+void EagleCamera::fitsFrameHeader(FitsStreamWriter::Header &hdr, const FrameMetadata &meta, const double exp_time)
+{
+    hdr.setString("DATE-OBS", formatTimestamp(meta.startUtc), EAGLE_CAMERA_FITS_KEYWORD_COMMENT_DATEOBS);
+    hdr.setDouble(EAGLE_CAMERA_FITS_KEYWORD_NAME_CCD_TEMP, meta.ccdTemp, EAGLE_CAMERA_FITS_KEYWORD_COMMENT_CCD_TEMP);
+    hdr.setDouble(EAGLE_CAMERA_FITS_KEYWORD_NAME_PCB_TEMP, meta.pcbTemp, EAGLE_CAMERA_FITS_KEYWORD_COMMENT_PCB_TEMP);
+    hdr.setDouble(EAGLE_CAMERA_FITS_KEYWORD_NAME_EXPTIME, exp_time, EAGLE_CAMERA_FITS_KEYWORD_COMMENT_EXPTIME);
+}
 
-                    ++icol;
 
-                    formatFitsLogMessage("fits_write_col",TDOUBLE,icol,i+1,1,1,_pcbTemp[i],(void*)&status);
-                    CFITSIO_API_CALL( fits_write_col(_fitsFilePtr,TDOUBLE,icol,i+1,1,1,&_pcbTemp[i],&status),
-                                      logMessageStream.str());
-                }
+void EagleCamera::writeFitsHeaderCards(const FitsStreamWriter::Header &hdr, const bool update)
+{
+    int status = 0;
 
-                if ( _stopCapturing  && (stopFrameExpTime < _expTime)) { // re-write value of EXPTIME if user abort exposure
-                    formatFitsLogMessage("fits_write_col",TDOUBLE,2,i_frame,1,1,stopFrameExpTime,(void*)&status);
-                    CFITSIO_API_CALL( fits_write_col(_fitsFilePtr,TDOUBLE,2,i_frame,1,1,&stopFrameExpTime,&status),
-                                      logMessageStream.str());
-                }
+    // the cards are formatted already: CFITSIO just copies them into its buffers
+    for ( size_t i = 0; i < hdr.cardsNumber(); ++i ) {
+        const std::string &card = hdr.card(i);
+
+        if ( update && (hdr.valueCardsNumber(i) > 1) ) {
+            // long string: existing keyword is deleted with its CONTINUE-cards, and the cards are appended
+            std::string key = hdr.keyword(i);
+            fits_delete_key(_fitsFilePtr, key.c_str(), &status);
+            if ( status == KEY_NO_EXIST ) status = 0;
+            CFITSIO_API_CALL( status, formatFitsLogMessage("fits_delete_key", key, (void*)&status) );
+
+            size_t n = hdr.valueCardsNumber(i);
+            for ( size_t j = i; j < i + n; ++j ) {
+                CFITSIO_API_CALL( fits_write_record(_fitsFilePtr, hdr.card(j).c_str(), &status),
+                                  formatFitsLogMessage("fits_write_record", hdr.card(j), (void*)&status) );
             }
+            i += n - 1;
+        } else if ( update ) {
+            std::string key = hdr.keyword(i);
+            CFITSIO_API_CALL( fits_update_card(_fitsFilePtr, key.c_str(), card.c_str(), &status),
+                              formatFitsLogMessage("fits_update_card", key, card, (void*)&status) );
+        } else { // no search of existing keyword
+            CFITSIO_API_CALL( fits_write_record(_fitsFilePtr, card.c_str(), &status),
+                              formatFitsLogMessage("fits_write_record", card, (void*)&status) );
+        }
+    }
+}
 
-#ifndef NDEBUG
-            std::cout << "Save FITS keywords ...\n";
-#endif
 
-            // move to primary HDU (needs if multiple extensions format was used)
-            formatFitsLogMessage("fits_movabs_hdu", 1, 0, (void*)&status);
-            CFITSIO_API_CALL( fits_movabs_hdu(_fitsFilePtr, 1, NULL, &status), logMessageStream.str());
-
-            // write camera info FITS keywords
-            EagleCamera_StringFeature str_f;
-            std::string str_val;
-            int int_val;
-            double float_val;
-            long long_val;
-
-            // origin
-            str_val = std::string(EAGLE_CAMERA_SOFTWARE_NAME) + ", v" + std::to_string(EAGLE_CAMERA_VERSION_MAJOR) + "." +
-                    std::to_string(EAGLE_CAMERA_VERSION_MINOR);
-            formatFitsLogMessage("fits_update_key", TSTRING, "ORIGIN", str_val,
-                                 EAGLE_CAMERA_FITS_KEYWORD_COMMENT_ORIGIN, &status);
-            CFITSIO_API_CALL( fits_update_key(_fitsFilePtr, TSTRING, "ORIGIN", (void*)str_val.c_str(),
-                                              EAGLE_CAMERA_FITS_KEYWORD_COMMENT_ORIGIN, &status),
-                              logMessageStream.str() );
-
-            // start pixels coordinates
-            formatFitsLogMessage("fits_update_key", TLONG, EAGLE_CAMERA_FITS_KEYWORD_NAME_STARTX, _imageStartX,
-                                 EAGLE_CAMERA_FITS_KEYWORD_COMMENT_STARTX, &status);
-            CFITSIO_API_CALL( fits_update_key(_fitsFilePtr, TLONG, EAGLE_CAMERA_FITS_KEYWORD_NAME_STARTX, &_imageStartX,
-                                              EAGLE_CAMERA_FITS_KEYWORD_COMMENT_STARTX, &status),
-                              logMessageStream.str() );
-
-            formatFitsLogMessage("fits_update_key", TLONG, EAGLE_CAMERA_FITS_KEYWORD_NAME_STARTY, _imageStartY,
-                                 EAGLE_CAMERA_FITS_KEYWORD_COMMENT_STARTY, &status);
-            CFITSIO_API_CALL( fits_update_key(_fitsFilePtr, TLONG, EAGLE_CAMERA_FITS_KEYWORD_NAME_STARTY, &_imageStartY,
-                                              EAGLE_CAMERA_FITS_KEYWORD_COMMENT_STARTY, &status),
-                              logMessageStream.str() );
-
-            // binning
-            int_val = (*this)[EAGLE_CAMERA_FEATURE_HBIN_NAME];
-            formatFitsLogMessage("fits_update_key", TINT, EAGLE_CAMERA_FITS_KEYWORD_NAME_XBIN, int_val,
-                                 EAGLE_CAMERA_FITS_KEYWORD_COMMENT_XBIN, &status);
-            CFITSIO_API_CALL( fits_update_key(_fitsFilePtr, TINT, EAGLE_CAMERA_FITS_KEYWORD_NAME_XBIN,
-                                              &int_val, EAGLE_CAMERA_FITS_KEYWORD_COMMENT_XBIN, &status),
-                              logMessageStream.str() );
-
-            str_val = std::to_string(int_val) + "x";
-            int_val = (*this)[EAGLE_CAMERA_FEATURE_VBIN_NAME];
-            formatFitsLogMessage("fits_update_key", TINT, EAGLE_CAMERA_FITS_KEYWORD_NAME_YBIN, int_val,
-                                 EAGLE_CAMERA_FITS_KEYWORD_COMMENT_YBIN, &status);
-            CFITSIO_API_CALL( fits_update_key(_fitsFilePtr, TINT, EAGLE_CAMERA_FITS_KEYWORD_NAME_YBIN,
-                                              &int_val, EAGLE_CAMERA_FITS_KEYWORD_COMMENT_YBIN, &status),
-                              logMessageStream.str() );
-
-
-            str_val += std::to_string(int_val);
-            formatFitsLogMessage("fits_update_key", TSTRING, EAGLE_CAMERA_FITS_KEYWORD_NAME_BINNING, str_val,
-                                 EAGLE_CAMERA_FITS_KEYWORD_COMMENT_BINNING, &status);
-            CFITSIO_API_CALL( fits_update_key(_fitsFilePtr, TSTRING, EAGLE_CAMERA_FITS_KEYWORD_NAME_BINNING,
-                                              (void*)str_val.c_str(),
-                                              EAGLE_CAMERA_FITS_KEYWORD_COMMENT_BINNING, &status),
-                              logMessageStream.str() );
-
-
-            // shutter state
-            str_f = (*this)[EAGLE_CAMERA_FEATURE_SHUTTER_STATE_NAME];
-            str_val = std::string(EAGLE_CAMERA_FITS_KEYWORD_COMMENT_SHUTTER_STATE) + ": ";
-            if ( !str_f.value().compare(EAGLE_CAMERA_FEATURE_SHUTTER_STATE_EXP) ) {
-                str_val += "open for duration exposure time";
-            } else if ( !str_f.value().compare(EAGLE_CAMERA_FEATURE_SHUTTER_STATE_CLOSED) ) {
-                str_val += "always closed";
-            } else if ( !str_f.value().compare(EAGLE_CAMERA_FEATURE_SHUTTER_STATE_OPEN) ) {
-                str_val += "always open";
-            }
-            formatFitsLogMessage("fits_update_key", TSTRING, EAGLE_CAMERA_FITS_KEYWORD_NAME_SHUTTER_STATE,
-                                 str_f.value(), str_val, &status);
-            CFITSIO_API_CALL( fits_update_key(_fitsFilePtr, TSTRING, EAGLE_CAMERA_FITS_KEYWORD_NAME_SHUTTER_STATE,
-                                              (void*)str_f.value().c_str(), str_val.c_str(), &status),
-                              logMessageStream.str() );
-
-            // readout rate
-            str_f = (*this)[EAGLE_CAMERA_FEATURE_READOUT_RATE_NAME];
-            str_val = EAGLE_CAMERA_FITS_KEYWORD_COMMENT_READOUT_RATE;
-            if ( !str_f.value().compare(EAGLE_CAMERA_FEATURE_READOUT_RATE_FAST) ) {
-                str_val += " (2 MHz)";
-            } else if ( !str_f.value().compare(EAGLE_CAMERA_FEATURE_READOUT_RATE_SLOW) ){
-                str_val += " (75 kHz)";
-            }
-            formatFitsLogMessage("fits_update_key", TSTRING, EAGLE_CAMERA_FITS_KEYWORD_NAME_READOUT_RATE,
-                                 str_f.value(), str_val, &status);
-            CFITSIO_API_CALL( fits_update_key(_fitsFilePtr, TSTRING, EAGLE_CAMERA_FITS_KEYWORD_NAME_READOUT_RATE,
-                                              (void*)str_f.value().c_str(), str_val.c_str(), &status),
-                              logMessageStream.str() );
-
-
-            // readout mode
-            str_f = (*this)[EAGLE_CAMERA_FEATURE_READOUT_MODE_NAME];
-            formatFitsLogMessage("fits_update_key", TSTRING, EAGLE_CAMERA_FITS_KEYWORD_NAME_READOUT_MODE,
-                                 str_f.value(), EAGLE_CAMERA_FITS_KEYWORD_COMMENT_READOUT_MODE, &status);
-            CFITSIO_API_CALL( fits_update_key(_fitsFilePtr, TSTRING, EAGLE_CAMERA_FITS_KEYWORD_NAME_READOUT_MODE,
-                                              (void*)str_f.value().c_str(),
-                                              EAGLE_CAMERA_FITS_KEYWORD_COMMENT_READOUT_MODE, &status),
-                              logMessageStream.str() );
-
-
-            // TEC state and temperatures
-            str_f = (*this)[EAGLE_CAMERA_FEATURE_TEC_STATE_NAME];
-            formatFitsLogMessage("fits_update_key", TSTRING, EAGLE_CAMERA_FITS_KEYWORD_NAME_TEC_STATE,
-                                 str_f.value(), EAGLE_CAMERA_FITS_KEYWORD_COMMENT_TEC_STATE, &status);
-            CFITSIO_API_CALL( fits_update_key(_fitsFilePtr, TSTRING, EAGLE_CAMERA_FITS_KEYWORD_NAME_TEC_STATE,
-                                              (void*)str_f.value().c_str(),
-                                              EAGLE_CAMERA_FITS_KEYWORD_COMMENT_TEC_STATE, &status),
-                              logMessageStream.str() );
-
-            float_val = (*this)[EAGLE_CAMERA_FEATURE_CCD_TEMP_NAME];
-            float_val = std::round(float_val*100)/100.0; // 2 digits after the floating point
-            formatFitsLogMessage("fits_update_key", TDOUBLE, EAGLE_CAMERA_FITS_KEYWORD_NAME_CCD_TEMP,
-                                 float_val, EAGLE_CAMERA_FITS_KEYWORD_COMMENT_CCD_TEMP, &status);
-            CFITSIO_API_CALL( fits_update_key(_fitsFilePtr, TDOUBLE, EAGLE_CAMERA_FITS_KEYWORD_NAME_CCD_TEMP,
-                                              &float_val,
-                                              EAGLE_CAMERA_FITS_KEYWORD_COMMENT_CCD_TEMP, &status),
-                              logMessageStream.str() );
-
-            float_val = (*this)[EAGLE_CAMERA_FEATURE_PCB_TEMP_NAME];
-            float_val = std::round(float_val*100)/100.0; // 2 digits after the floating point
-            formatFitsLogMessage("fits_update_key", TDOUBLE, EAGLE_CAMERA_FITS_KEYWORD_NAME_PCB_TEMP,
-                                 float_val, EAGLE_CAMERA_FITS_KEYWORD_COMMENT_READOUT_MODE, &status);
-            CFITSIO_API_CALL( fits_update_key(_fitsFilePtr, TDOUBLE, EAGLE_CAMERA_FITS_KEYWORD_NAME_PCB_TEMP,
-                                              &float_val,
-                                              EAGLE_CAMERA_FITS_KEYWORD_COMMENT_PCB_TEMP, &status),
-                              logMessageStream.str() );
-
-
-
-            // write user FITS keywords
-            if ( !_fitsHdrFilename.empty() ) {
-                formatFitsLogMessage("fits_write_key_template", _fitsHdrFilename, (void*)&status);
-                CFITSIO_API_CALL( fits_write_key_template(_fitsFilePtr, _fitsHdrFilename.c_str(),&status),
-                                  logMessageStream.str());
-            }
+std::vector<std::string> EagleCamera::cubeInfoFormats(const IntegerType n_frames)
+{
+    FrameMetadata dropped = FrameMetadata(); // dropped frames have empty records
+    dropped.flags = FRAME_FLAG_DROPPED;
+    _cubeMetadata.resize(n_frames, dropped);
 
-            // versions info keywords
-            long_val = (long)_serialNumber;
-            formatFitsLogMessage("fits_update_key", TLONG, EAGLE_CAMERA_FITS_KEYWORD_NAME_SERIAL_NUMBER,
-                                 long_val, EAGLE_CAMERA_FITS_KEYWORD_COMMENT_SERIAL_NUMBER, &status);
-            CFITSIO_API_CALL( fits_update_key(_fitsFilePtr, TLONG, EAGLE_CAMERA_FITS_KEYWORD_NAME_SERIAL_NUMBER,
-                                              &long_val, EAGLE_CAMERA_FITS_KEYWORD_COMMENT_SERIAL_NUMBER, &status),
-                              logMessageStream.str());
+    // format for exposure time
+    std::string fmt1 = get_float_fmt(_expTime, EAGLE_CAMERA_DEFAULT_EXPTIME_VALUE_DIGITS);
 
+    // format for temperature values
+    double max_ccd_temp = 0.0, max_pcb_temp = 0.0;
+    for ( auto &meta: _cubeMetadata ) {
+        max_ccd_temp = std::max(max_ccd_temp, std::abs(meta.ccdTemp));
+        max_pcb_temp = std::max(max_pcb_temp, std::abs(meta.pcbTemp));
+    }
+    std::string fmt2 = get_float_fmt(max_ccd_temp,EAGLE_CAMERA_DEFAULT_TEMP_VALUE_DIGITS);
+    std::string fmt3 = get_float_fmt(max_pcb_temp,EAGLE_CAMERA_DEFAULT_TEMP_VALUE_DIGITS);
 
-            formatFitsLogMessage("fits_update_key", TSTRING, EAGLE_CAMERA_FITS_KEYWORD_NAME_MICRO_VERSION,
-                                 _microVersion, EAGLE_CAMERA_FITS_KEYWORD_COMMENT_MICRO_VERSION, &status);
-            CFITSIO_API_CALL( fits_update_key(_fitsFilePtr, TSTRING, EAGLE_CAMERA_FITS_KEYWORD_NAME_MICRO_VERSION,
-                                              (void*)_microVersion.c_str(),
-                                              EAGLE_CAMERA_FITS_KEYWORD_COMMENT_MICRO_VERSION, &status),
-                              logMessageStream.str() );
+    return {"A30", fmt1, fmt2, fmt3, "I1"};
+}
 
 
-            formatFitsLogMessage("fits_update_key", TSTRING, EAGLE_CAMERA_FITS_KEYWORD_NAME_FPGA_VERSION,
-                                 _FPGAVersion, EAGLE_CAMERA_FITS_KEYWORD_COMMENT_FPGA_VERSION, &status);
-            CFITSIO_API_CALL( fits_update_key(_fitsFilePtr, TSTRING, EAGLE_CAMERA_FITS_KEYWORD_NAME_FPGA_VERSION,
-                                              (void*)_FPGAVersion.c_str(),
-                                              EAGLE_CAMERA_FITS_KEYWORD_COMMENT_FPGA_VERSION, &status),
-                              logMessageStream.str() );
+void EagleCamera::writeImageData(const long first_pix, const IntegerType buff_no)
+{
+    int status = 0;
 
-            formatFitsLogMessage("fits_update_key", TSTRING, EAGLE_CAMERA_FITS_KEYWORD_NAME_BUILD_DATE,
-                                 _buildDate, EAGLE_CAMERA_FITS_KEYWORD_COMMENT_BUILD_DATE, &status);
-            CFITSIO_API_CALL( fits_update_key(_fitsFilePtr, TSTRING, EAGLE_CAMERA_FITS_KEYWORD_NAME_BUILD_DATE,
-                                              (void*)_buildDate.c_str(),
-                                              EAGLE_CAMERA_FITS_KEYWORD_COMMENT_BUILD_DATE, &status),
-                              logMessageStream.str() );
+    if ( (buff_no < 0) || !_zeroCopyFrames ) {
+        // negative index: the frame was read from spool file
+        ushort *image = (buff_no < 0) ? _spoolBuffer.data() : _imageBuffer[buff_no];
 
-            formatFitsLogMessage("fits_update_key", TSTRING, EAGLE_CAMERA_FITS_KEYWORD_NAME_BUILD_CODE,
-                                 _buildCode, EAGLE_CAMERA_FITS_KEYWORD_COMMENT_BUILD_CODE, &status);
-            CFITSIO_API_CALL( fits_update_key(_fitsFilePtr, TSTRING, EAGLE_CAMERA_FITS_KEYWORD_NAME_BUILD_CODE,
-                                              (void*)_buildCode.c_str(),
-                                              EAGLE_CAMERA_FITS_KEYWORD_COMMENT_BUILD_CODE, &status),
-                              logMessageStream.str() );
+        CFITSIO_API_CALL( fits_write_img(_fitsFilePtr, TUSHORT, first_pix, _imagePixelsNumber,
+                                         (void*)image, &status),
+                          formatFitsLogMessage("fits_write_img", TUSHORT, first_pix, _imagePixelsNumber,
+                                               (void*)image, (void*)&status) );
+        return;
+    }
 
+    // zero-copy mode: read grabber framebuffer of the slot by chunks of whole lines (the chunk
+    // is small enough to stay in CPU cache) and pass them directly to CFITSIO
 
-            formatFitsLogMessage("fits_close_file",(void*)&status);
-            CFITSIO_API_CALL( fits_close_file(_fitsFilePtr,&status), logMessageStream.str());
+    IntegerType chunk_lines = EAGLE_CAMERA_DEFAULT_ZERO_COPY_CHUNK_SIZE/(sizeof(ushort)*_ccdDimension[0]);
+    if ( chunk_lines < 1 ) chunk_lines = 1;
 
-#ifndef NDEBUG
-            std::cout << "  OK (FITS keywords)\n";
-#endif
-        } catch ( EagleCameraException ex ) {
-#ifndef NDEBUG
-            std::cout << "ACQ PROCCESS ERROR: " << ex.XCLIB_Error() << ", " << ex.Camera_Error() << "\n";
-            std::cout << "ACQ PROCCESS ERROR: " << ex.what() << "\n";
-#endif
-            _acquiringFinished = true;
-            throw ex;
-        }
+    size_t chunk_len = chunk_lines*_ccdDimension[0];
+    if ( _zeroCopyChunk.size() < chunk_len ) _zeroCopyChunk.resize(chunk_len);
 
-#ifndef NDEBUG
-        std::cout << "END OF ACQUSITION\n";
-#endif
-        _acquiringFinished = true;
-    });
+    long pix = 0;
+    for ( IntegerType line = 0; (line < _frameBufferLines) && (pix < _imagePixelsNumber); line += chunk_lines ) {
+        long npix = std::min(static_cast<long>(chunk_len), _imagePixelsNumber - pix); // the last chunk can be shorter
 
+        readGrabberPixels(buff_no+1, line, npix, _zeroCopyChunk.data());
 
-    // waiting for 100 millisecond and check for possible errors ...
+        CFITSIO_API_CALL( fits_write_img(_fitsFilePtr, TUSHORT, first_pix + pix, npix,
+                                         (void*)_zeroCopyChunk.data(), &status),
+                          formatFitsLogMessage("fits_write_img", TUSHORT, first_pix + pix, npix,
+                                               (void*)_zeroCopyChunk.data(), (void*)&status) );
 
-    auto wstatus = _acquisitionProccessThreadFuture.wait_for(std::chrono::milliseconds(100));
-    if ( wstatus != std::future_status::timeout ) {
-        _acquisitionProccessThreadFuture.get(); // if an error occured an exception should be thrown here
+        pix += npix;
     }
-
 }
 
 
-void EagleCamera::stopAcquisition()
+void EagleCamera::convertImageData(const IntegerType buff_no, unsigned char *dst)
 {
-#ifndef NDEBUG
-    std::cout << "\nABORT EXPOSURE!!!\n";
-#endif
-    _stopExpTimepoint = std::chrono::system_clock::now();
-    setTriggerMode(CL_TRIGGER_MODE_ABORT_CURRENT_EXP); // set abort exp bit
-    _stopCapturing = true;
-}
+    if ( (buff_no < 0) || !_zeroCopyFrames ) {
+        ushort *image = (buff_no < 0) ? _spoolBuffer.data() : _imageBuffer[buff_no];
+        convertToFitsPixels(image, _imagePixelsNumber, dst);
+        return;
+    }
 
+    // zero-copy mode: the same chunks of whole lines as in writeImageData
 
-void EagleCamera::imageReady(const IntegerType frame_no, const ushort *image_buffer, const size_t buffer_len)
-{
+    IntegerType chunk_lines = EAGLE_CAMERA_DEFAULT_ZERO_COPY_CHUNK_SIZE/(sizeof(ushort)*_ccdDimension[0]);
+    if ( chunk_lines < 1 ) chunk_lines = 1;
+
+    size_t chunk_len = chunk_lines*_ccdDimension[0];
+    if ( _zeroCopyChunk.size() < chunk_len ) _zeroCopyChunk.resize(chunk_len);
+
+    long pix = 0;
+    for ( IntegerType line = 0; (line < _frameBufferLines) && (pix < _imagePixelsNumber); line += chunk_lines ) {
+        long npix = std::min(static_cast<long>(chunk_len), _imagePixelsNumber - pix);
+
+        readGrabberPixels(buff_no+1, line, npix, _zeroCopyChunk.data());
+        convertToFitsPixels(_zeroCopyChunk.data(), npix, dst + pix*sizeof(ushort));
+
+        pix += npix;
+    }
 }
 
 
-EagleCamera::CameraFeatureProxy & EagleCamera::operator [](const std::string & name)
+void EagleCamera::openNativeFitsFile(const long naxis, const long *naxes, const bool exten_format,
+                                     const std::string &date_str)
 {
-    if ( cameraUnitmap <= 0 ) {
-        throw EagleCameraException(0,EagleCamera::Error_Uninitialized,"Try to access feature for uninitialized camera!");
-    }
+    _fitsStreamWriter.open(_fitsFilename);
 
-    auto search = PREDEFINED_CAMERA_FEATURES.find(name);
+    logToFile(EagleCamera::LOG_IDENT_CAMERA_INFO, "Native FITS writer: " +
+              fitsPixelsKernelName(fitsPixelsKernel()) + " pixels conversion kernel");
 
-    if ( search != PREDEFINED_CAMERA_FEATURES.end() ) {
-        currentCameraFeature = (search->second).get();
+    // the same keywords as CFITSIO writes for USHORT_IMG image
+
+    FitsStreamWriter::Header &hdr = _fitsPrimaryHeader;
+
+    hdr.clear();
+    hdr.setLogical("SIMPLE", true, "file does conform to FITS standard");
+    hdr.setInteger("BITPIX", SHORT_IMG, "number of bits per data pixel");
+    if ( exten_format ) { // empty primary array
+        hdr.setInteger("NAXIS", 0, "number of data axes");
     } else {
-        currentCameraFeature = nullptr;
-        std::string log_str = "'" + name + "' is unknown camera feature!";
-        throw EagleCameraException(0,EagleCamera::Error_UnknowFeature,log_str);
+        hdr.setInteger("NAXIS", naxis, "number of data axes");
+        for ( long i = 0; i < naxis; ++i ) {
+            hdr.setInteger("NAXIS" + std::to_string(i+1), naxes[i], "length of data axis " + std::to_string(i+1));
+        }
+    }
+    hdr.setLogical("EXTEND", true, "FITS dataset may contain extensions");
+    if ( !exten_format ) {
+        hdr.setInteger("BZERO", 32768, "offset data range to that of unsigned short");
+        hdr.setInteger("BSCALE", 1, "default scaling factor");
     }
+    hdr.setString("DATE", date_str, EAGLE_CAMERA_FITS_KEYWORD_COMMENT_DATE);
 
-    return cameraFeature;
-}
+    // the header has room for keywords written after acquisition, so the data never move
 
+    _fitsDataOffset = hdr.size();
+    _fitsWriteOffset = _fitsDataOffset;
 
-EagleCamera::CameraFeatureProxy & EagleCamera::operator[](const char* name)
-{
-    return operator [](std::string(name));
-}
+    if ( _fitsFrameBuffer.size() < _fitsDataOffset ) _fitsFrameBuffer.resize(_fitsDataOffset);
+    hdr.serialize(_fitsFrameBuffer.data());
 
+    _fitsStreamWriter.write(_fitsFrameBuffer.data(), _fitsDataOffset, 0);
 
+    _fitsCubeMap = nullptr;
+    _fitsCubeWriters = 0;
+    bool mapped_cube = !exten_format && !_fitsFileMappingMode.compare(EAGLE_CAMERA_FEATURE_FITS_FILE_MAPPING_ON);
 
-void EagleCamera::logToFile(const EagleCamera::EagleCameraLogIdent ident, const std::string &log_str, const int indent_tabs)
-{
-    if ( !cameraLog ) return;
+    if ( mapped_cube ) { // the whole cube is allocated at once and frames are placed directly into the mapping
+        uint64_t data_bytes = sizeof(ushort);
+        for ( long i = 0; i < naxis; ++i ) data_bytes *= naxes[i];
+        uint64_t len = _fitsDataOffset + FitsStreamWriter::padded(data_bytes);
 
-    if ( logLevel == EagleCamera::LOG_LEVEL_QUIET ) return;
+        // a sparse file is never mapped: writing into a page without disk block kills the process
+        // (SIGBUS) if the disk is full, while a system call just returns an error
+        if ( !_fitsStreamWriter.allocate(len) ) {
+            logToFile(EagleCamera::LOG_IDENT_CAMERA_ERROR, "Cannot reserve disk space for FITS file '" + _fitsFilename +
+                      "'! Frames will be written by system calls");
+        } else if ( char *map = _fitsStreamWriter.map(len) ) {
+            _fitsCubeMap = map + _fitsDataOffset;
+        } else {
+            logToFile(EagleCamera::LOG_IDENT_CAMERA_ERROR, "Cannot map FITS file '" + _fitsFilename +
+                      "' into memory! Frames will be written by system calls");
+        }
+    }
 
-    logMutex.lock();
+    size_t n_threads = (_fitsWriterThreads > 0) ? _fitsWriterThreads : std::thread::hardware_concurrency();
 
-    std::string tab;
-    if ( indent_tabs > 0 ) tab.resize(indent_tabs*EAGLE_CAMERA_DEFAULT_LOG_TAB, ' ');
+    if ( _fitsCubeMap && !_zeroCopyFrames ) { // frames are saved concurrently, each one by its own writer
+        // more writers than image buffers would just wait for frames
+        _fitsCubeWriters = std::min(n_threads, static_cast<size_t>(_acquisitionBuffersNumber));
+        if ( !_fitsCubeWriters ) _fitsCubeWriters = 1;
+    } else if ( _riceFitsFormat || _fitsCubeMap ) { // the saving thread works too
+        _fitsWorkerPool.start(n_threads > 1 ? n_threads - 1 : 0, [this]() {
+            applyThreadScheduling(_writerThreadScheduling, "FITS writer");
+        });
+    }
+}
 
-    std::string str = "[" + time_stamp() + "]";
 
-    switch ( ident ) {
-    case EagleCamera::LOG_IDENT_BLANK:
-        *cameraLog  << log_str << std::endl << std::flush;
+void EagleCamera::saveToNativeFitsFile(const IntegerType frame_no, const IntegerType buff_no,
+                                       const double exp_time, bool as_extension)
+{
+    const FrameMetadata &meta = frameMetadata(frame_no);
+
+    if ( as_extension && _riceFitsFormat ) {
+        saveToRiceFitsExtension(frame_no, buff_no, exp_time);
         return;
-    case EagleCamera::LOG_IDENT_CAMERA_INFO:
-        str += "[CAMERA INFO] ";
-        break;
-    case EagleCamera::LOG_IDENT_CAMERA_ERROR:
-        str += "[CAMERA ERROR] ";
-        break;
-    case EagleCamera::LOG_IDENT_XCLIB_INFO:
-        str += "[XCLIB INFO] ";
-        break;
-    case EagleCamera::LOG_IDENT_XCLIB_ERROR:
-        str += "[XCLIB ERROR] ";
-        break;
-    default:
-        break;
     }
 
+    size_t data_bytes = _imagePixelsNumber*sizeof(ushort);
+
+    if ( as_extension ) { // the whole HDU (header and data) is written by one call
+        FitsStreamWriter::Header hdr(EAGLE_CAMERA_FITS_EXTENSION_HEADER_CARDS);
+
+        hdr.setString("XTENSION", "IMAGE", "IMAGE extension");
+        hdr.setInteger("BITPIX", SHORT_IMG, "number of bits per data pixel");
+        hdr.setInteger("NAXIS", 2, "number of data axes");
+        hdr.setInteger("NAXIS1", _imageXDim, "length of data axis 1");
+        hdr.setInteger("NAXIS2", _imageYDim, "length of data axis 2");
+        hdr.setInteger("PCOUNT", 0, "required keyword; must = 0");
+        hdr.setInteger("GCOUNT", 1, "required keyword; must = 1");
+        hdr.setInteger("BZERO", 32768, "offset data range to that of unsigned short");
+        hdr.setInteger("BSCALE", 1, "default scaling factor");
+        fitsFrameHeader(hdr, meta, exp_time);
+
+        size_t hdr_bytes = hdr.size();
+        size_t hdu_bytes = hdr_bytes + FitsStreamWriter::padded(data_bytes);
+        if ( _fitsFrameBuffer.size() < hdu_bytes ) _fitsFrameBuffer.resize(hdu_bytes);
+
+        char *buff = _fitsFrameBuffer.data();
+        hdr.serialize(buff);
+        convertImageData(buff_no, reinterpret_cast<unsigned char*>(buff + hdr_bytes));
+        std::fill(buff + hdr_bytes + data_bytes, buff + hdu_bytes, 0); // data are padded by zeros
+
+        _fitsStreamWriter.write(buff, hdu_bytes, _fitsWriteOffset);
+        _fitsWriteOffset += hdu_bytes;
+        _bytesWritten += hdu_bytes;
+    } else { // the frame is written at its place in the cube, primary header is written after acquisition
+        if ( frame_no == 0 ) {
+            _fitsPrimaryHeader.setString("DATE-OBS", formatTimestamp(meta.startUtc),
+                                         EAGLE_CAMERA_FITS_KEYWORD_COMMENT_DATEOBS);
+        }
+        _fitsPrimaryHeader.setDouble(EAGLE_CAMERA_FITS_KEYWORD_NAME_EXPTIME, exp_time,
+                                     EAGLE_CAMERA_FITS_KEYWORD_COMMENT_EXPTIME);
 
-    *cameraLog << str << tab << log_str << std::endl << std::flush;
+        uint64_t offset = frame_no*static_cast<uint64_t>(data_bytes);
 
-    logMutex.unlock();
-}
+        if ( _fitsCubeMap ) { // row bands of the frame are converted in parallel right into the file pages
+            const ushort *image = frameImage(buff_no);
+            unsigned char *dst = reinterpret_cast<unsigned char*>(_fitsCubeMap + offset);
 
+            size_t n_pix = _imagePixelsNumber;
+            size_t n_bands = _fitsWorkerPool.threadsNumber();
+            size_t band_len = (n_pix/n_bands + 63)/64*64; // bands do not share cache lines
+            n_bands = (n_pix + band_len - 1)/band_len;
 
+            _fitsWorkerPool.run(n_bands, [&](const size_t band, const size_t) {
+                size_t first = band*band_len;
+                convertToFitsPixels(image + first, std::min(band_len, n_pix - first), dst + 2*first);
+            });
 
-void EagleCamera::logToFile(const EagleCameraException &ex, const int indent_tabs)
-{
-    if ( ex.XCLIB_Error() < 0 ) { // XCLIB errors
-        std::string log_str = ex.what();
-        log_str += " [XCLIB ERROR CODE: " + std::to_string(ex.XCLIB_Error()) + "]";
+            _fitsStreamWriter.flush(_fitsDataOffset + offset, data_bytes);
+        } else {
+            if ( _fitsFrameBuffer.size() < data_bytes ) _fitsFrameBuffer.resize(data_bytes);
 
-        logToFile(EagleCamera::LOG_IDENT_XCLIB_ERROR, log_str, indent_tabs);
-    }
+            convertImageData(buff_no, reinterpret_cast<unsigned char*>(_fitsFrameBuffer.data()));
 
-    if ( ex.Camera_Error() != EagleCamera::Error_OK ) {
-        std::string log_str = ex.what();
-        if ( ex.Camera_Error() == EagleCamera::Error_FITS_ERR ) {
-            log_str += " [CFITSIO ERROR CODE: " + std::to_string(ex.XCLIB_Error()) + "]";
-        } else {
-            log_str += " [CAMERA ERROR CODE: " + std::to_string(ex.Camera_Error()) + "]";
+            _fitsStreamWriter.write(_fitsFrameBuffer.data(), data_bytes, _fitsDataOffset + offset);
         }
 
-        logToFile(EagleCamera::LOG_IDENT_CAMERA_ERROR, log_str, indent_tabs);
+        _bytesWritten += data_bytes;
     }
 }
 
 
+void EagleCamera::saveToMappedCube(const IntegerType frame_no, const ushort *image, const double exp_time)
+{
+    {
+        std::lock_guard<std::mutex> lock(_fitsCubeMutex);
 
-                            /*  PROTECTED METHODS  */
+        if ( frame_no == 0 ) {
+            _fitsPrimaryHeader.setString("DATE-OBS", formatTimestamp(frameMetadata(frame_no).startUtc),
+                                         EAGLE_CAMERA_FITS_KEYWORD_COMMENT_DATEOBS);
+        }
+        // frames are saved out of order: EXPTIME is of the latest frame as in the single thread case
+        if ( static_cast<size_t>(frame_no) + 1 == _cubeMetadata.size() ) {
+            _fitsPrimaryHeader.setDouble(EAGLE_CAMERA_FITS_KEYWORD_NAME_EXPTIME, exp_time,
+                                         EAGLE_CAMERA_FITS_KEYWORD_COMMENT_EXPTIME);
+        }
+    }
 
-void EagleCamera::doSnapAndCopy(const ulong timeout, const IntegerType frame_no, const IntegerType buff_no)
-{
-    char col[] = "Gray";
+    size_t data_bytes = _imagePixelsNumber*sizeof(ushort);
+    uint64_t offset = frame_no*static_cast<uint64_t>(data_bytes);
 
-    try {
-#ifndef NDEBUG
-        std::cout << "\nCAPTURE (frame_no = " << frame_no << ", buff_no = " << buff_no << ") ";
-#endif
+    // the writer converts the frame right into its slice of the file and syncs only the slice
+    convertToFitsPixels(image, _imagePixelsNumber, reinterpret_cast<unsigned char*>(_fitsCubeMap + offset));
+    _fitsStreamWriter.flush(_fitsDataOffset + offset, data_bytes);
 
-        formatLogMessage("pxd_doSnap", 1, timeout);
-        XCLIB_API_CALL( pxd_doSnap(cameraUnitmap, 1, timeout), logMessageStream.str());
+    _bytesWritten += data_bytes;
+}
 
 
-        formatLogMessage("pxd_readushort",1, 0, 0, -1, _frameBufferLines,
-                         (void*)_imageBuffer[buff_no].get(),_currentBufferLength,col);
+// 32-bit big-endian integer of FITS binary table
+static void put_fits_int32(unsigned char *dst, const uint32_t value)
+{
+    dst[0] = static_cast<unsigned char>(value >> 24);
+    dst[1] = static_cast<unsigned char>(value >> 16);
+    dst[2] = static_cast<unsigned char>(value >> 8);
+    dst[3] = static_cast<unsigned char>(value);
+}
 
-#ifndef NDEBUG
-        std::cout << "AND READ IMAGE TO BUFFER ...";
-#endif
 
-        XCLIB_API_CALL(pxd_readushort(cameraUnitmap, 1, 0, 0, -1, _frameBufferLines, _imageBuffer[buff_no].get(),
-                                      _currentBufferLength, (char*)col),
-                logMessageStream.str());
+void EagleCamera::saveToRiceFitsExtension(const IntegerType frame_no, const IntegerType buff_no,
+                                          const double exp_time)
+{
+    const FrameMetadata &meta = frameMetadata(frame_no);
 
-        imageReady(frame_no,_imageBuffer[buff_no].get(), _imagePixelsNumber);
+    _fitsTileCompressor.compress(_fitsWorkerPool, frameImage(buff_no), _imagePixelsNumber, _imageXDim);
 
-#ifndef NDEBUG
-        std::cout << "OK CAPTURE & READ\n";
-#endif
-    } catch ( EagleCameraException &ex ) {
-        throw;
+    size_t n_tiles = _fitsTileCompressor.tilesNumber();
+    size_t heap_bytes = 0;
+    size_t max_tile_bytes = 0;
+    for ( size_t i = 0; i < n_tiles; ++i ) {
+        heap_bytes += _fitsTileCompressor.tileBytes(i);
+        max_tile_bytes = std::max(max_tile_bytes, _fitsTileCompressor.tileBytes(i));
+    }
+
+    // tiled image compression convention: binary table of one variable length column,
+    // the compressed tiles are in the heap following the table
+
+    FitsStreamWriter::Header hdr(EAGLE_CAMERA_FITS_EXTENSION_HEADER_CARDS);
+
+    hdr.setString("XTENSION", "BINTABLE", "binary table extension");
+    hdr.setInteger("BITPIX", BYTE_IMG, "8-bit bytes");
+    hdr.setInteger("NAXIS", 2, "2-dimensional binary table");
+    hdr.setInteger("NAXIS1", 8, "width of table in bytes");
+    hdr.setInteger("NAXIS2", n_tiles, "number of rows in table");
+    hdr.setInteger("PCOUNT", heap_bytes, "size of special data area");
+    hdr.setInteger("GCOUNT", 1, "one data group (required keyword)");
+    hdr.setInteger("TFIELDS", 1, "number of fields in each row");
+    hdr.setString("TTYPE1", "COMPRESSED_DATA", "label for field   1");
+    hdr.setString("TFORM1", "1PB(" + std::to_string(max_tile_bytes) + ")", "data format of field: variable length array");
+    hdr.setLogical("ZIMAGE", true, "extension contains compressed image");
+    hdr.setInteger("ZBITPIX", SHORT_IMG, "data type of original image");
+    hdr.setInteger("ZNAXIS", 2, "dimension of original image");
+    hdr.setInteger("ZNAXIS1", _imageXDim, "length of original image axis");
+    hdr.setInteger("ZNAXIS2", _imageYDim, "length of original image axis");
+    hdr.setInteger("ZTILE1", _imageXDim, "size of tiles to be compressed");
+    hdr.setInteger("ZTILE2", 1, "size of tiles to be compressed");
+    hdr.setString("ZCMPTYPE", "RICE_1", "compression algorithm");
+    hdr.setString("ZNAME1", "BLOCKSIZE", "compression block size");
+    hdr.setInteger("ZVAL1", EAGLE_CAMERA_FITS_RICE_BLOCK_SIZE, "pixels per block");
+    hdr.setString("ZNAME2", "BYTEPIX", "bytes per pixel (1, 2, 4, or 8)");
+    hdr.setInteger("ZVAL2", sizeof(short), "bytes per pixel (1, 2, 4, or 8)");
+    hdr.setString("EXTNAME", "COMPRESSED_IMAGE", "name of this binary table extension");
+    hdr.setInteger("BZERO", 32768, "offset data range to that of unsigned short");
+    hdr.setInteger("BSCALE", 1, "default scaling factor");
+    fitsFrameHeader(hdr, meta, exp_time);
+
+    size_t hdr_bytes = hdr.size();
+    size_t table_bytes = 8*n_tiles; // descriptors: number of bytes and offset in the heap
+    size_t hdu_bytes = hdr_bytes + FitsStreamWriter::padded(table_bytes + heap_bytes);
+    if ( _fitsFrameBuffer.size() < hdu_bytes ) _fitsFrameBuffer.resize(hdu_bytes);
+
+    char *buff = _fitsFrameBuffer.data();
+    hdr.serialize(buff);
+
+    unsigned char *row = reinterpret_cast<unsigned char*>(buff + hdr_bytes);
+    unsigned char *heap = row + table_bytes;
+
+    size_t offset = 0;
+    for ( size_t i = 0; i < n_tiles; ++i ) { // the tiles are written in order
+        size_t nbytes = _fitsTileCompressor.tileBytes(i);
+
+        put_fits_int32(row, static_cast<uint32_t>(nbytes));
+        put_fits_int32(row + 4, static_cast<uint32_t>(offset));
+        row += 8;
+
+        std::copy(_fitsTileCompressor.tileData(i), _fitsTileCompressor.tileData(i) + nbytes, heap + offset);
+        offset += nbytes;
     }
+
+    std::fill(reinterpret_cast<char*>(heap + offset), buff + hdu_bytes, 0); // data are padded by zeros
+
+    _fitsStreamWriter.write(buff, hdu_bytes, _fitsWriteOffset);
+    _fitsWriteOffset += hdu_bytes;
+    _bytesWritten += hdu_bytes; // compressed size
 }
 
 
-void EagleCamera::saveToFitsFile(const IntegerType frame_no, const IntegerType buff_no,
-                                 const double exp_time, bool as_extension)
+const ushort* EagleCamera::frameImage(const IntegerType buff_no)
 {
-    int status = 0;
+    if ( buff_no < 0 ) return _spoolBuffer.data();
 
-    try {
-#ifndef NDEBUG
-        std::cout << "\nSave FITS (i_frameSaving = " << frame_no <<
-                     ", lastBufferSaving = " << buff_no << ")  ...";
-#endif
+    if ( !_zeroCopyFrames ) return _imageBuffer[buff_no];
 
-        if ( as_extension ) {
-            long naxes[2] = {_imageXDim, _imageYDim};
+    // zero-copy mode: the whole image is needed to process its parts in parallel
+    if ( _fitsTileImage.size() < static_cast<size_t>(_imagePixelsNumber) ) _fitsTileImage.resize(_imagePixelsNumber);
+    readGrabberPixels(buff_no+1, 0, _imagePixelsNumber, _fitsTileImage.data());
 
-            formatFitsLogMessage("fits_create_img",USHORT_IMG,2,(void*)naxes,&status);
-            CFITSIO_API_CALL( fits_create_img(_fitsFilePtr,USHORT_IMG,2,naxes,&status),
-                              logMessageStream.str());
+    return _fitsTileImage.data();
+}
 
-            // write 'DATE-OBS'
 
-            formatFitsLogMessage("fits_update_key", TSTRING, "DATE-OBS", _startExpTimestamp[frame_no],
-                                 EAGLE_CAMERA_FITS_KEYWORD_COMMENT_DATEOBS, (void*)&status);
-            CFITSIO_API_CALL( fits_update_key(_fitsFilePtr, TSTRING, "DATE-OBS",
-                                              (void*)_startExpTimestamp[frame_no].c_str(),
-                                              EAGLE_CAMERA_FITS_KEYWORD_COMMENT_DATEOBS, &status),
-                              logMessageStream.str());
+void EagleCamera::closeNativeFitsFile(const IntegerType n_frames, const bool exten_format)
+{
+    _fitsWorkerPool.stop();
 
-            // write temperatures keywords
+    // the mapping must be released before the file length is changed
+    _fitsStreamWriter.unmap();
+    _fitsCubeMap = nullptr;
 
-            formatFitsLogMessage("fits_update_key", TDOUBLE, EAGLE_CAMERA_FITS_KEYWORD_NAME_CCD_TEMP,
-                                 _ccdTemp[frame_no], EAGLE_CAMERA_FITS_KEYWORD_COMMENT_CCD_TEMP, &status);
-            CFITSIO_API_CALL( fits_update_key(_fitsFilePtr, TDOUBLE, EAGLE_CAMERA_FITS_KEYWORD_NAME_CCD_TEMP,
-                                              &_ccdTemp[frame_no],
-                                              EAGLE_CAMERA_FITS_KEYWORD_COMMENT_CCD_TEMP, &status),
-                              logMessageStream.str() );
+    uint64_t len = _fitsWriteOffset;
 
-            formatFitsLogMessage("fits_update_key", TDOUBLE, EAGLE_CAMERA_FITS_KEYWORD_NAME_PCB_TEMP,
-                                 _pcbTemp[frame_no], EAGLE_CAMERA_FITS_KEYWORD_COMMENT_READOUT_MODE, &status);
-            CFITSIO_API_CALL( fits_update_key(_fitsFilePtr, TDOUBLE, EAGLE_CAMERA_FITS_KEYWORD_NAME_PCB_TEMP,
-                                              &_pcbTemp[frame_no],
-                                              EAGLE_CAMERA_FITS_KEYWORD_COMMENT_PCB_TEMP, &status),
-                              logMessageStream.str() );
+    // camera info keywords go into the room reserved in primary header
+    fitsCameraInfoHeader(_fitsPrimaryHeader);
 
-            // write image
-            formatFitsLogMessage("fits_write_img", TUSHORT, 1, _imagePixelsNumber,
-                                 (void*)_imageBuffer[buff_no].get(), (void*)&status);
-            CFITSIO_API_CALL( fits_write_img(_fitsFilePtr, TUSHORT, 1, _imagePixelsNumber,
-                                             (void*)_imageBuffer[buff_no].get(), &status),
-                              logMessageStream.str() );
-        } else {
-            if ( frame_no == 0 ) {
-                // write 'DATE-OBS'
-                formatFitsLogMessage("fits_update_key", TSTRING, "DATE-OBS", _startExpTimestamp[0],
-                                     EAGLE_CAMERA_FITS_KEYWORD_COMMENT_DATEOBS, (void*)&status);
-                CFITSIO_API_CALL( fits_update_key(_fitsFilePtr, TSTRING, "DATE-OBS",
-                                                  (void*)_startExpTimestamp[0].c_str(),
-                                                  EAGLE_CAMERA_FITS_KEYWORD_COMMENT_DATEOBS, &status),
-                                  logMessageStream.str());
+    if ( !exten_format ) {
+        // re-write NAXIS3 value (acquisition was stopped or RECORDER ring was not full at trigger)
+
+        if ( n_frames < _acquisitionFramesNumber ) {
+            if ( n_frames > 1 ) {
+                _fitsPrimaryHeader.setInteger("NAXIS3", n_frames, "length of data axis 3");
+            } else if ( _acquisitionFramesNumber > 1 ) { // it is now just 2-dim image
+                _fitsPrimaryHeader.setInteger("NAXIS", 2, "number of data axes");
+                _fitsPrimaryHeader.remove("NAXIS3");
             }
-            long first_pix = frame_no*_imagePixelsNumber + 1;
-            formatFitsLogMessage("fits_write_img", TUSHORT, first_pix, _imagePixelsNumber,
-                                 (void*)_imageBuffer[buff_no].get(), (void*)&status);
-            CFITSIO_API_CALL( fits_write_img(_fitsFilePtr, TUSHORT, first_pix, _imagePixelsNumber,
-                                             (void*)_imageBuffer[buff_no].get(), &status),
-                              logMessageStream.str() );
         }
-        // write exposure duration keyword
 
-        formatFitsLogMessage("fits_update_key", TDOUBLE, EAGLE_CAMERA_FITS_KEYWORD_NAME_EXPTIME,
-                             _expTime, EAGLE_CAMERA_FITS_KEYWORD_COMMENT_EXPTIME, (void*)&status);
-        CFITSIO_API_CALL( fits_update_key(_fitsFilePtr, TDOUBLE, EAGLE_CAMERA_FITS_KEYWORD_NAME_EXPTIME,
-                                          (void*)&exp_time, EAGLE_CAMERA_FITS_KEYWORD_COMMENT_EXPTIME, &status),
-                          logMessageStream.str());
+        // not saved frames are zero-filled (2-dim image has at least one frame)
 
-#ifndef NDEBUG
-        std::cout << "  OK (Save FITS)\n";
-#endif
-    } catch ( EagleCameraException &ex ) {
-        throw;
+        IntegerType n_data = std::max(n_frames, static_cast<IntegerType>(1));
+        len = _fitsDataOffset + FitsStreamWriter::padded(n_data*_imagePixelsNumber*sizeof(ushort));
+
+        if ( n_frames > 1 ) len += saveNativeCubeInfo(n_frames, len);
+    }
+
+    if ( _fitsPrimaryHeader.size() != _fitsDataOffset ) {
+        throw EagleCameraException(0, EagleCamera::Error_FitsFileIO,
+                                   "Primary header of FITS file '" + _fitsFilename + "' is overflowed");
+    }
+
+    _fitsPrimaryHeader.serialize(_fitsFrameBuffer.data());
+    _fitsStreamWriter.write(_fitsFrameBuffer.data(), _fitsDataOffset, 0);
+
+    _fitsStreamWriter.truncate(len);
+    _fitsStreamWriter.close();
+}
+
+
+uint64_t EagleCamera::saveNativeCubeInfo(const IntegerType n_frames, const uint64_t offset)
+{
+    const char* ttype[] = {"DATE-OBS", EAGLE_CAMERA_FITS_KEYWORD_NAME_EXPTIME,
+                           EAGLE_CAMERA_FITS_KEYWORD_NAME_CCD_TEMP, EAGLE_CAMERA_FITS_KEYWORD_NAME_PCB_TEMP,
+                           "DROPPED"};
+    const size_t tfields = 5;
+
+    std::vector<std::string> tform = cubeInfoFormats(n_frames);
+
+    // fields ("Aw", "Fw.d" or "Iw") are separated by a space as CFITSIO does
+
+    size_t width[tfields], tbcol[tfields], row_len = 0;
+    int prec[tfields];
+    for ( size_t i = 0; i < tfields; ++i ) {
+        size_t dot = tform[i].find('.');
+        width[i] = std::stoul(tform[i].substr(1, dot == std::string::npos ? std::string::npos : dot - 1));
+        prec[i] = (dot == std::string::npos) ? 0 : std::stoi(tform[i].substr(dot + 1));
+        if ( tform[i][0] == 'F' ) { // room for sign of negative temperatures (CFITSIO table keeps its format)
+            tform[i] = "F" + std::to_string(++width[i]) + "." + std::to_string(prec[i]);
+        }
+        tbcol[i] = row_len + 1;
+        row_len += width[i] + 1;
+    }
+    --row_len;
+
+    FitsStreamWriter::Header hdr(EAGLE_CAMERA_FITS_EXTENSION_HEADER_CARDS);
+
+    hdr.setString("XTENSION", "TABLE", "ASCII table extension");
+    hdr.setInteger("BITPIX", 8, "8-bit ASCII characters");
+    hdr.setInteger("NAXIS", 2, "2-dimensional ASCII table");
+    hdr.setInteger("NAXIS1", row_len, "width of table in characters");
+    hdr.setInteger("NAXIS2", n_frames, "number of rows in table");
+    hdr.setInteger("PCOUNT", 0, "no group parameters (required keyword)");
+    hdr.setInteger("GCOUNT", 1, "one data group (required keyword)");
+    hdr.setInteger("TFIELDS", tfields, "number of fields in each row");
+    for ( size_t i = 0; i < tfields; ++i ) {
+        std::string n = std::to_string(i+1);
+        hdr.setString("TTYPE" + n, ttype[i], "label for field " + n);
+        hdr.setInteger("TBCOL" + n, tbcol[i], "beginning column of field " + n);
+        hdr.setString("TFORM" + n, tform[i], "Fortran-77 format of field");
+    }
+    hdr.setString("EXTNAME", "CUBE INFO", "name of this ASCII table extension");
+
+    size_t hdr_bytes = hdr.size();
+    size_t hdu_bytes = hdr_bytes + FitsStreamWriter::padded(row_len*n_frames);
+    if ( _fitsFrameBuffer.size() < hdu_bytes ) _fitsFrameBuffer.resize(hdu_bytes);
+
+    char *buff = _fitsFrameBuffer.data();
+    hdr.serialize(buff);
+    std::fill(buff + hdr_bytes, buff + hdu_bytes, ' '); // ASCII table is padded by blanks
+
+    char *row = buff + hdr_bytes;
+    char field[64];
+    for ( IntegerType i = 0; i < n_frames; ++i, row += row_len ) {
+        const FrameMetadata &meta = _cubeMetadata[i];
+
+        // empty for dropped frame
+        std::string timestamp = meta.startUtc.time_since_epoch().count() ? formatTimestamp(meta.startUtc) : "";
+        timestamp.copy(row + tbcol[0] - 1, std::min(timestamp.size(), width[0]));
+
+        double values[] = {meta.expTime, meta.ccdTemp, meta.pcbTemp,
+                           (meta.flags & FRAME_FLAG_DROPPED) ? 1.0 : 0.0}; // the dropped plane is zero-filled
+        for ( size_t k = 1; k < tfields; ++k ) {
+            int n = (tform[k][0] == 'I') ?
+                        snprintf(field, sizeof(field), "%*d", static_cast<int>(width[k]), static_cast<int>(values[k-1])) :
+                        snprintf(field, sizeof(field), "%*.*f", static_cast<int>(width[k]), prec[k], values[k-1]);
+            if ( (n > 0) && (static_cast<size_t>(n) == width[k]) && (width[k] < sizeof(field)) ) {
+                memcpy(row + tbcol[k] - 1, field, width[k]);
+            } else { // the value does not fit into the field
+                std::fill(row + tbcol[k] - 1, row + tbcol[k] - 1 + width[k], '*');
+            }
+        }
     }
 
+    _fitsStreamWriter.write(buff, hdu_bytes, offset);
+
+    return hdu_bytes;
 }
 
 
@@ -1219,10 +2926,9 @@ int EagleCamera::cl_read(byte_vector_t &data,  const bool all)
     if ( CL_ACK_BIT_ENABLED ) ++info_len;
     if ( CL_CHK_SUM_BIT_ENABLED ) ++info_len;
 
-    formatLogMessage("pxd_serialRead",0,NULL,0);
-
     // how many byte available for reading ...
-    XCLIB_API_CALL( nbytes = pxd_serialRead(cameraUnitmap,0,NULL,0), logMessageStream.str() );
+    XCLIB_API_CALL( nbytes = XCLIB_SERIALIZED(pxd_serialRead(cameraUnitmap,0,NULL,0)),
+                    formatLogMessage("pxd_serialRead",0,NULL,0) );
 
     // special case
     if ( (data.size() == 0) && !info_len ) { // nothing to read
@@ -1241,8 +2947,8 @@ int EagleCamera::cl_read(byte_vector_t &data,  const bool all)
     buff_ptr = buff.get();
 
     if ( all ) {
-        formatLogMessage("pxd_serialRead", 0, (void*)buff_ptr, nbytes);
-        XCLIB_API_CALL( pxd_serialRead(cameraUnitmap, 0, buff_ptr, nbytes), logMessageStream.str(),
+        XCLIB_API_CALL( XCLIB_SERIALIZED(pxd_serialRead(cameraUnitmap, 0, buff_ptr, nbytes)),
+                        formatLogMessage("pxd_serialRead", 0, (void*)buff_ptr, nbytes),
                         buff_ptr, nbytes);
     } else {
         std::chrono::milliseconds timeout{10000};
@@ -1254,17 +2960,19 @@ int EagleCamera::cl_read(byte_vector_t &data,  const bool all)
             auto now = std::chrono::system_clock::now();
             std::chrono::duration<double> diff = now-start;
             if ( std::chrono::duration_cast<std::chrono::milliseconds>(diff).count() >= timeout_count ) {
-                throw EagleCameraException(PXERTIMEOUT,EagleCamera::Error_OK, logMessageStream.str());
+                throw EagleCameraException(PXERTIMEOUT,EagleCamera::Error_OK, formatLogMessage("pxd_serialRead",0,NULL,0));
             }
 
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            // wait approximately for the time of transmission of the missing bytes
+            std::this_thread::sleep_for(std::chrono::microseconds((nbytes - N)*EAGLE_CAMERA_SERIAL_BYTE_TIME));
 
             // how many byte available for reading ...
-            XCLIB_API_CALL( N = pxd_serialRead(cameraUnitmap,0,NULL,0), logMessageStream.str() );
+            XCLIB_API_CALL( N = XCLIB_SERIALIZED(pxd_serialRead(cameraUnitmap,0,NULL,0)),
+                            formatLogMessage("pxd_serialRead",0,NULL,0) );
         }
 
-        formatLogMessage("pxd_serialRead", 0, (void*)buff_ptr, nbytes);
-        XCLIB_API_CALL( pxd_serialRead(cameraUnitmap, 0, buff_ptr, nbytes), logMessageStream.str(),
+        XCLIB_API_CALL( XCLIB_SERIALIZED(pxd_serialRead(cameraUnitmap, 0, buff_ptr, nbytes)),
+                        formatLogMessage("pxd_serialRead", 0, (void*)buff_ptr, nbytes),
                         buff_ptr, nbytes);
     }
 
@@ -1287,8 +2995,8 @@ int EagleCamera::cl_write(const byte_vector_t val)
 {
     int nbytes = 0;
 
-    formatLogMessage("pxd_serialWrite",0,NULL,0);
-    XCLIB_API_CALL( nbytes = pxd_serialWrite(cameraUnitmap, 0, NULL, 0), logMessageStream.str() );
+    XCLIB_API_CALL( nbytes = XCLIB_SERIALIZED(pxd_serialWrite(cameraUnitmap, 0, NULL, 0)),
+                    formatLogMessage("pxd_serialWrite",0,NULL,0) );
 
     if ( val.size() == 0 ) { // special case
         return nbytes;
@@ -1319,29 +3027,28 @@ int EagleCamera::cl_write(const byte_vector_t val)
             auto now = std::chrono::system_clock::now();
             std::chrono::duration<double> diff = now-start;
             if ( std::chrono::duration_cast<std::chrono::milliseconds>(diff).count() >= timeout_count ) {
-                throw EagleCameraException(PXERTIMEOUT,EagleCamera::Error_OK, logMessageStream.str());
+                throw EagleCameraException(PXERTIMEOUT,EagleCamera::Error_OK, formatLogMessage("pxd_serialWrite",0,NULL,0));
             }
 
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            // wait for the time of transmission of bytes which still do not fit into Tx-buffer
+            std::this_thread::sleep_for(std::chrono::microseconds((UART_len - nbytes)*EAGLE_CAMERA_SERIAL_BYTE_TIME));
 
-//            formatLogMessage("pxd_serialWrite",0,NULL,0);
-            XCLIB_API_CALL( nbytes = pxd_serialWrite(cameraUnitmap, 0, NULL, 0), logMessageStream.str() );
+            XCLIB_API_CALL( nbytes = XCLIB_SERIALIZED(pxd_serialWrite(cameraUnitmap, 0, NULL, 0)),
+                            formatLogMessage("pxd_serialWrite",0,NULL,0) );
         }
 
-        formatLogMessage("pxd_serialWrite",0,(void*)buff_ptr,UART_len);
-        XCLIB_API_CALL( nbytes = pxd_serialWrite(cameraUnitmap, 0, (char*)buff_ptr, UART_len),
-                        logMessageStream.str(), (char*)buff.get(), UART_len);
+        XCLIB_API_CALL( nbytes = XCLIB_SERIALIZED(pxd_serialWrite(cameraUnitmap, 0, (char*)buff_ptr, UART_len)),
+                        formatLogMessage("pxd_serialWrite",0,(void*)buff_ptr,UART_len), (char*)buff.get(), UART_len);
 
         /*
-        formatLogMessage("pxd_serialWrite",0,(void*)val.data(),val.size());
-        XCLIB_API_CALL( nbytes = pxd_serialWrite(cameraUnitmap, 0, (char*)val.data(), val.size()),
-                        logMessageStream.str(), (char*)val.data(), val.size());
+        XCLIB_API_CALL( nbytes = XCLIB_SERIALIZED(pxd_serialWrite(cameraUnitmap, 0, (char*)val.data(), val.size())),
+                        formatLogMessage("pxd_serialWrite",0,(void*)val.data(),val.size()), (char*)val.data(), val.size());
 
         // write mandatory End-of-Transmision byte
         char ack = CL_ETX;
 
-        formatLogMessage("pxd_serialWrite",0,(void*)&ack,1);
-        XCLIB_API_CALL( N = pxd_serialWrite(cameraUnitmap, 0, &ack, 1), logMessageStream.str(),
+        XCLIB_API_CALL( N = XCLIB_SERIALIZED(pxd_serialWrite(cameraUnitmap, 0, &ack, 1)),
+                        formatLogMessage("pxd_serialWrite",0,(void*)&ack,1),
                         &ack, 1);
 
         nbytes += N;
@@ -1351,9 +3058,8 @@ int EagleCamera::cl_write(const byte_vector_t val)
             for ( int i = 1; i < val.size(); ++i ) sum ^= val[i];
             sum ^= CL_ETX;
 
-            formatLogMessage("pxd_serialWrite",0,(void*)&sum,1);
-            XCLIB_API_CALL( N = pxd_serialWrite(cameraUnitmap, 0, &sum, 1),
-                            logMessageStream.str(), &sum, 1 );
+            XCLIB_API_CALL( N = XCLIB_SERIALIZED(pxd_serialWrite(cameraUnitmap, 0, &sum, 1)),
+                            formatLogMessage("pxd_serialWrite",0,(void*)&sum,1), &sum, 1 );
             nbytes += N;
         }
         */
@@ -1365,8 +3071,16 @@ int EagleCamera::cl_write(const byte_vector_t val)
 
 int EagleCamera::cl_exec(const EagleCamera::byte_vector_t command, EagleCamera::byte_vector_t &response, const long timeout)
 {
+    std::lock_guard<std::recursive_mutex> lock(_serialPortMutex);
+
     cl_write(command);
-    if ( timeout > 0 ) std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
+
+    // if a response is expected 'cl_read' returns as soon as it arrives,
+    // so the pause is needed only for commands without any response
+    if ( (timeout > 0) && response.empty() && !CL_ACK_BIT_ENABLED ) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
+    }
+
     return cl_read(response);
 }
 
@@ -1383,6 +3097,29 @@ void EagleCamera::writeRegisters(const byte_vector_t addr, const byte_vector_t v
     size_t N = ( addr.size() < values.size() ) ? addr.size() : values.size();
     if ( !N ) return;
 
+    std::lock_guard<std::recursive_mutex> lock(_serialPortMutex);
+
+    bool shadowed = _registerShadowEnabled;
+    for ( size_t i = 0; i < N; ++i ) shadowed = shadowed && isShadowedRegister(addr[i]);
+
+    if ( shadowed ) { // skip the group if all its registers already hold the values
+        bool changed = false;
+        for ( size_t i = 0; i < N; ++i ) {
+            auto it = _registerShadow.find(addr[i]);
+            if ( (it == _registerShadow.end()) || (it->second != values[i]) ) {
+                changed = true;
+                break;
+            }
+        }
+        if ( !changed ) {
+            ++_registerShadowHits;
+            return;
+        }
+
+        // forget the group: the values are stored only after successful writing
+        for ( size_t i = 0; i < N; ++i ) _registerShadow.erase(addr[i]);
+    }
+
     byte_vector_t comm = CL_COMMAND_WRITE_VALUE;
 
     size_t i = 0;
@@ -1390,7 +3127,11 @@ void EagleCamera::writeRegisters(const byte_vector_t addr, const byte_vector_t v
         comm[3] = address;
         comm[4] = values[i++];
         cl_exec(comm);
-        if ( i == N ) return; // just protection from out-of-range error ...
+        if ( i == N ) break; // just protection from out-of-range error ...
+    }
+
+    if ( shadowed ) {
+        for ( size_t i = 0; i < N; ++i ) _registerShadow[addr[i]] = values[i];
     }
 }
 
@@ -1399,6 +3140,25 @@ EagleCamera::byte_vector_t EagleCamera::readRegisters(const byte_vector_t addr,
 {
     if ( !addr.size() ) return byte_vector_t();
 
+    // registers with special addressing (e.g. temperatures) and status ones (e.g. control
+    // register 0x00 or versions) are always read from the camera
+    bool shadowed = addr_comm.empty();
+    for ( auto address: addr ) shadowed = shadowed && isShadowedRegister(address);
+
+    if ( shadowed ) {
+        std::lock_guard<std::recursive_mutex> lock(_serialPortMutex);
+
+        if ( _registerShadowEnabled ) {
+            byte_vector_t res;
+            for ( auto address: addr ) {
+                auto it = _registerShadow.find(address);
+                if ( it == _registerShadow.end() ) break;
+                res.push_back(it->second);
+            }
+            if ( res.size() == addr.size() ) return res;
+        }
+    }
+
     byte_vector_t comm = CL_COMMAND_READ_VALUE;
     byte_vector_t a_comm;
     byte_vector_t res(addr.size());
@@ -1408,16 +3168,51 @@ EagleCamera::byte_vector_t EagleCamera::readRegisters(const byte_vector_t addr,
 
     size_t i = 0;
     for (auto address: addr ) {
+        waitForSnapshotTrigger(); // telemetry gives way to exposure trigger between registers
+
+        std::lock_guard<std::recursive_mutex> lock(_serialPortMutex); // set address and read it at once
+
         a_comm[3] = address;
         cl_exec(a_comm);
         cl_exec(comm,value);
         res[i++] = value[0];
+
+        if ( shadowed && _registerShadowEnabled ) _registerShadow[address] = value[0];
     }
 
     return res;
 }
 
 
+bool EagleCamera::isShadowedRegister(const unsigned char address)
+{
+    switch ( address ) {
+        case 0x03: case 0x04:                                     // TEC set point
+        case 0xA1: case 0xA2:                                     // binning
+        case 0xA3: case 0xA4:                                     // readout rate
+        case 0xA5: case 0xA6: case 0xA7:                          // shutter state and delays
+        case 0xB4: case 0xB5: case 0xB6: case 0xB7:               // ROI
+        case 0xB8: case 0xB9: case 0xBA: case 0xBB:
+        case 0xDC: case 0xDD: case 0xDE: case 0xDF: case 0xE0:    // frame rate
+        case 0xED: case 0xEE: case 0xEF: case 0xF0: case 0xF1:    // exposure time
+        case 0xF7:                                                // readout mode
+            return true;
+        default:
+            return false;
+    }
+}
+
+
+void EagleCamera::enableRegisterShadow(const bool enabled)
+{
+    std::lock_guard<std::recursive_mutex> lock(_serialPortMutex);
+
+    _registerShadowEnabled = enabled;
+    _registerShadow.clear();
+    _registerShadowHits = 0;
+}
+
+
 unsigned char EagleCamera::getSystemState()
 {
     byte_vector_t comm = {0x49};
@@ -1557,6 +3352,8 @@ unsigned char EagleCamera::getTriggerMode()
 
     addr_comm[3] = 0xD4;
 
+    std::lock_guard<std::recursive_mutex> lock(_serialPortMutex);
+
     cl_exec(addr_comm);
     cl_exec(comm,val);
 
@@ -1593,6 +3390,10 @@ bool EagleCamera::resetMicro(const long timeout)
     byte_vector_t poll_comm = {0x4F, 0x51};
     byte_vector_t ack;
 
+    std::lock_guard<std::recursive_mutex> lock(_serialPortMutex);
+
+    _registerShadow.clear(); // registers are reset
+
     cl_write(comm); // here there is no response from camera
 
     int64_t timeout_counts = 0;
@@ -1638,6 +3439,10 @@ bool EagleCamera::resetFPGA(const long timeout)
     byte_vector_t poll_comm = {0x49};
     byte_vector_t ack(1);
 
+    std::lock_guard<std::recursive_mutex> lock(_serialPortMutex);
+
+    _registerShadow.clear(); // registers are reset
+
     cl_exec(comm);
     std::this_thread::sleep_for(std::chrono::milliseconds(1000));
     comm = {0x4F, 0x52};
@@ -1668,6 +3473,8 @@ bool EagleCamera::resetFPGA(const long timeout)
 
 void EagleCamera::getManufactureData()
 {
+    std::lock_guard<std::recursive_mutex> lock(_serialPortMutex); // EPROM access mode must not be interleaved
+
     unsigned char state = getSystemState();
     setSystemState(is_chk_sum_enabled(state), is_ack_enabled(state), is_fpga_in_reset(state), true);
 
@@ -1879,67 +3686,64 @@ int EagleCamera::CFITSIO_API_CALL(int err_code, const std::string &context)
     // format logging message
 
 template<typename ...T>
-void EagleCamera::formatLogMessage(const char* func_name, T ...args)
+std::string EagleCamera::formatLogMessage(const char* func_name, T ...args)
 {
-    logMessageStreamMutex.lock();
+    std::ostringstream os; // the message is formatted by capturing, saving and telemetry threads concurrently
 
-    logMessageStream.str("");
-    logMessageStream << func_name << "(" << cameraUnitmap << ", ";
-    logHelper(args...);
-    logMessageStream << ")";
+    os << func_name << "(" << cameraUnitmap << ", ";
+    logHelper(os, args...);
+    os << ")";
 
-    logMessageStreamMutex.unlock();
+    return os.str();
 }
 
 
 template<typename ...T>
-void EagleCamera::formatFitsLogMessage(const char* func_name, T ...args)
+std::string EagleCamera::formatFitsLogMessage(const char* func_name, T ...args)
 {
+    std::ostringstream os;
 
-    logMessageStreamMutex.lock();
-
-    logMessageStream.str("");
-    logMessageStream << func_name << "(" << (void*)_fitsFilePtr << ", ";
-    logHelper(args...);
-    logMessageStream << ")";
+    os << func_name << "(" << (void*)_fitsFilePtr << ", ";
+    logHelper(os, args...);
+    os << ")";
 
-    logMessageStreamMutex.unlock();
+    return os.str();
 }
 
 
 template<typename T1, typename... T2>
-inline void EagleCamera::logHelper(T1 first, T2... last)
+inline void EagleCamera::logHelper(std::ostream &os, T1 first, T2... last)
 {
-    logHelper(first);
-    logMessageStream << ", ";
-    logHelper(last ...);
+    logHelper(os, first);
+    os << ", ";
+    logHelper(os, last ...);
 }
 
 
 template<typename T>
-void EagleCamera::logHelper(T arg)
+void EagleCamera::logHelper(std::ostream &os, T arg)
 {
-    logMessageStream << arg;
+    os << arg;
 }
 
-void EagleCamera::logHelper(const char *str)
+void EagleCamera::logHelper(std::ostream &os, const char *str)
 {
-    logMessageStream << "\"" << str << "\"";
+    os << "\"" << str << "\"";
 }
 
-void EagleCamera::logHelper(const std::string &str)
+void EagleCamera::logHelper(std::ostream &os, const std::string &str)
 {
-    logHelper(str.c_str());
+    logHelper(os, str.c_str());
 }
 
 
-void EagleCamera::logHelper(const void *addr)
+void EagleCamera::logHelper(std::ostream &os, const void *addr)
 {
-    logMessageStream << std::hex << addr << std::dec;
+    os << std::hex << addr << std::dec;
 }
 
 
-void EagleCamera::logHelper()
+void EagleCamera::logHelper(std::ostream &)
 {
 
 }
@@ -46,6 +46,12 @@
 #include <future>
 #include <atomic>
 #include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <cstdio>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
 #include <fitsio.h>
 
 #include <iostream>
@@ -65,13 +71,75 @@
 
 #define EAGLE_CAMERA_DEFAULT_CAPTURING_TIMEOUT_GAP 120 // in seconds. default timeout portion to be added to exposure time.
                                                        // the final timeout is one for capturing proccess
-                                                       // (see doSnap XCLIB function)
+                                                       // (see snapFrame method)
 
 #define EAGLE_CAMERA_DEFAULT_FITS_WRITING_TIMEOUT 100000 // in milliseconds (100 secs)
                                                          // default timeout for writing each image buffer into FITS file
 
 #define EAGLE_CAMERA_DEFAULT_NUMBER_OF_BUFFERS 10 // default number of buffers used for FITS file saving
 
+#define EAGLE_CAMERA_DEFAULT_ZERO_COPY_CHUNK_SIZE 262144 // in bytes. size of a chunk of grabber framebuffer
+                                                        // to be read at once in zero-copy mode
+
+#define EAGLE_CAMERA_HUGE_PAGE_SIZE 2097152 // in bytes. huge pages are used for image buffers of at least this size
+
+#define EAGLE_CAMERA_DEFAULT_NUMA_NODE -1 // NUMA node of image buffers and acquisition threads (-1 means no placement)
+
+// XCLIB context is shared by all camera objects and the library does not guarantee thread-safety,
+// so each call is serialized by grabberContextMutex (the lock is held for the call only)
+#define XCLIB_SERIALIZED(call) [&]{ std::lock_guard<std::mutex> xclib_lock(EagleCamera::grabberContextMutex); \
+                                    return (call); }()
+
+#define EAGLE_CAMERA_CACHE_LINE_SIZE 64 // in bytes. it is used to place concurrently modified indices
+                                        // into separate cache lines
+
+#define EAGLE_CAMERA_DEFAULT_TELEMETRY_RATE 1.0 // in Hz. default rate of sampling of camera temperatures
+                                                // during acquisition
+
+#define EAGLE_CAMERA_DEFAULT_TELEMETRY_RING_SIZE 256 // number of the latest telemetry samples to be kept
+
+#define EAGLE_CAMERA_SERIAL_BYTE_TIME 87 // in microseconds. transmission time of one byte via camera serial
+                                          // port (115200 baud, 10 bits per byte). it is used as a polling
+                                          // interval for serial port buffers
+
+#define EAGLE_CAMERA_DEFAULT_STREAMING_MAX_SLEEP 10 // in milliseconds. maximal sleep time of waiting for the next
+                                                    // frame in streaming mode
+
+#define EAGLE_CAMERA_DEFAULT_SNAP_POLL_INTERVAL 1 // in milliseconds. interval of polling of grabber after expected
+                                                // end of exposure (waiting for the end of image readout) if
+                                                // XCLIB captured field event is not available
+
+#define EAGLE_CAMERA_FIELD_EVENT_SIGNAL_OFFSET 4 // captured field events of grabber unit N are delivered
+                                                 // by real-time signal SIGRTMIN + OFFSET + N (Linux)
+
+#define EAGLE_CAMERA_DEFAULT_ABORT_READOUT_GAP 200 // in milliseconds. it is added to estimated readout time to get
+                                                   // timeout of waiting for partial frame after exposure abort
+
+#define EAGLE_CAMERA_FAST_READOUT_PIXEL_RATE 2000000.0 // in pixels per second ("FAST" readout rate)
+#define EAGLE_CAMERA_SLOW_READOUT_PIXEL_RATE 75000.0   // in pixels per second ("SLOW" readout rate)
+
+#define EAGLE_CAMERA_FITS_BLOCK_SIZE 2880 // in bytes. FITS headers and data units occupy whole blocks
+
+#define EAGLE_CAMERA_FITS_PRIMARY_HEADER_CARDS 144 // number of cards reserved in primary header written by native
+                                                   // FITS writer (keywords written after acquisition fill them)
+
+#define EAGLE_CAMERA_FITS_EXTENSION_HEADER_CARDS 36 // number of cards of IMAGE-extension header written by native
+                                                    // FITS writer (one block)
+
+#define EAGLE_CAMERA_FITS_RICE_BLOCK_SIZE 32 // number of pixels in Rice coding block (CFITSIO default)
+
+#define EAGLE_CAMERA_DEFAULT_FITS_WRITER_THREADS 0 // number of threads of native FITS writer compressing tiles or
+                                                   // filling memory-mapped cube (0 means number of CPUs)
+
+#define EAGLE_CAMERA_DEFAULT_SPOOL_CAPACITY 1024 // maximal number of frames in raw spool file (SPILL backpressure policy)
+
+#define EAGLE_CAMERA_DEFAULT_SPILL_BUFFERS 4 // number of frames queued for writing into spool file by spill thread
+
+#define EAGLE_CAMERA_DEFAULT_STAGE_QUEUE_CAPACITY 4 // default maximal number of frames waiting for processing stage
+
+#define EAGLE_CAMERA_DEFAULT_PRE_TRIGGER_FRAMES 10 // default number of frames kept in memory before trigger
+                                                   // in RECORDER acquisition mode
+
 #define EAGLE_CAMERA_DEFAULT_BUFFER_TIMEOUT 10  // default timeout in seconds for captured image buffer copying proccess
 
 #define EAGLE_CAMERA_DEFAULT_ACQUISITION_POLL_INTERVAL 100 // default interval in milliseconds for polling of acquisition
@@ -185,6 +253,7 @@ public:
                             Error_UnexpectedFPGAValue,
                             Error_AcquisitionProccessError, Error_CopyBufferTimeout,
                             Error_FitsWritingTimeout, Error_CameraIsAcquiring,
+                            Error_SpoolFileIO, Error_FitsFileIO, Error_VideoFormatMismatch,
                             Error_OK = 0,
                             // errors from EAGLE V 4240 Instruction Manual
                             Error_ETX_SER_TIMEOUT = 0x51, Error_ETX_CK_SUM_ERR,
@@ -197,6 +266,294 @@ public:
     enum EagleCameraLogIdent {LOG_IDENT_BLANK, LOG_IDENT_CAMERA_INFO, LOG_IDENT_CAMERA_ERROR,
                               LOG_IDENT_XCLIB_INFO, LOG_IDENT_XCLIB_ERROR};
 
+    // stages of frame processing which latencies are measured during acquisition
+    enum EagleCameraLatencyStage {
+        LATENCY_STAGE_SNAP,         // trigger command is sent -> pxd_doSnap returned (exposure and readout)
+        LATENCY_STAGE_COPY,         // pxd_doSnap returned -> pxd_readushort finished
+        LATENCY_STAGE_IMAGE_READY,  // pxd_readushort finished -> imageReady returned (in its consumer thread)
+        LATENCY_STAGE_SAVE_QUEUE,   // frame is passed to saving thread -> FITS writing is started
+        LATENCY_STAGE_FITS_WRITE,   // FITS writing is started -> FITS writing is finished
+        LATENCY_STAGE_TOTAL,        // trigger command is sent -> FITS writing is finished
+        LATENCY_STAGES_NUMBER
+    };
+
+            /*   DECLARATION OF A LOCK-FREE LATENCY HISTOGRAM   */
+
+    // HDR-style histogram of values in microseconds: values less than 16 have their own buckets,
+    // each next power-of-two range is divided into 16 linear sub-buckets (relative error is
+    // less than 1/16). recording is wait-free, so the histogram can be read at any moment
+    // (e.g. during acquisition), but a snapshot taken while recording is not strictly consistent
+    class LatencyHistogram {
+    public:
+        static const size_t SUB_BUCKET_BITS = 4;
+        static const size_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+        static const size_t BUCKETS = SUB_BUCKETS + (64 - SUB_BUCKET_BITS)*SUB_BUCKETS;
+
+        LatencyHistogram() {
+            reset();
+        }
+
+        LatencyHistogram(const LatencyHistogram&) = delete;
+        LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+        void reset() {
+            for ( auto &count: _counts ) count.store(0, std::memory_order_relaxed);
+            _count.store(0, std::memory_order_relaxed);
+            _sum.store(0, std::memory_order_relaxed);
+            _min.store(std::numeric_limits<uint64_t>::max(), std::memory_order_relaxed);
+            _max.store(0, std::memory_order_relaxed);
+        }
+
+        void record(const uint64_t value) {
+            _counts[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+            _sum.fetch_add(value, std::memory_order_relaxed);
+
+            uint64_t v = _min.load(std::memory_order_relaxed);
+            while ( (value < v) && !_min.compare_exchange_weak(v, value, std::memory_order_relaxed) );
+            v = _max.load(std::memory_order_relaxed);
+            while ( (value > v) && !_max.compare_exchange_weak(v, value, std::memory_order_relaxed) );
+
+            _count.fetch_add(1, std::memory_order_release);
+        }
+
+        uint64_t count() const {
+            return _count.load(std::memory_order_acquire);
+        }
+
+        uint64_t min() const {
+            return count() ? _min.load(std::memory_order_relaxed) : 0;
+        }
+
+        uint64_t max() const {
+            return _max.load(std::memory_order_relaxed);
+        }
+
+        double mean() const {
+            uint64_t n = count();
+            return n ? static_cast<double>(_sum.load(std::memory_order_relaxed))/n : 0.0;
+        }
+
+        // value (upper bound of bucket) below which 'percent' of recorded values fall
+        uint64_t percentile(const double percent) const {
+            uint64_t n = count();
+            if ( !n ) return 0;
+
+            double rank = percent < 0.0 ? 0.0 : percent > 100.0 ? 100.0 : percent;
+            uint64_t target = static_cast<uint64_t>(std::ceil(rank/100.0*n));
+            if ( !target ) target = 1;
+
+            uint64_t cumulative = 0;
+            for ( size_t i = 0; i < BUCKETS; ++i ) {
+                cumulative += _counts[i].load(std::memory_order_relaxed);
+                if ( cumulative >= target ) return std::min(bucketUpperValue(i), max());
+            }
+
+            return max();
+        }
+
+    private:
+        std::atomic<uint64_t> _counts[BUCKETS];
+        std::atomic<uint64_t> _count;
+        std::atomic<uint64_t> _sum;
+        std::atomic<uint64_t> _min;
+        std::atomic<uint64_t> _max;
+
+        static size_t bucketIndex(const uint64_t value) {
+            if ( value < SUB_BUCKETS ) return value;
+
+            size_t exp = 63;
+            while ( !(value >> exp) ) --exp; // position of the most significant bit (>= SUB_BUCKET_BITS)
+
+            size_t shift = exp - SUB_BUCKET_BITS;
+            return SUB_BUCKETS + shift*SUB_BUCKETS + ((value >> shift) & (SUB_BUCKETS-1));
+        }
+
+        static uint64_t bucketUpperValue(const size_t idx) {
+            if ( idx < SUB_BUCKETS ) return idx;
+
+            size_t shift = (idx - SUB_BUCKETS)/SUB_BUCKETS;
+            uint64_t sub = SUB_BUCKETS + (idx - SUB_BUCKETS)%SUB_BUCKETS;
+
+            return ((sub + 1) << shift) - 1;
+        }
+    };
+
+            /*   DECLARATION OF BASE CLASS FOR FRAME PROCESSING STAGES   */
+
+    // a stage of frame processing pipeline between capturing and FITS file writing
+    // (e.g. calibration, statistics, compression). each stage runs in its own worker
+    // thread and gets frames through its bounded queue in order of capturing, so
+    // a slow stage does not delay capturing (while image buffers are available).
+    // a stage which does not declare pixels modification must not change the image
+    class EAGLE_CAMERA_LIBRARY_EXPORT FrameProcessingStage {
+    public:
+        FrameProcessingStage(const std::string &name, const bool modifies_pixels = false,
+                             const size_t queue_capacity = EAGLE_CAMERA_DEFAULT_STAGE_QUEUE_CAPACITY);
+        virtual ~FrameProcessingStage();
+
+        std::string name() const;
+        bool modifiesPixels() const;
+        size_t queueCapacity() const;
+
+        // are called from the stage worker thread before the first and after the last frame
+        virtual void begin();
+        virtual void end();
+
+        // is called from the stage worker thread for each frame. exception aborts acquisition
+        virtual void process(const IntegerType frame_no, ushort *image_buffer, const size_t buffer_len) = 0;
+
+    private:
+        std::string _name;
+        bool _modifiesPixels;
+        size_t _queueCapacity;
+    };
+
+            /*   PER-FRAME METADATA RECORD   */
+
+    // compact fixed-size record of frame metadata. timestamps are kept raw and
+    // are formatted only when FITS header is written
+
+    enum FrameMetadataFlag {
+        FRAME_FLAG_TELEMETRY = 0x1, // temperatures were sampled
+        FRAME_FLAG_ABORTED   = 0x2, // exposure was stopped by user
+        FRAME_FLAG_DROPPED   = 0x4  // frame was not saved (its plane of CUBE is zero-filled)
+    };
+
+    struct FrameMetadata {
+        std::chrono::system_clock::time_point startUtc;        // start of exposure
+        std::chrono::steady_clock::time_point startMonotonic;
+        double ccdTemp;
+        double pcbTemp;
+        double expTime; // actual exposure duration in seconds
+        uint32_t flags;
+    };
+
+    // start of exposure formatted as DATE-OBS keyword
+    static std::string formatTimestamp(const std::chrono::system_clock::time_point &tp);
+
+
+            /*   CONVERSION OF PIXELS INTO FITS REPRESENTATION   */
+
+    // FITS keeps unsigned 16-bit pixels as signed big-endian ones with BZERO = 32768.
+    // the offset and byte swapping are done in one vectorized pass, the kernel is
+    // chosen at run-time according to CPU
+
+    enum FitsPixelsKernel {FITS_PIXELS_SCALAR, FITS_PIXELS_SSE2, FITS_PIXELS_AVX2, FITS_PIXELS_AVX512};
+
+    static FitsPixelsKernel fitsPixelsKernel(); // the fastest kernel supported by CPU
+    static bool fitsPixelsKernelSupported(const FitsPixelsKernel kernel);
+    static std::string fitsPixelsKernelName(const FitsPixelsKernel kernel);
+
+    // 'dst' must be at least 2*n bytes long. not supported kernel is replaced by scalar one
+    static void convertToFitsPixels(const ushort *src, const size_t n, unsigned char *dst);
+    static void convertToFitsPixels(const ushort *src, const size_t n, unsigned char *dst,
+                                    const FitsPixelsKernel kernel);
+
+
+            /*   DECLARATION OF REFERENCE-COUNTED FRAME HANDLE   */
+
+    // a handle owns a reference to captured image in image buffer of the camera and
+    // keeps the frame metadata. the buffer is returned back for capturing when the last
+    // handle of the frame (and FITS writer) releases it. copying of handle does not copy image.
+    // NOTE: a handle should be released before the end of acquisition: the next acquisition
+    //       can not be started while any handle is held (its buffer would be re-used)
+    class EAGLE_CAMERA_LIBRARY_EXPORT FrameHandle {
+        friend class EagleCamera;
+    public:
+        FrameHandle();
+        FrameHandle(const FrameHandle &other);
+        FrameHandle& operator=(const FrameHandle &other);
+        ~FrameHandle();
+
+        bool valid() const;
+        void release();
+
+        IntegerType frameNumber() const;   // starts from 0
+        const ushort* image() const;
+        size_t imageLength() const;        // in pixels
+        std::string startTimestamp() const; // start of exposure (as DATE-OBS keyword)
+        double ccdTemp() const;
+        double pcbTemp() const;
+        const FrameMetadata& metadata() const;
+
+    private:
+        FrameHandle(EagleCamera *camera, const IntegerType frame_no, const IntegerType buff_no);
+
+        EagleCamera *_camera;
+        IntegerType _frameNo;
+        IntegerType _buffNo;
+        FrameMetadata _metadata;
+    };
+
+            /*   DECLARATION OF BASE CLASS FOR FRAME CONSUMERS   */
+
+    // a consumer gets handles of all captured frames (fan-out without image copying) in
+    // its own worker thread. frames are passed to consumers after the last processing stage
+    // which modifies pixels. if queue of a consumer is full the frame is skipped for it
+    // (zero capacity means a queue for all image buffers, i.e. frames are never skipped
+    // but a slow consumer holds image buffers). an exception stops the consumer only
+    class EAGLE_CAMERA_LIBRARY_EXPORT FrameConsumer {
+        friend class EagleCamera;
+    public:
+        FrameConsumer(const std::string &name, const size_t queue_capacity = 0);
+        virtual ~FrameConsumer();
+
+        std::string name() const;
+        size_t queueCapacity() const;
+        IntegerType skippedFrames() const; // in the current (or the last) acquisition
+
+        // are called from the consumer worker thread before the first and after the last frame
+        virtual void begin();
+        virtual void end();
+
+        virtual void consume(const FrameHandle &frame) = 0;
+
+    private:
+        std::string _name;
+        size_t _queueCapacity;
+        std::atomic<IntegerType> _skippedFrames;
+    };
+
+
+    // one setting of acquisition sequence step: feature name and its value
+
+    struct EAGLE_CAMERA_LIBRARY_EXPORT SequenceSetting {
+        SequenceSetting(const std::string &feature_name, const IntegerType value);
+        SequenceSetting(const std::string &feature_name, const int value);
+        SequenceSetting(const std::string &feature_name, const double value);
+        SequenceSetting(const std::string &feature_name, const std::string &value);
+        SequenceSetting(const std::string &feature_name, const char *value);
+
+        bool operator==(const SequenceSetting &other) const;
+
+        std::string feature;
+        EagleCameraFeatureType type;
+        IntegerType integerValue;
+        double floatValue;
+        std::string stringValue;
+    };
+
+    // step of acquisition sequence: features to be set (in given order) and number of frames
+
+    struct EAGLE_CAMERA_LIBRARY_EXPORT SequenceStep {
+        std::vector<SequenceSetting> settings;
+        IntegerType frames;
+        std::string name; // it is substituted for "{name}" in filename template
+    };
+
+
+    // progress of the current (or the last) acquisition
+
+    struct AcquisitionProgress {
+        IntegerType capturedFrames; // frames passed to saving pipeline (including dropped and spilled ones)
+        IntegerType savedFrames;    // frames written into FITS file
+        uint64_t bytesWritten;      // bytes of frames written into FITS file (image data or whole frame HDU
+                                    // written by native writer, compressed tiles in RICE format)
+        bool finished;
+    };
+
+    typedef std::function<void(const AcquisitionProgress &progress)> progress_callback_t;
+
 
     void initCamera(const int unitmap = 1, std::ostream *log_file = nullptr);
 
@@ -209,11 +566,58 @@ public:
     void startAcquisition();
     void stopAcquisition();
 
+    // completion handle of the current (or the last) acquisition. it becomes ready when
+    // acquisition thread is finished and its get() re-throws an error of the acquisition
+    // (e.g. one occured long after startAcquisition returned). the handle is invalid
+    // if acquisition was never started
+    std::shared_future<void> acquisitionCompletion() const;
+
+    // wait for the end of acquisition ('timeout' in milliseconds, negative value means
+    // infinite waiting). return false on timeout, re-throw an error of the acquisition
+    bool waitForAcquisition(const long timeout = -1);
+
+    AcquisitionProgress acquisitionProgress();
+
+    // the callback is invoked by FITS writer thread after each saved frame and by acquisition
+    // thread once at the end of acquisition (with finished = true, also on error). it should
+    // return quickly and must not wait for the acquisition. it can not be changed during acquisition
+    void setProgressCallback(const progress_callback_t &callback);
+
+    // execute acquisition sequence: steps are run back to back, each one into its own FITS file
+    // named by 'filename_template' ("{step}" is replaced by step number starting from 1 and
+    // "{name}" by step name). features are set in given order, but camera registers which
+    // already hold the requested values (e.g. set by previous step) are not re-written.
+    // the method blocks until the whole sequence is finished. stopAcquisition (from another
+    // thread) stops the current step and the rest of the sequence
+    void runSequence(const std::vector<SequenceStep> &plan, const std::string &filename_template);
+
+    // flush pre-trigger frames and the next 'FrameCount' frames into FITS file
+    // (RECORDER acquisition mode). it can be called from any thread (e.g. from a handler
+    // of some external event)
+    void triggerRecorder();
+
+    // latency statistics (in microseconds) of the current (or the last) acquisition stage.
+    // the histograms are reset by startAcquisition and can be read during acquisition
+    const LatencyHistogram& latencyHistogram(const EagleCameraLatencyStage stage) const;
+
+    // append processing stage to the pipeline (FITS file writing is always the last stage).
+    // stages can not be changed during acquisition
+    void addProcessingStage(const std::shared_ptr<FrameProcessingStage> &stage);
+    void clearProcessingStages();
+
+    // add consumer of captured frames (imageReady is invoked by one more built-in consumer).
+    // consumers can not be changed during acquisition
+    void addFrameConsumer(const std::shared_ptr<FrameConsumer> &consumer);
+    void clearFrameConsumers();
+
     // is invoked every time image was captured and
     // copied to buffer pointed by 'image_buffer'.
     // size of the buffer is in 'buff_len'.
     // in 'frame_no' a sequence number of frame for 'image_buffer' will be returned.
     // 'frame_no' starts from 0!!!
+    // it is invoked by built-in frame consumer in its own thread (in order of frames)
+    // NOTE: it is not invoked in zero-copy mode (images are not copied from grabber memory)
+    // and for dropped or spilled frames
     void virtual imageReady(const IntegerType frame_no, const ushort* image_buffer, const size_t buffer_len);
 
     void logToFile(const EagleCamera::EagleCameraLogIdent ident, const std::string &log_str, const int indent_tabs = 0);
@@ -507,10 +911,715 @@ protected:
 
     void saveToFitsFile(const IntegerType frame_no, const IntegerType buff_no, const double exp_time, bool as_extension);
 
-    void doSnapAndCopy(const ulong timeout, const IntegerType frame_no, const IntegerType buff_no);
+    // capture image of frame 'frame_no' (for image buffer 'buff_no') into grabber framebuffer
+    // 'grabber_buff'. return false if exposure was aborted and partial frame has not been read out
+    bool doSnap(const ulong timeout, const IntegerType frame_no, const IntegerType buff_no, const long grabber_buff);
+
+    // start snapping into grabber framebuffer 'grabber_buff' and wait for the image.
+    // the waiting is cancelled by stopAcquisition: the camera reads out partial frame
+    // which is waited for not longer than _abortReadoutTimeout. return false if the
+    // partial frame has not come
+    bool snapFrame(const long grabber_buff, const ulong timeout);
+
+    ulong _abortReadoutTimeout; // in milliseconds
+    std::atomic<bool> _snapAborted; // the last snap was aborted without image
+
+            /*   DECLARATION OF GRABBER CAPTURED FIELD EVENT CLASS   */
+
+    // XCLIB notification of each field captured by grabber: a signal on Linux (its handler
+    // writes into a pipe) and an event object on Windows. wait() returns on captured field,
+    // on wakeUp() or at the deadline. if XCLIB can not create the event isOpen() is false
+    // and wait() just sleeps until the deadline
+
+    class GrabberFieldEvent {
+    public:
+        GrabberFieldEvent();
+        ~GrabberFieldEvent();
+
+        GrabberFieldEvent(const GrabberFieldEvent&) = delete;
+        GrabberFieldEvent& operator=(const GrabberFieldEvent&) = delete;
+
+        bool open(const int unitmap); // return false if the event is not available
+        void close();
+        bool isOpen() const;
+
+        void wait(const std::chrono::steady_clock::time_point &deadline);
+        void wakeUp(); // e.g. on stop request
+
+    private:
+        int _unitmap;
+        int _signal;    // Linux
+        int _pipe[2];
+        intptr_t _event; // HANDLE on Windows
+    };
+
+    GrabberFieldEvent _grabberFieldEvent; // it is open for acquisition time
+
+    // write image of buffer 'buff_no' into FITS file starting from 'first_pix' pixel.
+    // in zero-copy mode the image is read from grabber framebuffer 'buff_no'+1 by chunks
+    void writeImageData(const long first_pix, const IntegerType buff_no);
+
+    // native FITS writer: create file and write its primary header, write frame (as extension or
+    // into cube at offset of 'frame_no') and complete the file after acquisition ('n_frames' frames)
+    void openNativeFitsFile(const long naxis, const long *naxes, const bool exten_format, const std::string &date_str);
+    void saveToNativeFitsFile(const IntegerType frame_no, const IntegerType buff_no,
+                              const double exp_time, bool as_extension);
+    // write frame into mapped cube by one of concurrent saving threads (see _fitsCubeWriters)
+    void saveToMappedCube(const IntegerType frame_no, const ushort *image, const double exp_time);
+    void closeNativeFitsFile(const IntegerType n_frames, const bool exten_format);
+
+    // convert image of buffer 'buff_no' into FITS representation (see writeImageData for buffers)
+    void convertImageData(const IntegerType buff_no, unsigned char *dst);
+
+    // write frame as Rice-compressed tiled image extension (one tile per image line)
+    void saveToRiceFitsExtension(const IntegerType frame_no, const IntegerType buff_no, const double exp_time);
+
+    // image of buffer 'buff_no' in memory (in zero-copy mode it is read from grabber framebuffer)
+    const ushort* frameImage(const IntegerType buff_no);
+
+    // read image from grabber framebuffer 'grabber_buff' (starting from 1) into image buffer 'buff_no'
+    void copyFrameBuffer(const long grabber_buff, const IntegerType frame_no, const IntegerType buff_no);
+
+    // read 'npix' packed image pixels from grabber framebuffer 'grabber_buff' starting
+    // from line 'first_line' (full lines and, possibly, a part of the next line)
+    void readGrabberPixels(const long grabber_buff, const IntegerType first_line, const size_t npix, ushort *buff);
+
+    // run camera in fixed frame rate continuous sequence mode and grabber in live sequence capturing mode.
+    // if 'recorder' is true frames are kept in memory ring until triggerRecorder is called.
+    // the method returns number of frames passed to saving thread
+    IntegerType doStreamingAcquisition(const ulong timeout, const bool recorder = false);
+
+            /*   DECLARATION OF A POOL OF IMAGE BUFFERS   */
+
+    // the pool keeps once allocated memory blocks for the whole camera object life.
+    // blocks have power-of-two sizes (size classes), so a block allocated for larger
+    // image is reused for smaller ones (e.g. after changing ROI or binning).
+    // blocks of at least page size are page-aligned, smaller ones are cache line aligned.
+    // optionally the blocks are backed by huge pages, pre-faulted and locked in RAM
+    class FrameBufferPool {
+    public:
+        FrameBufferPool();
+        ~FrameBufferPool();
+
+        FrameBufferPool(const FrameBufferPool&) = delete;
+        FrameBufferPool& operator=(const FrameBufferPool&) = delete;
+
+        // get free buffer of at least 'len' elements (throw std::bad_alloc).
+        // memory of a new block is placed on NUMA node 'numa_node' (if it is not negative)
+        ushort* acquire(const size_t len, const bool huge_pages = false,
+                        const bool prefault = false, const bool lock = false, const int numa_node = -1);
+        // return all the buffers into the pool
+        void releaseAll();
+        // free all memory blocks
+        void clear();
+
+        size_t allocatedBytes() const;
+        size_t lockFailures() const; // number of blocks which could not be locked in RAM
+        size_t numaFailures() const; // number of blocks which could not be placed on NUMA node
+
+    private:
+        struct Block {
+            void *addr;
+            size_t size;
+            bool mapped;    // allocated by OS virtual memory API
+            bool hugePages;
+            bool locked;
+            bool used;
+            int numaNode;
+        };
+
+        std::vector<Block> _blocks;
+        size_t _lockFailures;
+        size_t _numaFailures;
+
+        Block allocate(const size_t size, const bool huge_pages, const bool prefault, const int numa_node);
+        void free(Block &block);
+        void lock(Block &block);
+    };
+
+            /*   DECLARATION OF NATIVE FITS FILE WRITER CLASS  */
+
+    // it writes 2880-byte blocks at given offsets of the file (pwrite), so a frame is written
+    // by one system call without any seeking and buffering
+
+    class FitsStreamWriter {
+    public:
+        // in-memory header: 80-character cards. the header occupies at least 'capacity' cards,
+        // so keywords can be added later without moving of the data following the header
+
+        class Header {
+        public:
+            Header(const size_t capacity = 0);
+
+            void setLogical(const std::string &key, const bool value, const std::string &comment = "");
+            void setInteger(const std::string &key, const long long value, const std::string &comment = "");
+            void setDouble(const std::string &key, const double value, const std::string &comment = "");
+            void setString(const std::string &key, const std::string &value, const std::string &comment = "");
+            void remove(const std::string &key);
+
+            void clear();
+
+            size_t size() const; // in bytes (multiple of FITS block)
+            void serialize(char *buff) const; // 'buff' must be at least size() bytes long
+
+            size_t cardsNumber() const;
+            const std::string& card(const size_t i) const; // 80-character card
+            std::string keyword(const size_t i) const;     // without trailing spaces
+            size_t valueCardsNumber(const size_t i) const; // the i-th card and its CONTINUE-cards
+
+        private:
+            size_t _capacity;
+            std::vector<std::string> _cards; // without END-card
+
+            void setCard(const std::string &key, const std::string &value, const std::string &comment);
+            void setCards(const std::string &key, const std::vector<std::string> &cards);
+        };
+
+        FitsStreamWriter();
+        ~FitsStreamWriter();
+
+        FitsStreamWriter(const FitsStreamWriter&) = delete;
+        FitsStreamWriter& operator=(const FitsStreamWriter&) = delete;
+
+        // create new (or truncate existing) file (throw EagleCameraException)
+        void open(const std::string &filename);
+        void close();
+        bool isOpen() const;
+
+        void write(const void *data, const size_t len, const uint64_t offset);
+        void truncate(const uint64_t len); // set file length (extended part is filled by zeros)
+
+        // reserve disk space for the file of 'len' bytes. throw EagleCameraException if there is no room,
+        // return false (the file is not changed) if filesystem can not reserve the space
+        bool allocate(const uint64_t len);
+
+        // map the first 'len' bytes of the file into memory (return nullptr if it is not possible),
+        // start writing of mapped bytes to disk and unmap the file (close() unmaps it too).
+        // the space must be allocated before mapping: a page without disk block raises SIGBUS if the disk is full
+        char* map(const uint64_t len);
+        void flush(const uint64_t offset, const uint64_t len);
+        void unmap();
+
+        static uint64_t padded(const uint64_t bytes); // rounded up to FITS block size
+
+    private:
+        std::string _filename;
+        intptr_t _file; // file descriptor (HANDLE on Windows)
+
+        char *_map;
+        uint64_t _mapLen;
+        intptr_t _mapping; // file mapping object on Windows
+    };
+
+
+            /*   DECLARATION OF NATIVE FITS WRITER THREADS POOL CLASS  */
+
+    // it runs a batch of independent jobs (tiles or slices of an image) in parallel.
+    // the thread calling run() runs jobs too
+
+    class FitsWorkerPool {
+    public:
+        typedef std::function<void(const size_t job, const size_t thread)> job_t; // 'thread' 0 is the calling one
+
+        FitsWorkerPool();
+        ~FitsWorkerPool();
+
+        FitsWorkerPool(const FitsWorkerPool&) = delete;
+        FitsWorkerPool& operator=(const FitsWorkerPool&) = delete;
+
+        // start 'n_threads' workers. 'init' is called by each worker at start
+        void start(const size_t n_threads, const std::function<void()> &init = nullptr);
+        void stop();
+
+        size_t threadsNumber() const; // workers plus the calling thread
+
+        // run jobs from 0 to 'n_jobs'-1 and wait for all of them. the first exception
+        // thrown by a job is re-thrown
+        void run(const size_t n_jobs, const job_t &job);
+
+    private:
+        std::vector<std::thread> _threads;
+        std::mutex _mutex;
+        std::condition_variable _jobCond;
+        std::condition_variable _doneCond;
+        bool _stop;
+        uint64_t _generation; // number of batches (workers take each batch once)
+        size_t _busyWorkers;
+        size_t _doneJobs;
+
+        const job_t *_job;
+        size_t _jobsNumber;
+        std::atomic<size_t> _nextJob;
+        std::exception_ptr _error;
+
+        void worker(const size_t thread);
+        size_t runJobs(const size_t thread); // return number of done jobs
+    };
+
+            /*   DECLARATION OF PARALLEL FITS TILES COMPRESSOR CLASS  */
+
+    // it compresses tiles of an image by Rice algorithm on a pool of threads
+
+    class FitsTileCompressor {
+    public:
+        FitsTileCompressor();
+
+        // compress image of 'n_pix' unsigned 16-bit pixels by tiles of 'tile_len' pixels
+        // (the last tile can be shorter) and wait for all the tiles (throw EagleCameraException)
+        void compress(FitsWorkerPool &pool, const ushort *image, const size_t n_pix, const size_t tile_len);
+
+        size_t tilesNumber() const;
+        const unsigned char* tileData(const size_t i) const;
+        size_t tileBytes(const size_t i) const;
+
+    private:
+        size_t _tilesNumber;
+        std::vector<std::vector<unsigned char>> _tiles;
+        std::vector<size_t> _tileBytes;
+        std::vector<std::vector<short>> _pixels; // tile in FITS representation for each thread
+    };
+
+    // FITS headers are built in memory: camera state and versions keywords (written into primary
+    // header after acquisition) and keywords of a frame (start of exposure, temperatures and exposure duration)
+    void fitsCameraInfoHeader(FitsStreamWriter::Header &hdr);
+    void fitsFrameHeader(FitsStreamWriter::Header &hdr, const FrameMetadata &meta, const double exp_time);
+
+    // write cards into current HDU of CFITSIO file (append them or update existing keywords)
+    void writeFitsHeaderCards(const FitsStreamWriter::Header &hdr, const bool update);
+
+    // formats of "CUBE INFO" table columns (metadata of 'n_frames' frames, dropped frames have empty records)
+    std::vector<std::string> cubeInfoFormats(const IntegerType n_frames);
+
+    // native FITS writer: append "CUBE INFO" ASCII table at 'offset' by one write (return HDU length)
+    uint64_t saveNativeCubeInfo(const IntegerType n_frames, const uint64_t offset);
+
+            /*   DECLARATION OF A JOB QUEUE FOR ACQUISITION WORKER THREADS  */
+
+    struct AcquisitionJob {
+        IntegerType frame_no;
+        IntegerType buff_no;
+        std::chrono::steady_clock::time_point submitted; // time point the job was put into queue
+        long grabber_buff;  // grabber framebuffer with captured image (for copying job)
+    };
+
+    class AcquisitionJobQueue {
+    public:
+        AcquisitionJobQueue(): _jobs(), _mutex(), _cond(), _closed(false)
+        {
+        }
+
+        void push(const AcquisitionJob &job) {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _jobs.push_back(job);
+            }
+            _cond.notify_one();
+        }
+
+        // wait for a job. return false if the queue was closed and there are no more jobs
+        bool pop(AcquisitionJob &job) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cond.wait(lock, [this]{return _closed || !_jobs.empty();});
+            if ( _jobs.empty() ) return false;
+
+            job = _jobs.front();
+            _jobs.pop_front();
+            return true;
+        }
+
+        void close(const bool discard_jobs = false) {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _closed = true;
+                if ( discard_jobs ) _jobs.clear();
+            }
+            _cond.notify_all();
+        }
+
+        void reset() {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _jobs.clear();
+            _closed = false;
+        }
+
+    private:
+        std::deque<AcquisitionJob> _jobs;
+        std::mutex _mutex;
+        std::condition_variable _cond;
+        bool _closed;
+    };
+
+            /*   DECLARATION OF A LOCK-FREE RING OF FRAMES   */
+
+    // bounded ring of (frame sequence number, image buffer index) entries with a single
+    // producer. entries are taken by CAS on the tail, so besides of the main consumer
+    // the producer itself can take the oldest entries (e.g. to drop them).
+    // head and tail are monotonic counters placed in separate cache lines.
+    // two rings are used during acquisition: the ring of frames ready for saving
+    // (acquisition thread -> saving thread) and the ring of free image buffers
+    // (saving thread -> acquisition thread)
+    class FrameRing {
+    public:
+        FrameRing(): _head(0), _tail(0), _closed(false), _discarded(false), _capacity(0), _frameNo(), _buffNo()
+        {
+        }
+
+        void reset(const size_t capacity) {
+            if ( capacity != _capacity ) {
+                _capacity = capacity;
+                _frameNo = std::unique_ptr<std::atomic<IntegerType>[]>(new std::atomic<IntegerType>[capacity]);
+                _buffNo = std::unique_ptr<std::atomic<IntegerType>[]>(new std::atomic<IntegerType>[capacity]);
+            }
+            _head.store(0);
+            _tail.store(0);
+            _closed.store(false);
+            _discarded.store(false);
+        }
+
+        size_t capacity() const {
+            return _capacity;
+        }
+
+            // producer side
+
+        bool full() const {
+            return (_head.load(std::memory_order_relaxed) - _tail.load(std::memory_order_acquire)) >= _capacity;
+        }
+
+        void push(const IntegerType frame_no, const IntegerType buff_no) { // the caller must check that ring is not full!
+            uint64_t head = _head.load(std::memory_order_relaxed);
+            _frameNo[head % _capacity].store(frame_no, std::memory_order_relaxed);
+            _buffNo[head % _capacity].store(buff_no, std::memory_order_relaxed);
+            _head.store(head + 1, std::memory_order_release);
+        }
+
+        void close(const bool discard_frames = false) { // if 'discard_frames' is true the consumer should
+                                                        // stop without processing of not popped frames
+            _discarded.store(discard_frames, std::memory_order_release);
+            _closed.store(true, std::memory_order_release);
+        }
+
+            // consumer side
+
+        bool empty() const {
+            return _tail.load(std::memory_order_acquire) == _head.load(std::memory_order_acquire);
+        }
+
+        bool closed() const {
+            return _closed.load(std::memory_order_acquire);
+        }
+
+        bool discarded() const {
+            return _discarded.load(std::memory_order_acquire);
+        }
+
+        // take the oldest entry. return false if the ring is empty
+        bool pop(IntegerType &frame_no, IntegerType &buff_no) {
+            uint64_t tail = _tail.load(std::memory_order_acquire);
+            for (;;) {
+                if ( tail == _head.load(std::memory_order_acquire) ) return false;
+
+                // the entry can be re-written by producer only after the tail is moved,
+                // so if CAS succeeds the read values are valid
+                frame_no = _frameNo[tail % _capacity].load(std::memory_order_relaxed);
+                buff_no = _buffNo[tail % _capacity].load(std::memory_order_relaxed);
+                if ( _tail.compare_exchange_weak(tail, tail + 1, std::memory_order_acq_rel,
+                                                 std::memory_order_acquire) ) return true;
+            }
+        }
+
+            // counters
+
+        uint64_t pushed() const {
+            return _head.load(std::memory_order_acquire);
+        }
+
+        uint64_t popped() const {
+            return _tail.load(std::memory_order_acquire);
+        }
+
+    private:
+        char _pad0[EAGLE_CAMERA_CACHE_LINE_SIZE];
+        std::atomic<uint64_t> _head;
+        char _pad1[EAGLE_CAMERA_CACHE_LINE_SIZE];
+        std::atomic<uint64_t> _tail;
+        char _pad2[EAGLE_CAMERA_CACHE_LINE_SIZE];
+        std::atomic<bool> _closed;
+        std::atomic<bool> _discarded;
+        size_t _capacity;
+        std::unique_ptr<std::atomic<IntegerType>[]> _frameNo; // frame sequence numbers
+        std::unique_ptr<std::atomic<IntegerType>[]> _buffNo;  // image buffer indices
+    };
+
+            /*   DECLARATION OF A RING OF TIMESTAMPED TELEMETRY SAMPLES   */
+
+    struct TelemetrySample {
+        std::chrono::steady_clock::time_point time;
+        double ccdTemp;
+        double pcbTemp;
+    };
+
+    // the ring is filled by telemetry thread and it keeps the latest samples in time order.
+    // acquisition thread looks for a sample nearest to a given time point
+    class TelemetryRing {
+    public:
+        TelemetryRing(const size_t capacity = EAGLE_CAMERA_DEFAULT_TELEMETRY_RING_SIZE):
+            _mutex(), _samples(capacity), _pushed(0)
+        {
+        }
+
+        void reset() {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _pushed = 0;
+        }
+
+        void push(const TelemetrySample &sample) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _samples[_pushed % _samples.size()] = sample;
+            ++_pushed;
+        }
+
+        // return false if there are no samples
+        bool nearest(const std::chrono::steady_clock::time_point &tp, TelemetrySample &sample) const {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if ( !_pushed ) return false;
+
+            uint64_t n = (_pushed < _samples.size()) ? _pushed : _samples.size();
+
+            // go from the newest sample to older ones while they are not earlier than 'tp'
+            uint64_t i = _pushed - 1;
+            sample = _samples[i % _samples.size()];
+            for ( uint64_t k = 1; (k < n) && (sample.time > tp); ++k ) {
+                const TelemetrySample &prev = _samples[(i-k) % _samples.size()];
+                if ( (tp - prev.time) >= (sample.time - tp) ) break; // the newer one is nearer
+                sample = prev;
+            }
+
+            return true;
+        }
+
+    private:
+        mutable std::mutex _mutex;
+        std::vector<TelemetrySample> _samples;
+        uint64_t _pushed;
+    };
+
+    // start thread sampling camera temperatures with rate of _telemetryRate.
+    // the first sample is taken before the method returns
+    void startTelemetrySampler();
+    void stopTelemetrySampler();
+    void sampleTelemetry();
+
+    // acquisition thread marks the time it triggers an exposure: telemetry thread does not start
+    // a serial transaction meanwhile, so the trigger waits for one register read at most
+    void setSnapshotPending(const bool pending);
+    void waitForSnapshotTrigger(); // called by telemetry thread before each register read
+
+    // set temperatures of frame 'frame_no' from telemetry sample nearest to 'tp'
+    void setFrameTelemetry(const IntegerType frame_no, const std::chrono::steady_clock::time_point &tp);
+
+    TelemetryRing _telemetryRing;
+    std::thread _telemetryThread;
+    std::mutex _telemetryMutex;
+    std::condition_variable _telemetryCond;
+    bool _telemetryStop;
+    double _telemetryRate; // in Hz
+    bool _snapshotPending; // guarded by _telemetryMutex
+
+    // scheduling of acquisition threads (it is applied by a thread itself at its start).
+    // failures (e.g. no permission for real-time policy) are logged and are not fatal
+    struct ThreadScheduling {
+        std::string policy;
+        IntegerType priority;
+        std::string affinity; // list of CPUs (e.g. "0,2-3"), empty means all CPUs
+    };
+
+    ThreadScheduling _captureThreadScheduling;    // acquisition and capturing threads
+    ThreadScheduling _writerThreadScheduling;     // FITS writer
+    ThreadScheduling _telemetryThreadScheduling;
+    ThreadScheduling _processingThreadScheduling; // processing stages and frame consumers
+
+    // threads without explicit CPU affinity are placed on CPUs of NUMA node of image buffers
+    void applyThreadScheduling(const ThreadScheduling &sched, const std::string &thread_name);
+    // parse list of CPUs. return false if it is invalid
+    static bool parseCpuList(const std::string &list, std::vector<int> &cpus);
+    // CPUs of NUMA node. return false if they cannot be determined
+    static bool numaNodeCpus(const int node, std::vector<int> &cpus);
+
+    // start capturing thread and pipeline workers which live for the whole acquisition proccess
+    void startAcquisitionWorkers(const ulong timeout, const bool as_extension);
+    // close job queue and frame rings and wait for the threads. if 'abort' is true
+    // not saved frames are discarded and errors of the threads are not re-thrown
+    void stopAcquisitionWorkers(const bool abort = false);
+
+    // worker of pipeline stage 'idx'. user stages are followed by FITS writer stage
+    // which returns image buffers back to acquisition thread
+    void runPipelineStage(const size_t idx, const bool as_extension);
+    FrameRing& pipelineInput(const size_t idx); // _frameRing for the first stage
+    // read spooled frame 'buff_no' into _restoreBuffer (for user stages). return false if
+    // the pipeline is discarded while waiting for the buffer
+    bool restoreSpooledFrame(const IntegerType buff_no, FrameRing &input);
+    // write frame into FITS file and release its buffer. concurrent cube writers pass
+    // spooled frame in 'spooled_image' (it is read in order of spilling when it is popped)
+    void writeFrame(const IntegerType frame_no, const IntegerType buff_no, const bool as_extension,
+                    const ushort *spooled_image = nullptr);
+
+    // bounded queue of frame handles for consumer worker
+    class FrameHandleQueue {
+    public:
+        FrameHandleQueue(): _frames(), _mutex(), _cond(), _capacity(0), _closed(false)
+        {
+        }
+
+        // return false if the queue is full or closed
+        bool push(const FrameHandle &frame) {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if ( _closed || (_frames.size() >= _capacity) ) return false;
+                _frames.push_back(frame);
+            }
+            _cond.notify_one();
+            return true;
+        }
+
+        // wait for a frame. return false if the queue was closed and there are no more frames
+        bool pop(FrameHandle &frame) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cond.wait(lock, [this]{return _closed || !_frames.empty();});
+            if ( _frames.empty() ) return false;
+
+            frame = _frames.front();
+            _frames.pop_front();
+            return true;
+        }
+
+        void close(const bool discard_frames = false) {
+            std::deque<FrameHandle> discarded; // release the handles outside the lock
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _closed = true;
+                if ( discard_frames ) discarded.swap(_frames);
+            }
+            _cond.notify_all();
+        }
+
+        void reset(const size_t capacity) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _frames.clear();
+            _capacity = capacity;
+            _closed = false;
+        }
+
+    private:
+        std::deque<FrameHandle> _frames;
+        std::mutex _mutex;
+        std::condition_variable _cond;
+        size_t _capacity;
+        bool _closed;
+    };
+
+    struct FrameConsumerWorker {
+        std::shared_ptr<FrameConsumer> consumer;
+        FrameHandleQueue queue;
+        std::thread thread;
+    };
+
+    // built-in consumer which invokes imageReady
+    class ImageReadyConsumer: public FrameConsumer {
+    public:
+        ImageReadyConsumer(EagleCamera *camera);
+        void consume(const FrameHandle &frame);
+    private:
+        EagleCamera *_camera;
+    };
+
+    void startFrameConsumers();
+    void stopFrameConsumers(const bool abort);
+    void runFrameConsumer(FrameConsumerWorker *worker);
+    // pass handles of the frame to consumers
+    void fanOutFrame(const IntegerType frame_no, const IntegerType buff_no);
+    // drop a reference to image buffer. the last one returns the buffer to acquisition thread
+    void releaseFrameBuffer(const IntegerType buff_no);
+
+    std::vector<std::shared_ptr<FrameConsumer>> _frameConsumers;
+    std::shared_ptr<FrameConsumer> _imageReadyConsumer;
+    std::vector<std::unique_ptr<FrameConsumerWorker>> _consumerWorkers;
+    size_t _fanOutStage; // frames are passed to consumers after this number of processing stages
+    std::deque<std::atomic<int>> _bufferRefs; // references to image buffers (a deque does not move elements)
+    std::atomic<int> _frameHandlesNumber;     // valid frame handles (they can outlive the acquisition)
+    std::mutex _freeBuffersMutex; // several threads can return image buffers
+
+    std::vector<std::shared_ptr<FrameProcessingStage>> _processingStages;
+    std::vector<std::unique_ptr<FrameRing>> _stageRings; // inputs of stages except the first one
+    std::vector<std::thread> _pipelineThreads;
+    std::vector<std::thread> _cubeWriterThreads; // more FITS writers sharing the input of the last stage
+    IntegerType _restoreBuffer;           // image buffer for spooled frames passing user stages
+    std::atomic<bool> _restoreBufferBusy;
+
+    // captured frames are copied from grabber framebuffers in separate thread, so the next frame
+    // can be exposed and captured (into the next framebuffer) while the previous one is copied
+    void waitForCapturedFrames(const IntegerType frames_number, const ulong timeout); // captured and copied
+    void waitForSnappedFrames(const IntegerType frames_number, const ulong timeout);
+    void waitForFreeFrameSlot();
+    void notifyAcquisitionState();
+
+    // get a free image buffer for the next frame according to backpressure policy.
+    // it returns _scratchBuffer if the frame is to be dropped or spilled
+    IntegerType takeFrameBuffer();
+    // pass captured frame to saving pipeline (or drop or spill it if it is in scratch buffer)
+    void publishFrame(const IntegerType frame_no, const IntegerType buff_no);
+
+    void openSpoolFile();
+    void closeSpoolFile();
+    bool spillFrame(const IntegerType frame_no); // return false if there is no room to spill the frame
+    void runSpillThread(); // write queued frames into spool file
+    void readSpooledFrame(const IntegerType buff_no, ushort *buff = nullptr); // into _spoolBuffer if 'buff' is nullptr
+
+    AcquisitionJobQueue _captureQueue;
+    FrameRing _frameRing;  // frames ready for saving
+    FrameRing _freeBuffers; // image buffers which can be filled
+    std::thread _captureThread;
+
+    std::mutex _acquisitionStateMutex;              // guards the counter and errors below
+    std::condition_variable _acquisitionStateCond;  // is notified on any acquisition state change
+    IntegerType _capturedFrames; // captured and copied frames
+    IntegerType _snappedFrames;  // captured frames (they are possibly still in grabber framebuffers)
+    AcquisitionJobQueue _copyQueue;
+    std::thread _copyThread;
+    std::exception_ptr _captureError;
+    std::exception_ptr _savingError;
+
+    bool _acquisitionStarted;                 // FITS file is created and workers are started (or start failed)
+    std::exception_ptr _acquisitionStartError;
+    void setAcquisitionStarted(const std::exception_ptr &err = nullptr);
+
+    int64_t _captureDispatchLatencySum; // in microseconds
+    int64_t _captureDispatchLatencyMax;
+
+    // time points of frame stages. they are kept per image buffer: a buffer belongs to
+    // one thread at a time, so the ownership handoff makes the fields visible for the next one.
+    // unset (zero) time point means the stage was skipped (e.g. no copying in zero-copy mode)
+    struct FrameTiming {
+        std::chrono::steady_clock::time_point triggered;
+        std::chrono::steady_clock::time_point snapped;
+        std::chrono::steady_clock::time_point copied;
+        std::chrono::steady_clock::time_point published;
+    };
+
+    std::vector<FrameTiming> _frameTiming;
+    LatencyHistogram _latencyHistogram[LATENCY_STAGES_NUMBER];
+
+    void recordLatency(const EagleCameraLatencyStage stage,
+                       const std::chrono::steady_clock::time_point &start,
+                       const std::chrono::steady_clock::time_point &stop);
+    void logLatencyStatistics();
 
     IntegerType _frameCounts; // number of frames per acquisition proccess
-    IntegerType _currentBuffer;
+    IntegerType _acquisitionFramesNumber; // maximal number of frames to be saved in the current acquisition
+                                          // (_frameCounts plus pre-trigger frames in RECORDER mode)
+
+    IntegerType _preTriggerFrames; // number of frames in memory ring in RECORDER mode
+    std::atomic<bool> _recorderTriggered;
 
     IntegerType _frameBufferLines;
     long _imageXDim;
@@ -521,17 +1630,82 @@ protected:
     double _expTime;
     std::chrono::system_clock::time_point _startExpTimepoint;
     std::chrono::system_clock::time_point _stopExpTimepoint;
-    std::vector<std::string> _startExpTimestamp;
-    std::vector<double> _ccdTemp;
-    std::vector<double> _pcbTemp;
-    std::vector<std::unique_ptr<ushort[]>> _imageBuffer; // image buffers addresses
+
+    // metadata of frames in flight (from trigger to FITS writing). the ring is sized by maximal
+    // number of not saved frames (image buffers and spooled frames), so its memory does not
+    // depend on number of frames in acquisition
+    std::vector<FrameMetadata> _frameMetadata;
+    FrameMetadata& frameMetadata(const IntegerType frame_no)
+    {
+        return _frameMetadata[frame_no % _frameMetadata.size()];
+    }
+    std::vector<FrameMetadata> _cubeMetadata; // metadata of saved frames for "CUBE INFO" table (CUBE format)
+    FrameBufferPool _frameBufferPool;
+    std::vector<ushort*> _imageBuffer; // image buffers addresses (the memory is owned by the pool)
     size_t _currentBufferLength;
-    size_t _usedBuffersNumber;
+    std::string _hugePagesMode;
+    std::string _prefaultBuffersMode;
+    std::string _lockBuffersMode;
+    IntegerType _numaNode; // NUMA node of image buffers and acquisition threads (negative means no placement)
+    std::vector<int> _numaCpus; // CPUs of the node in the current acquisition
+    IntegerType _grabberBuffersNumber; // number of grabber framebuffers
+    IntegerType _acquisitionBuffersNumber; // number of image buffers (grabber framebuffers in zero-copy mode)
+                                           // used in the current acquisition (without scratch buffer)
+
+    std::string _acquisitionMode;
+    std::atomic<IntegerType> _lostFrames; // number of frames re-written in grabber memory before reading (streaming mode)
+
+    std::string _backpressurePolicy;
+    IntegerType _scratchBuffer;   // index of image buffer for frames to be dropped or spilled
+    std::atomic<IntegerType> _droppedFrames;
+    std::atomic<IntegerType> _spilledFrames;
+
+    std::string _spoolFilename;   // raw spool file for SPILL policy
+    std::string _spoolFilePath;
+    std::FILE *_spoolWriteFile;   // spill thread stream
+    std::FILE *_spoolReadFile;    // saving thread stream
+    uint64_t _spoolWritten;       // number of frames queued for spool file
+    std::atomic<uint64_t> _spoolFlushed;    // number of frames written into spool file
+    uint64_t _spoolRead;                    // number of frames read from spool file
+    std::atomic<IntegerType> _spoolPending; // number of spooled frames still not saved into FITS file
+    std::vector<ushort> _spoolBuffer;       // saving thread buffer to read spooled frames
+
+    // acquisition thread copies the frame into a free spill buffer and passes it to spill thread
+    // (the ring entry is spool slot and spill buffer index), so disk writing does not block capturing
+    std::vector<std::vector<ushort>> _spillBuffers;
+    FrameRing _spillRing;
+    FrameRing _freeSpillBuffers;
+    std::thread _spillThread;
+    bool _spillStopped; // guarded by _acquisitionStateMutex
+
+    std::string _zeroCopyMode;
+    bool _zeroCopyFrames;               // is zero-copy mode used in the current acquisition
+    std::vector<ushort> _zeroCopyChunk; // saving thread buffer to read grabber framebuffer chunks
 
     fitsfile* _fitsFilePtr;
     std::string _fitsFilename;
     std::string _fitsHdrFilename;
     std::string _fitsDataFormat;
+    std::string _fitsWriterMode;
+
+    bool _nativeFitsWriting;                    // is the current FITS file written by native writer
+    FitsStreamWriter _fitsStreamWriter;
+    FitsStreamWriter::Header _fitsPrimaryHeader;
+    uint64_t _fitsDataOffset;                   // offset of primary data (CUBE) or the first extension (EXTEN)
+    uint64_t _fitsWriteOffset;                  // offset of the next extension (EXTEN)
+    std::vector<char> _fitsFrameBuffer;         // saving thread buffer of HDU in FITS representation
+
+    bool _riceFitsFormat;                       // are frames written as Rice-compressed extensions
+    IntegerType _fitsWriterThreads;
+    FitsWorkerPool _fitsWorkerPool;
+    FitsTileCompressor _fitsTileCompressor;
+    std::vector<ushort> _fitsTileImage;         // saving thread buffer to read image in zero-copy mode
+
+    std::string _fitsFileMappingMode;
+    char *_fitsCubeMap;                         // mapped primary array of natively written cube (or nullptr)
+    size_t _fitsCubeWriters;                    // saving threads writing into mapped cube concurrently (or 0)
+    std::mutex _fitsCubeInputMutex;             // cube writers pop spooled frames and read them in order
+    std::mutex _fitsCubeMutex;                  // _cubeMetadata and primary header keywords of cube writers
     long _fitsWritingTimeout; // timeout in milliseconds for writing each image buffer into FITS file
 
     EagleCamera::EagleCameraError _lastCameraError;
@@ -540,7 +1714,16 @@ protected:
     std::atomic<bool> _acquiringFinished;
     long _acquisitionProccessPollingInterval; // in milliseconds
 
-    std::future<void> _acquisitionProccessThreadFuture;
+    std::shared_future<void> _acquisitionProccessThreadFuture;
+    std::thread _acquisitionProccessThread;
+
+    std::atomic<IntegerType> _publishedFrames;
+    std::atomic<IntegerType> _savedFrames;
+    std::atomic<uint64_t> _bytesWritten;
+    progress_callback_t _progressCallback;
+    std::mutex _progressMutex; // the callback is called by several saving threads
+
+    void notifyProgress(const bool finished);
 
     long _capturingTimeoutGap;
 
@@ -564,6 +1747,10 @@ protected:
 
         /*  CAMERALINK serial port methods and member */
 
+    // serializes camera serial port transactions of different threads (e.g. telemetry and acquisition ones).
+    // it is recursive since transactions consist of nested ones
+    std::recursive_mutex _serialPortMutex;
+
     typedef std::vector<unsigned char> byte_vector_t;
 
     bool CL_ACK_BIT_ENABLED;
@@ -582,11 +1769,30 @@ protected:
                                                                                            // return 'response'
                                                                                            // 'timeout' is a timeout in millisecs
                                                                                            // between cl_write an cl_read commands
+                                                                                           // (only if no response and ACK
+                                                                                           // are expected)
     int cl_exec(const byte_vector_t command, const long timeout = 10);
 
     byte_vector_t readRegisters(const byte_vector_t addr, const byte_vector_t addr_comm = byte_vector_t());
     void writeRegisters(const byte_vector_t addr, const byte_vector_t values);
 
+    // shadow copy of FPGA registers (it is enabled during acquisition sequence).
+    // a group of registers is written only if one of them differs from the shadow
+    // (so multi-byte values are still latched as a whole) and register values
+    // which are in the shadow are not read from the camera. only configuration
+    // registers changed by the host alone are shadowed (not status ones)
+    static bool isShadowedRegister(const unsigned char address);
+    bool _registerShadowEnabled;
+    std::map<unsigned char, unsigned char> _registerShadow;
+    size_t _registerShadowHits; // number of skipped writes of register groups
+
+    void enableRegisterShadow(const bool enabled);
+
+    std::atomic<bool> _sequenceStopped;
+
+    void applySequenceSetting(const SequenceSetting &setting);
+    static std::string sequenceFilename(const std::string &filename_template, const size_t step, const std::string &name);
+
     bool resetMicro(const long timeout = 10000); // timeout in microsecs
     bool resetFPGA(const long timeout = 10000);  // timeout in microsecs
 
@@ -715,32 +1921,29 @@ protected:
 
 
 
-    std::stringstream logMessageStream;
-    std::mutex logMessageStreamMutex;
-
     // format logging message for call of CFITSIO functions
     // (the first argument is CFITSIO function name, others - its arguments
     // except the first one (pointer to FITS structure) - it is added automatically)
     template<typename... T>
-    void formatFitsLogMessage(const char* func_name, T... args);
+    std::string formatFitsLogMessage(const char* func_name, T... args);
 
     // format logging message for call of XCLIB functions
     // (the first argument is XCLIB function name, others - its arguments
     // except the first one (unitmap) - it is added automatically)
     template<typename... T>
-    void formatLogMessage(const char* func_name, T... args);
+    std::string formatLogMessage(const char* func_name, T... args);
 
     // helper methods for logging
     template<typename T1, typename... T2>
-    inline void logHelper(T1 first, T2... last);
+    inline void logHelper(std::ostream &os, T1 first, T2... last);
 
     template<typename T>
-    inline void logHelper(T arg);
+    inline void logHelper(std::ostream &os, T arg);
 
-    inline void logHelper(const std::string &str);
-    inline void logHelper(const char* str);
-    inline void logHelper(const void* addr);
-    inline void logHelper();
+    inline void logHelper(std::ostream &os, const std::string &str);
+    inline void logHelper(std::ostream &os, const char* str);
+    inline void logHelper(std::ostream &os, const void* addr);
+    inline void logHelper(std::ostream &os);
 
     // add to logging string (see formatLogMessage) return value of XCLIB functions in form "-> ret_val"
     inline std::string logXCLIB_Info(const std::string & str, const int result);
@@ -759,7 +1962,14 @@ protected:
 
         /*  static members and methods  */
 
+    // XCLIB is opened once per process and it is shared by all camera objects.
+    // each object controls its own grabber units (e.g. ports of multi-port grabber),
+    // so cameras can acquire concurrently with independent threads and buffers
+
+    static std::mutex grabberContextMutex;
     static size_t createdObjects;
+    static std::string grabberVideoFormat; // video format the library was opened with
+    static int grabberUsedUnitmap;         // units controlled by camera objects
 };
 
 
@@ -823,6 +2033,7 @@ private:
 #define EAGLE_CAMERA_COMMAND_RESET "RESET"
 #define EAGLE_CAMERA_COMMAND_EXPSTART "EXPSTART"
 #define EAGLE_CAMERA_COMMAND_EXPSTOP  "EXPSTOP"
+#define EAGLE_CAMERA_COMMAND_RECTRIGGER "RECTRIGGER"
 
 
                     /*******************************************************
@@ -862,6 +2073,19 @@ private:
 #define EAGLE_CAMERA_FEATURE_FITS_FILENAME_NAME        "FitsFilename"
 #define EAGLE_CAMERA_FEATURE_FITS_HDR_FILENAME_NAME    "FitsHdrFilename"
 #define EAGLE_CAMERA_FEATURE_FRAME_BUFFERS_NUMBER_NAME "FrameBuffers"
+#define EAGLE_CAMERA_FEATURE_TELEMETRY_RATE_NAME       "TelemetryRate"
+#define EAGLE_CAMERA_FEATURE_PRE_TRIGGER_FRAMES_NAME   "PreTriggerFrames"
+#define EAGLE_CAMERA_FEATURE_DROPPED_FRAMES_NAME       "DroppedFrames"
+#define EAGLE_CAMERA_FEATURE_SPILLED_FRAMES_NAME       "SpilledFrames"
+#define EAGLE_CAMERA_FEATURE_LOST_FRAMES_NAME          "LostFrames"
+#define EAGLE_CAMERA_FEATURE_SPOOL_FILENAME_NAME       "SpoolFilename"
+
+#define EAGLE_CAMERA_FEATURE_CAPTURE_THREAD_PRIORITY_NAME    "CaptureThreadPriority"
+#define EAGLE_CAMERA_FEATURE_WRITER_THREAD_PRIORITY_NAME     "WriterThreadPriority"
+#define EAGLE_CAMERA_FEATURE_TELEMETRY_THREAD_PRIORITY_NAME  "TelemetryThreadPriority"
+#define EAGLE_CAMERA_FEATURE_PROCESSING_THREAD_PRIORITY_NAME "ProcessingThreadPriority"
+#define EAGLE_CAMERA_FEATURE_NUMA_NODE_NAME                  "NUMANode" // node of image buffers and threads
+                                                                        // (-1 means no placement)
 
 
             /***************************************************
@@ -912,6 +2136,98 @@ private:
 #define EAGLE_CAMERA_FEATURE_FITS_DATA_FORMAT_NAME   "FitsDataFormat"
 #define EAGLE_CAMERA_FEATURE_FITS_DATA_FORMAT_EXTEN  "EXTEN"  // write frames into separate IMAGE-extensions
 #define EAGLE_CAMERA_FEATURE_FITS_DATA_FORMAT_CUBE   "CUBE"   // write frames into primary array as a 3D cube
+#define EAGLE_CAMERA_FEATURE_FITS_DATA_FORMAT_RICE   "RICE"   // write frames into separate Rice-compressed tiled
+                                                              // image extensions (always by native writer)
+
+
+    /*     "FitsWriterThreads"     */
+
+#define EAGLE_CAMERA_FEATURE_FITS_WRITER_THREADS_NAME "FitsWriterThreads" // number of threads of native writer
+                                                                          // ("RICE" format or mapped cube)
+
+
+    /*     "FitsFileMapping"     */
+
+    // natively written "CUBE" file is preallocated and memory-mapped, frames are
+    // converted directly into the mapping by all the threads of native writer
+
+#define EAGLE_CAMERA_FEATURE_FITS_FILE_MAPPING_NAME  "FitsFileMapping"
+#define EAGLE_CAMERA_FEATURE_FITS_FILE_MAPPING_ON    "ON"
+#define EAGLE_CAMERA_FEATURE_FITS_FILE_MAPPING_OFF   "OFF"
+
+
+    /*     "FitsWriter"     */
+
+#define EAGLE_CAMERA_FEATURE_FITS_WRITER_NAME     "FitsWriter"
+#define EAGLE_CAMERA_FEATURE_FITS_WRITER_CFITSIO  "CFITSIO" // write frames by CFITSIO library
+#define EAGLE_CAMERA_FEATURE_FITS_WRITER_NATIVE   "NATIVE"  // write frames by native writer (CFITSIO writes
+                                                            // keywords after acquisition only)
+
+
+    /*     "BackpressurePolicy"     */
+
+    // what to do with a frame if all image buffers are still not saved into FITS file
+
+#define EAGLE_CAMERA_FEATURE_BACKPRESSURE_POLICY_NAME        "BackpressurePolicy"
+#define EAGLE_CAMERA_FEATURE_BACKPRESSURE_POLICY_BLOCK       "BLOCK"        // wait for a free buffer
+#define EAGLE_CAMERA_FEATURE_BACKPRESSURE_POLICY_DROP_NEWEST "DROP_NEWEST"  // drop the frame
+#define EAGLE_CAMERA_FEATURE_BACKPRESSURE_POLICY_DROP_OLDEST "DROP_OLDEST"  // drop the oldest not saved frame
+#define EAGLE_CAMERA_FEATURE_BACKPRESSURE_POLICY_SPILL       "SPILL"        // write the frame into raw spool file
+                                                                            // to be saved later
+
+
+    /*     "HugePages", "PrefaultBuffers", "LockBuffers"     */
+
+    // memory of image buffers pool (it is applied to newly allocated buffers)
+
+#define EAGLE_CAMERA_FEATURE_HUGE_PAGES_NAME       "HugePages"        // back image buffers by huge pages
+#define EAGLE_CAMERA_FEATURE_PREFAULT_BUFFERS_NAME "PrefaultBuffers"  // touch all pages of image buffers
+                                                                      // right after allocation
+#define EAGLE_CAMERA_FEATURE_LOCK_BUFFERS_NAME     "LockBuffers"      // lock image buffers in RAM
+#define EAGLE_CAMERA_FEATURE_BUFFERS_MEMORY_ON     "ON"
+#define EAGLE_CAMERA_FEATURE_BUFFERS_MEMORY_OFF    "OFF"
+
+
+    /*     "ZeroCopy"     */
+
+#define EAGLE_CAMERA_FEATURE_ZERO_COPY_NAME  "ZeroCopy"
+#define EAGLE_CAMERA_FEATURE_ZERO_COPY_ON    "ON"   // keep images in grabber framebuffers until they are saved
+#define EAGLE_CAMERA_FEATURE_ZERO_COPY_OFF   "OFF"  // copy images into image buffers right after capturing
+
+
+    /*     "CaptureThreadPolicy", "WriterThreadPolicy", "TelemetryThreadPolicy", "ProcessingThreadPolicy"     */
+
+    // scheduling policy of acquisition threads. real-time policies use '...ThreadPriority'
+    // features (on Windows FIFO and RR mean highest or time-critical thread priority)
+
+#define EAGLE_CAMERA_FEATURE_CAPTURE_THREAD_POLICY_NAME    "CaptureThreadPolicy"
+#define EAGLE_CAMERA_FEATURE_WRITER_THREAD_POLICY_NAME     "WriterThreadPolicy"
+#define EAGLE_CAMERA_FEATURE_TELEMETRY_THREAD_POLICY_NAME  "TelemetryThreadPolicy"
+#define EAGLE_CAMERA_FEATURE_PROCESSING_THREAD_POLICY_NAME "ProcessingThreadPolicy"
+#define EAGLE_CAMERA_FEATURE_THREAD_POLICY_OTHER           "OTHER"  // default time-sharing scheduling
+#define EAGLE_CAMERA_FEATURE_THREAD_POLICY_FIFO            "FIFO"   // SCHED_FIFO
+#define EAGLE_CAMERA_FEATURE_THREAD_POLICY_RR              "RR"     // SCHED_RR
+
+
+    /*     "CaptureThreadAffinity", "WriterThreadAffinity", "TelemetryThreadAffinity", "ProcessingThreadAffinity"     */
+
+    // CPUs of acquisition threads as a list (e.g. "0,2-3"). empty string means all CPUs
+
+#define EAGLE_CAMERA_FEATURE_CAPTURE_THREAD_AFFINITY_NAME    "CaptureThreadAffinity"
+#define EAGLE_CAMERA_FEATURE_WRITER_THREAD_AFFINITY_NAME     "WriterThreadAffinity"
+#define EAGLE_CAMERA_FEATURE_TELEMETRY_THREAD_AFFINITY_NAME  "TelemetryThreadAffinity"
+#define EAGLE_CAMERA_FEATURE_PROCESSING_THREAD_AFFINITY_NAME "ProcessingThreadAffinity"
+
+
+    /*     "AcquisitionMode"     */
+
+#define EAGLE_CAMERA_FEATURE_ACQUISITION_MODE_NAME       "AcquisitionMode"
+#define EAGLE_CAMERA_FEATURE_ACQUISITION_MODE_SNAPSHOT   "SNAPSHOT"   // software trigger for each frame
+#define EAGLE_CAMERA_FEATURE_ACQUISITION_MODE_STREAMING  "STREAMING"  // camera continuous sequence with fixed frame rate
+#define EAGLE_CAMERA_FEATURE_ACQUISITION_MODE_RECORDER   "RECORDER"   // streaming into memory ring of the last
+                                                                     // 'PreTriggerFrames' frames without saving.
+                                                                     // the ring and the next 'FrameCount' frames
+                                                                     // are saved after 'RECTRIGGER' command
 
 
 #endif // EAGLE_CAMERA_H
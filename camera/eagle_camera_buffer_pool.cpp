@@ -0,0 +1,244 @@
+#include <eagle_camera.h>
+
+#include <cstdlib>
+#include <new>
+
+#if defined(_WIN32) || defined(__WIN32__) || defined(_WIN64)
+    #include <malloc.h>
+    #define EAGLE_CAMERA_BUFFER_POOL_WIN
+#else
+    #include <sys/mman.h>
+    #include <unistd.h>
+#ifdef __linux__
+    #include <sys/syscall.h>
+    #define EAGLE_CAMERA_MPOL_PREFERRED 1 // see <numaif.h> (libnuma is not required)
+#endif
+#endif
+
+
+            /***************************************************
+            *                                                  *
+            *   IMPLEMENTATION OF IMAGE BUFFERS POOL CLASS     *
+            *                                                  *
+            ***************************************************/
+
+
+static size_t page_size()
+{
+#ifdef EAGLE_CAMERA_BUFFER_POOL_WIN
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+#else
+    return sysconf(_SC_PAGESIZE);
+#endif
+}
+
+
+// size class of a block: the nearest not less power of two
+static size_t size_class(const size_t size)
+{
+    size_t sz = EAGLE_CAMERA_CACHE_LINE_SIZE;
+    while ( sz < size ) sz <<= 1;
+
+    return sz;
+}
+
+
+EagleCamera::FrameBufferPool::FrameBufferPool(): _blocks(), _lockFailures(0), _numaFailures(0)
+{
+}
+
+
+EagleCamera::FrameBufferPool::~FrameBufferPool()
+{
+    clear();
+}
+
+
+ushort* EagleCamera::FrameBufferPool::acquire(const size_t len, const bool huge_pages,
+                                              const bool prefault, const bool lock, const int numa_node)
+{
+    size_t size = len*sizeof(ushort);
+
+    // the smallest free block of suitable size and kind
+
+    Block *best = nullptr;
+    for ( auto &block: _blocks ) {
+        if ( block.used || (block.size < size) || (block.hugePages != huge_pages) ) continue;
+        if ( block.numaNode != numa_node ) continue;
+        if ( !best || (block.size < best->size) ) best = &block;
+    }
+
+    if ( !best ) {
+        // free blocks of another kind or NUMA node (e.g. NUMANode feature was changed): they would
+        // never be used while the pool grows for the current placement
+        for ( auto it = _blocks.begin(); it != _blocks.end(); ) {
+            if ( !it->used && ((it->hugePages != huge_pages) || (it->numaNode != numa_node)) ) {
+                free(*it);
+                it = _blocks.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        _blocks.push_back(allocate(size_class(size), huge_pages, prefault, numa_node));
+        best = &_blocks.back();
+    }
+
+    if ( lock && !best->locked ) this->lock(*best);
+
+    best->used = true;
+
+    return static_cast<ushort*>(best->addr);
+}
+
+
+void EagleCamera::FrameBufferPool::releaseAll()
+{
+    for ( auto &block: _blocks ) block.used = false;
+}
+
+
+void EagleCamera::FrameBufferPool::clear()
+{
+    for ( auto &block: _blocks ) free(block);
+    _blocks.clear();
+}
+
+
+size_t EagleCamera::FrameBufferPool::allocatedBytes() const
+{
+    size_t bytes = 0;
+    for ( auto &block: _blocks ) bytes += block.size;
+
+    return bytes;
+}
+
+
+size_t EagleCamera::FrameBufferPool::lockFailures() const
+{
+    return _lockFailures;
+}
+
+
+size_t EagleCamera::FrameBufferPool::numaFailures() const
+{
+    return _numaFailures;
+}
+
+
+EagleCamera::FrameBufferPool::Block EagleCamera::FrameBufferPool::allocate(const size_t size, const bool huge_pages,
+                                                                           const bool prefault, const int numa_node)
+{
+    Block block = {nullptr, size, false, huge_pages, false, false, numa_node};
+
+    size_t page = page_size();
+
+    if ( size < page ) { // small block: just cache line aligned (its NUMA placement is not important)
+#ifdef EAGLE_CAMERA_BUFFER_POOL_WIN
+        block.addr = _aligned_malloc(size, EAGLE_CAMERA_CACHE_LINE_SIZE);
+#else
+        if ( posix_memalign(&block.addr, EAGLE_CAMERA_CACHE_LINE_SIZE, size) ) block.addr = nullptr;
+#endif
+        if ( !block.addr ) throw std::bad_alloc();
+        block.hugePages = huge_pages;
+        return block;
+    }
+
+    block.mapped = true;
+
+#ifdef EAGLE_CAMERA_BUFFER_POOL_WIN
+    if ( huge_pages && (size >= EAGLE_CAMERA_HUGE_PAGE_SIZE) ) { // it requires "Lock pages in memory" privilege
+        size_t large_page = GetLargePageMinimum();
+        if ( large_page && !(size % large_page) ) {
+            block.addr = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        }
+    }
+    if ( !block.addr && (numa_node >= 0) ) {
+        block.addr = VirtualAllocExNuma(GetCurrentProcess(), NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, numa_node);
+        if ( !block.addr ) ++_numaFailures;
+    }
+    if ( !block.addr ) block.addr = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if ( !block.addr ) throw std::bad_alloc();
+#else
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    if ( prefault && (numa_node < 0) ) flags |= MAP_POPULATE; // otherwise pages are faulted after binding to node
+
+#ifdef MAP_HUGETLB
+    if ( huge_pages && (size >= EAGLE_CAMERA_HUGE_PAGE_SIZE) ) { // reserved huge pages (hugetlbfs)
+        void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+        if ( addr != MAP_FAILED ) block.addr = addr;
+    }
+#endif
+
+    if ( !block.addr ) {
+        void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if ( addr == MAP_FAILED ) throw std::bad_alloc();
+        block.addr = addr;
+#ifdef MADV_HUGEPAGE
+        if ( huge_pages ) madvise(block.addr, size, MADV_HUGEPAGE); // transparent huge pages (just a hint)
+#endif
+    }
+
+    if ( numa_node >= 0 ) { // the pages are allocated on the node at the first touch
+#ifdef EAGLE_CAMERA_MPOL_PREFERRED
+        unsigned long nodemask = 0;
+        if ( numa_node < static_cast<int>(8*sizeof(nodemask)) ) {
+            nodemask = 1UL << numa_node;
+            if ( syscall(SYS_mbind, block.addr, size, EAGLE_CAMERA_MPOL_PREFERRED,
+                         &nodemask, 8*sizeof(nodemask), 0) ) ++_numaFailures;
+        } else {
+            ++_numaFailures;
+        }
+#else
+        ++_numaFailures;
+#endif
+    }
+#endif
+
+    if ( prefault ) { // write to each page to take page faults now and not during acquisition
+        volatile char *ptr = static_cast<volatile char*>(block.addr);
+        for ( size_t i = 0; i < size; i += page ) ptr[i] = 0;
+    }
+
+    return block;
+}
+
+
+void EagleCamera::FrameBufferPool::free(Block &block)
+{
+    if ( !block.addr ) return;
+
+    if ( block.mapped ) {
+#ifdef EAGLE_CAMERA_BUFFER_POOL_WIN
+        if ( block.locked ) VirtualUnlock(block.addr, block.size);
+        VirtualFree(block.addr, 0, MEM_RELEASE);
+#else
+        if ( block.locked ) munlock(block.addr, block.size);
+        munmap(block.addr, block.size);
+#endif
+    } else {
+#ifdef EAGLE_CAMERA_BUFFER_POOL_WIN
+        if ( block.locked ) VirtualUnlock(block.addr, block.size);
+        _aligned_free(block.addr);
+#else
+        if ( block.locked ) munlock(block.addr, block.size);
+        std::free(block.addr);
+#endif
+    }
+
+    block.addr = nullptr;
+}
+
+
+void EagleCamera::FrameBufferPool::lock(Block &block)
+{
+#ifdef EAGLE_CAMERA_BUFFER_POOL_WIN
+    block.locked = VirtualLock(block.addr, block.size) ? true : false;
+#else
+    block.locked = !mlock(block.addr, block.size);
+#endif
+
+    if ( !block.locked ) ++_lockFailures; // e.g. RLIMIT_MEMLOCK is exceeded. it is not fatal
+}
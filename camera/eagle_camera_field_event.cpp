@@ -0,0 +1,175 @@
+#include <eagle_camera.h>
+
+#include <xcliball.h>
+
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+#if defined(_WIN32) || defined(__WIN32__) || defined(_WIN64)
+    #define EAGLE_CAMERA_FIELD_EVENT_WIN
+#else
+    #include <csignal>
+    #include <cerrno>
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <unistd.h>
+#endif
+
+
+            /*******************************************************
+            *                                                      *
+            *   IMPLEMENTATION OF GRABBER CAPTURED FIELD EVENT     *
+            *                                                      *
+            *******************************************************/
+
+
+#ifndef EAGLE_CAMERA_FIELD_EVENT_WIN
+
+#define EAGLE_CAMERA_FIELD_EVENT_MAX_UNITS 32
+
+// write ends of pipes of grabber units (signal handler finds the pipe by signal number)
+static std::atomic<int> field_event_pipe[EAGLE_CAMERA_FIELD_EVENT_MAX_UNITS];
+
+
+static void field_event_handler(int sig)
+{
+    int unit = sig - SIGRTMIN - EAGLE_CAMERA_FIELD_EVENT_SIGNAL_OFFSET;
+    if ( (unit < 0) || (unit >= EAGLE_CAMERA_FIELD_EVENT_MAX_UNITS) ) return;
+
+    int fd = field_event_pipe[unit].load();
+    if ( fd < 0 ) return;
+
+    int err = errno; // the handler must not change errno of interrupted code
+    char c = 0;
+    ssize_t n = write(fd, &c, 1); // a full pipe is already a pending wakeup
+    (void)n;
+    errno = err;
+}
+
+#endif
+
+
+EagleCamera::GrabberFieldEvent::GrabberFieldEvent(): _unitmap(0), _signal(0), _pipe{-1, -1}, _event(0)
+{
+}
+
+
+EagleCamera::GrabberFieldEvent::~GrabberFieldEvent()
+{
+    close();
+}
+
+
+bool EagleCamera::GrabberFieldEvent::open(const int unitmap)
+{
+    close();
+
+#ifdef EAGLE_CAMERA_FIELD_EVENT_WIN
+    HANDLE h = XCLIB_SERIALIZED(pxd_eventCapturedFieldCreate(unitmap));
+    if ( !h ) return false;
+
+    _event = reinterpret_cast<intptr_t>(h);
+#else
+    int unit = 0; // the first unit of unitmap
+    while ( (unit < EAGLE_CAMERA_FIELD_EVENT_MAX_UNITS) && !(unitmap & (1 << unit)) ) ++unit;
+
+    int sig = SIGRTMIN + EAGLE_CAMERA_FIELD_EVENT_SIGNAL_OFFSET + unit;
+    if ( (unit == EAGLE_CAMERA_FIELD_EVENT_MAX_UNITS) || (sig > SIGRTMAX) ) return false;
+
+    if ( pipe(_pipe) ) return false;
+    for ( int fd: _pipe ) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    field_event_pipe[unit] = _pipe[1];
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = field_event_handler;
+    sa.sa_flags = SA_RESTART; // other threads' system calls are not interrupted
+    sigemptyset(&sa.sa_mask);
+
+    if ( sigaction(sig, &sa, NULL) || (XCLIB_SERIALIZED(pxd_eventCapturedFieldCreate(unitmap, sig, NULL)) < 0) ) {
+        field_event_pipe[unit] = -1;
+        ::close(_pipe[0]);
+        ::close(_pipe[1]);
+        _pipe[0] = _pipe[1] = -1;
+        return false;
+    }
+
+    _signal = sig;
+#endif
+
+    _unitmap = unitmap;
+
+    return true;
+}
+
+
+void EagleCamera::GrabberFieldEvent::close()
+{
+    if ( !isOpen() ) return;
+
+#ifdef EAGLE_CAMERA_FIELD_EVENT_WIN
+    XCLIB_SERIALIZED(pxd_eventCapturedFieldClose(_unitmap, reinterpret_cast<HANDLE>(_event)));
+    _event = 0;
+#else
+    XCLIB_SERIALIZED(pxd_eventCapturedFieldClose(_unitmap, _signal));
+
+    // a late signal finds no pipe
+    field_event_pipe[_signal - SIGRTMIN - EAGLE_CAMERA_FIELD_EVENT_SIGNAL_OFFSET] = -1;
+    ::close(_pipe[0]);
+    ::close(_pipe[1]);
+    _pipe[0] = _pipe[1] = -1;
+    _signal = 0;
+#endif
+
+    _unitmap = 0;
+}
+
+
+bool EagleCamera::GrabberFieldEvent::isOpen() const
+{
+    return _unitmap != 0;
+}
+
+
+void EagleCamera::GrabberFieldEvent::wait(const std::chrono::steady_clock::time_point &deadline)
+{
+    if ( !isOpen() ) {
+        std::this_thread::sleep_until(deadline);
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    long timeout = 0;
+    if ( deadline > now ) { // round up: do not wake up before the deadline
+        timeout = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now +
+                                                                         std::chrono::microseconds(999)).count();
+    }
+
+#ifdef EAGLE_CAMERA_FIELD_EVENT_WIN
+    WaitForSingleObject(reinterpret_cast<HANDLE>(_event), static_cast<DWORD>(timeout));
+#else
+    struct pollfd pfd = {_pipe[0], POLLIN, 0};
+    if ( poll(&pfd, 1, static_cast<int>(timeout)) > 0 ) { // EINTR is just an early wakeup
+        char buff[64];
+        while ( read(_pipe[0], buff, sizeof(buff)) > 0 ); // all the pending notifications are consumed
+    }
+#endif
+}
+
+
+void EagleCamera::GrabberFieldEvent::wakeUp()
+{
+    if ( !isOpen() ) return;
+
+#ifdef EAGLE_CAMERA_FIELD_EVENT_WIN
+    SetEvent(reinterpret_cast<HANDLE>(_event));
+#else
+    char c = 0;
+    ssize_t n = write(_pipe[1], &c, 1);
+    (void)n;
+#endif
+}
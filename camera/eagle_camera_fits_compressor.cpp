@@ -0,0 +1,197 @@
+#include <eagle_camera.h>
+
+
+            /*******************************************************
+            *                                                      *
+            *   IMPLEMENTATION OF NATIVE FITS WRITER THREADS POOL  *
+            *                                                      *
+            *******************************************************/
+
+
+EagleCamera::FitsWorkerPool::FitsWorkerPool():
+    _threads(), _mutex(), _jobCond(), _doneCond(), _stop(false), _generation(0), _busyWorkers(0), _doneJobs(0),
+    _job(nullptr), _jobsNumber(0), _nextJob(0), _error()
+{
+}
+
+
+EagleCamera::FitsWorkerPool::~FitsWorkerPool()
+{
+    stop();
+}
+
+
+void EagleCamera::FitsWorkerPool::start(const size_t n_threads, const std::function<void()> &init)
+{
+    stop();
+
+    _stop = false;
+
+    for ( size_t i = 0; i < n_threads; ++i ) {
+        _threads.emplace_back([this, init, i]() {
+            if ( init ) init();
+            worker(i + 1);
+        });
+    }
+}
+
+
+void EagleCamera::FitsWorkerPool::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _jobCond.notify_all();
+
+    for ( auto &thread: _threads ) thread.join();
+    _threads.clear();
+}
+
+
+size_t EagleCamera::FitsWorkerPool::threadsNumber() const
+{
+    return _threads.size() + 1;
+}
+
+
+void EagleCamera::FitsWorkerPool::run(const size_t n_jobs, const job_t &job)
+{
+    {
+        // a worker which was late for the previous batch can still be looking for jobs
+        std::unique_lock<std::mutex> lock(_mutex);
+        _doneCond.wait(lock, [this]{return !_busyWorkers;});
+
+        _job = &job;
+        _jobsNumber = n_jobs;
+        _nextJob = 0;
+        _doneJobs = 0;
+        _error = nullptr;
+        ++_generation;
+    }
+    _jobCond.notify_all();
+
+    size_t n = runJobs(0);
+
+    // wait for workers: they must not touch the job after return
+
+    std::exception_ptr error;
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _doneJobs += n;
+        _doneCond.wait(lock, [this]{return (_doneJobs == _jobsNumber) && !_busyWorkers;});
+        error = _error;
+    }
+
+    if ( error ) std::rethrow_exception(error);
+}
+
+
+void EagleCamera::FitsWorkerPool::worker(const size_t thread)
+{
+    uint64_t generation = 0;
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    for (;;) {
+        _jobCond.wait(lock, [&]{return _stop || (_generation != generation);});
+        if ( _stop ) return;
+
+        generation = _generation;
+        ++_busyWorkers;
+        lock.unlock();
+
+        size_t n = runJobs(thread);
+
+        lock.lock();
+        _doneJobs += n;
+        --_busyWorkers;
+        _doneCond.notify_all();
+    }
+}
+
+
+size_t EagleCamera::FitsWorkerPool::runJobs(const size_t thread)
+{
+    size_t n = 0;
+
+    for (;;) {
+        size_t i = _nextJob++;
+        if ( i >= _jobsNumber ) break;
+
+        try {
+            (*_job)(i, thread);
+        } catch ( ... ) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if ( !_error ) _error = std::current_exception();
+        }
+
+        ++n;
+    }
+
+    return n;
+}
+
+
+            /*******************************************************
+            *                                                      *
+            *   IMPLEMENTATION OF PARALLEL TILES COMPRESSOR CLASS  *
+            *                                                      *
+            *******************************************************/
+
+
+EagleCamera::FitsTileCompressor::FitsTileCompressor(): _tilesNumber(0), _tiles(), _tileBytes(), _pixels()
+{
+}
+
+
+void EagleCamera::FitsTileCompressor::compress(FitsWorkerPool &pool, const ushort *image,
+                                               const size_t n_pix, const size_t tile_len)
+{
+    _tilesNumber = (n_pix + tile_len - 1)/tile_len;
+
+    if ( _tiles.size() < _tilesNumber ) _tiles.resize(_tilesNumber); // the tiles keep their memory between images
+    _tileBytes.assign(_tilesNumber, 0);
+    if ( _pixels.size() < pool.threadsNumber() ) _pixels.resize(pool.threadsNumber());
+
+    pool.run(_tilesNumber, [&](const size_t i, const size_t thread) {
+        size_t first = i*tile_len;
+        size_t len = std::min(tile_len, n_pix - first);
+
+        // signed pixels with BZERO = 32768 (just inverted high bit)
+        std::vector<short> &pixels = _pixels[thread];
+        pixels.resize(len);
+        const ushort *src = image + first;
+        for ( size_t k = 0; k < len; ++k ) pixels[k] = static_cast<short>(src[k] ^ 0x8000);
+
+        // the worst case: each block is not compressed and has its own header
+        std::vector<unsigned char> &tile = _tiles[i];
+        tile.resize(len*sizeof(short) + len/EAGLE_CAMERA_FITS_RICE_BLOCK_SIZE + 64);
+
+        int nbytes = fits_rcomp_short(pixels.data(), static_cast<int>(len), tile.data(),
+                                      static_cast<int>(tile.size()), EAGLE_CAMERA_FITS_RICE_BLOCK_SIZE);
+        if ( nbytes < 0 ) {
+            throw EagleCameraException(0, EagleCamera::Error_FitsFileIO, "Cannot compress image tile by Rice algorithm");
+        }
+
+        _tileBytes[i] = nbytes;
+    });
+}
+
+
+size_t EagleCamera::FitsTileCompressor::tilesNumber() const
+{
+    return _tilesNumber;
+}
+
+
+const unsigned char* EagleCamera::FitsTileCompressor::tileData(const size_t i) const
+{
+    return _tiles[i].data();
+}
+
+
+size_t EagleCamera::FitsTileCompressor::tileBytes(const size_t i) const
+{
+    return _tileBytes[i];
+}
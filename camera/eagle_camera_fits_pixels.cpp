@@ -0,0 +1,215 @@
+#include <eagle_camera.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    #define EAGLE_CAMERA_PIXELS_X86
+    #include <immintrin.h>
+#ifdef _MSC_VER
+    #include <intrin.h>
+    #define EAGLE_CAMERA_PIXELS_TARGET(isa) // MSVC compiles intrinsics of any instruction set
+    #if (_MSC_VER >= 1910)
+        #define EAGLE_CAMERA_PIXELS_AVX512
+    #endif
+#else
+    #define EAGLE_CAMERA_PIXELS_TARGET(isa) __attribute__((target(isa)))
+    #if defined(__clang__) || (__GNUC__ >= 5)
+        #define EAGLE_CAMERA_PIXELS_AVX512
+    #endif
+#endif
+#endif
+
+
+            /*******************************************************
+            *                                                      *
+            *   CONVERSION OF PIXELS INTO FITS REPRESENTATION      *
+            *                                                      *
+            *******************************************************/
+
+// v - 32768 in two's complement is just v with inverted high bit. after byte swapping
+// the high byte is the first one in memory, i.e. it is inverted by XOR with 0x0080
+// in a little-endian 16-bit lane
+
+
+typedef void (*pixels_kernel_t)(const ushort *src, const size_t n, unsigned char *dst);
+
+
+static void convert_scalar(const ushort *src, const size_t n, unsigned char *dst)
+{
+    for ( size_t i = 0; i < n; ++i ) {
+        ushort v = src[i];
+        *dst++ = static_cast<unsigned char>((v >> 8) ^ 0x80);
+        *dst++ = static_cast<unsigned char>(v & 0xFF);
+    }
+}
+
+
+#ifdef EAGLE_CAMERA_PIXELS_X86
+
+EAGLE_CAMERA_PIXELS_TARGET("sse2")
+static void convert_sse2(const ushort *src, const size_t n, unsigned char *dst)
+{
+    const __m128i sign = _mm_set1_epi16(0x0080);
+
+    size_t i = 0;
+    for ( ; (i + 8) <= n; i += 8 ) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2*i), _mm_xor_si128(v, sign));
+    }
+
+    convert_scalar(src + i, n - i, dst + 2*i);
+}
+
+
+EAGLE_CAMERA_PIXELS_TARGET("avx2")
+static void convert_avx2(const ushort *src, const size_t n, unsigned char *dst)
+{
+    const __m256i sign = _mm256_set1_epi16(0x0080);
+
+    size_t i = 0;
+    for ( ; (i + 16) <= n; i += 16 ) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        v = _mm256_or_si256(_mm256_slli_epi16(v, 8), _mm256_srli_epi16(v, 8));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 2*i), _mm256_xor_si256(v, sign));
+    }
+
+    convert_sse2(src + i, n - i, dst + 2*i);
+}
+
+
+#ifdef EAGLE_CAMERA_PIXELS_AVX512
+EAGLE_CAMERA_PIXELS_TARGET("avx512f,avx512bw")
+static void convert_avx512(const ushort *src, const size_t n, unsigned char *dst)
+{
+    const __m512i sign = _mm512_set1_epi16(0x0080);
+
+    size_t i = 0;
+    for ( ; (i + 32) <= n; i += 32 ) {
+        __m512i v = _mm512_loadu_si512(src + i);
+        v = _mm512_or_si512(_mm512_slli_epi16(v, 8), _mm512_srli_epi16(v, 8));
+        _mm512_storeu_si512(dst + 2*i, _mm512_xor_si512(v, sign));
+    }
+
+    convert_sse2(src + i, n - i, dst + 2*i);
+}
+#endif
+
+
+#ifdef _MSC_VER
+static bool cpu_supports(const EagleCamera::FitsPixelsKernel kernel)
+{
+    int info[4];
+
+    __cpuid(info, 0);
+    int max_leaf = info[0];
+
+    __cpuid(info, 1);
+    if ( kernel == EagleCamera::FITS_PIXELS_SSE2 ) return (info[3] & (1 << 26)) != 0;
+
+    // AVX state must be enabled by OS
+    if ( !(info[2] & (1 << 27)) || (max_leaf < 7) ) return false;
+    unsigned long long xcr0 = _xgetbv(0);
+
+    __cpuidex(info, 7, 0);
+    if ( kernel == EagleCamera::FITS_PIXELS_AVX2 ) return ((xcr0 & 0x6) == 0x6) && (info[1] & (1 << 5));
+
+    return ((xcr0 & 0xE6) == 0xE6) && (info[1] & (1 << 16)) && (info[1] & (1 << 30)); // AVX512F and AVX512BW
+}
+#else
+static bool cpu_supports(const EagleCamera::FitsPixelsKernel kernel)
+{
+    __builtin_cpu_init();
+
+    switch ( kernel ) {
+        case EagleCamera::FITS_PIXELS_SSE2:
+            return __builtin_cpu_supports("sse2");
+        case EagleCamera::FITS_PIXELS_AVX2:
+            return __builtin_cpu_supports("avx2");
+        case EagleCamera::FITS_PIXELS_AVX512:
+#ifdef EAGLE_CAMERA_PIXELS_AVX512
+            return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#else
+            return false;
+#endif
+        default:
+            return false;
+    }
+}
+#endif
+
+#endif // EAGLE_CAMERA_PIXELS_X86
+
+
+static pixels_kernel_t pixels_kernel(const EagleCamera::FitsPixelsKernel kernel)
+{
+    if ( !EagleCamera::fitsPixelsKernelSupported(kernel) ) return convert_scalar;
+
+    switch ( kernel ) {
+#ifdef EAGLE_CAMERA_PIXELS_X86
+        case EagleCamera::FITS_PIXELS_SSE2:
+            return convert_sse2;
+        case EagleCamera::FITS_PIXELS_AVX2:
+            return convert_avx2;
+#ifdef EAGLE_CAMERA_PIXELS_AVX512
+        case EagleCamera::FITS_PIXELS_AVX512:
+            return convert_avx512;
+#endif
+#endif
+        default:
+            return convert_scalar;
+    }
+}
+
+
+EagleCamera::FitsPixelsKernel EagleCamera::fitsPixelsKernel()
+{
+    static const FitsPixelsKernel best = []() {
+        for ( auto kernel: {FITS_PIXELS_AVX512, FITS_PIXELS_AVX2, FITS_PIXELS_SSE2} ) {
+            if ( fitsPixelsKernelSupported(kernel) ) return kernel;
+        }
+        return FITS_PIXELS_SCALAR;
+    }();
+
+    return best;
+}
+
+
+bool EagleCamera::fitsPixelsKernelSupported(const FitsPixelsKernel kernel)
+{
+    if ( kernel == FITS_PIXELS_SCALAR ) return true;
+
+#ifdef EAGLE_CAMERA_PIXELS_X86
+    return cpu_supports(kernel);
+#else
+    return false;
+#endif
+}
+
+
+std::string EagleCamera::fitsPixelsKernelName(const FitsPixelsKernel kernel)
+{
+    switch ( kernel ) {
+        case FITS_PIXELS_SSE2:
+            return "SSE2";
+        case FITS_PIXELS_AVX2:
+            return "AVX2";
+        case FITS_PIXELS_AVX512:
+            return "AVX512";
+        default:
+            return "SCALAR";
+    }
+}
+
+
+void EagleCamera::convertToFitsPixels(const ushort *src, const size_t n, unsigned char *dst)
+{
+    static const pixels_kernel_t kernel = pixels_kernel(fitsPixelsKernel());
+
+    kernel(src, n, dst);
+}
+
+
+void EagleCamera::convertToFitsPixels(const ushort *src, const size_t n, unsigned char *dst,
+                                      const FitsPixelsKernel kernel)
+{
+    pixels_kernel(kernel)(src, n, dst);
+}
@@ -0,0 +1,452 @@
+#include <eagle_camera.h>
+
+#include <cstring>
+#include <cerrno>
+
+#if defined(_WIN32) || defined(__WIN32__) || defined(_WIN64)
+    #define EAGLE_CAMERA_FITS_WRITER_WIN
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/types.h>
+    #include <sys/mman.h>
+    #include <sys/statvfs.h>
+#endif
+
+
+#define EAGLE_CAMERA_FITS_CARD_SIZE 80
+#define EAGLE_CAMERA_FITS_KEYWORD_SIZE 8
+#define EAGLE_CAMERA_FITS_VALUE_WIDTH 20 // fixed-format values end at column 30
+#define EAGLE_CAMERA_FITS_STRING_WIDTH 68 // characters between quotes of a string value
+#define EAGLE_CAMERA_FITS_CONTINUE_KEYWORD "CONTINUE"
+
+
+            /***************************************************
+            *                                                  *
+            *   IMPLEMENTATION OF NATIVE FITS WRITER CLASS     *
+            *                                                  *
+            ***************************************************/
+
+
+static std::string fits_keyword(const std::string &key)
+{
+    std::string kw = key.substr(0, EAGLE_CAMERA_FITS_KEYWORD_SIZE);
+    kw.resize(EAGLE_CAMERA_FITS_KEYWORD_SIZE, ' ');
+
+    return kw;
+}
+
+
+static std::string fits_fixed_value(const std::string &value)
+{
+    if ( value.size() >= EAGLE_CAMERA_FITS_VALUE_WIDTH ) return value;
+
+    return std::string(EAGLE_CAMERA_FITS_VALUE_WIDTH - value.size(), ' ') + value;
+}
+
+
+static std::string system_error()
+{
+#ifdef EAGLE_CAMERA_FITS_WRITER_WIN
+    return "system error " + std::to_string(GetLastError());
+#else
+    return strerror(errno);
+#endif
+}
+
+
+            /*  header  */
+
+EagleCamera::FitsStreamWriter::Header::Header(const size_t capacity): _capacity(capacity), _cards()
+{
+}
+
+
+void EagleCamera::FitsStreamWriter::Header::setLogical(const std::string &key, const bool value,
+                                                       const std::string &comment)
+{
+    setCard(key, fits_fixed_value(value ? "T" : "F"), comment);
+}
+
+
+void EagleCamera::FitsStreamWriter::Header::setInteger(const std::string &key, const long long value,
+                                                       const std::string &comment)
+{
+    setCard(key, fits_fixed_value(std::to_string(value)), comment);
+}
+
+
+void EagleCamera::FitsStreamWriter::Header::setDouble(const std::string &key, const double value,
+                                                      const std::string &comment)
+{
+    // FITS has no representation of NaN and infinity: such a keyword has undefined value
+    if ( !std::isfinite(value) ) {
+        setCard(key, std::string(EAGLE_CAMERA_FITS_VALUE_WIDTH, ' '), comment);
+        return;
+    }
+
+    char buff[32];
+    snprintf(buff, sizeof(buff), "%.15G", value);
+
+    // real value must have decimal point (as CFITSIO writes it)
+    std::string str = buff;
+    if ( str.find('.') == std::string::npos ) {
+        size_t pos = str.find('E');
+        str.insert(pos == std::string::npos ? str.size() : pos, ".");
+    }
+
+    setCard(key, fits_fixed_value(str), comment);
+}
+
+
+void EagleCamera::FitsStreamWriter::Header::setString(const std::string &key, const std::string &value,
+                                                      const std::string &comment)
+{
+    std::string str;
+    for ( auto ch: value ) {
+        if ( ch == '\'' ) str += ch; // quote is doubled
+        str += ch;
+    }
+
+    if ( str.size() <= EAGLE_CAMERA_FITS_STRING_WIDTH ) {
+        if ( str.size() < EAGLE_CAMERA_FITS_KEYWORD_SIZE ) str.resize(EAGLE_CAMERA_FITS_KEYWORD_SIZE, ' ');
+
+        setCard(key, "'" + str + "'", comment);
+        return;
+    }
+
+    // long-string convention (as fits_write_key_longstr writes it): each but the last piece
+    // ends with '&' and the value continues in the next CONTINUE-card. a doubled quote is never split
+
+    std::vector<std::string> pieces(1);
+    for ( auto ch: value ) {
+        size_t len = (ch == '\'') ? 2 : 1;
+        if ( pieces.back().size() + len > EAGLE_CAMERA_FITS_STRING_WIDTH - 1 ) pieces.emplace_back();
+        pieces.back().append(len, ch);
+    }
+
+    std::vector<std::string> cards;
+    for ( size_t i = 0; i < pieces.size(); ++i ) {
+        std::string card = (i ? fits_keyword(EAGLE_CAMERA_FITS_CONTINUE_KEYWORD) + "  '" : fits_keyword(key) + "= '") +
+                           pieces[i] + (i < pieces.size() - 1 ? "&'" : "'");
+        if ( (i == pieces.size() - 1) && !comment.empty() ) card += " / " + comment;
+        card.resize(EAGLE_CAMERA_FITS_CARD_SIZE, ' ');
+
+        cards.push_back(card);
+    }
+
+    setCards(key, cards);
+}
+
+
+void EagleCamera::FitsStreamWriter::Header::remove(const std::string &key)
+{
+    std::string kw = fits_keyword(key);
+
+    for ( size_t i = 0; i < _cards.size(); ) {
+        if ( !_cards[i].compare(0, kw.size(), kw) ) {
+            _cards.erase(_cards.begin() + i, _cards.begin() + i + valueCardsNumber(i));
+        } else {
+            ++i;
+        }
+    }
+}
+
+
+void EagleCamera::FitsStreamWriter::Header::clear()
+{
+    _cards.clear();
+}
+
+
+size_t EagleCamera::FitsStreamWriter::Header::size() const
+{
+    size_t n_cards = std::max(_capacity, _cards.size() + 1); // plus END-card
+
+    return padded(n_cards*EAGLE_CAMERA_FITS_CARD_SIZE);
+}
+
+
+void EagleCamera::FitsStreamWriter::Header::serialize(char *buff) const
+{
+    size_t n_cards = std::max(_capacity, _cards.size() + 1);
+    memset(buff, ' ', size());
+
+    for ( size_t i = 0; i < _cards.size(); ++i ) {
+        memcpy(buff + i*EAGLE_CAMERA_FITS_CARD_SIZE, _cards[i].data(), EAGLE_CAMERA_FITS_CARD_SIZE);
+    }
+
+    // reserved room is blank cards before END-card (the header ends in the block of END)
+    memcpy(buff + (n_cards - 1)*EAGLE_CAMERA_FITS_CARD_SIZE, "END", 3);
+}
+
+
+size_t EagleCamera::FitsStreamWriter::Header::cardsNumber() const
+{
+    return _cards.size();
+}
+
+
+const std::string& EagleCamera::FitsStreamWriter::Header::card(const size_t i) const
+{
+    return _cards[i];
+}
+
+
+std::string EagleCamera::FitsStreamWriter::Header::keyword(const size_t i) const
+{
+    std::string kw = _cards[i].substr(0, EAGLE_CAMERA_FITS_KEYWORD_SIZE);
+    kw.erase(kw.find_last_not_of(' ') + 1);
+
+    return kw;
+}
+
+
+void EagleCamera::FitsStreamWriter::Header::setCard(const std::string &key, const std::string &value,
+                                                    const std::string &comment)
+{
+    std::string card = fits_keyword(key) + "= " + value;
+    if ( !comment.empty() ) card += " / " + comment;
+    card.resize(EAGLE_CAMERA_FITS_CARD_SIZE, ' ');
+
+    setCards(key, {card});
+}
+
+
+void EagleCamera::FitsStreamWriter::Header::setCards(const std::string &key, const std::vector<std::string> &cards)
+{
+    std::string kw = fits_keyword(key);
+
+    for ( size_t i = 0; i < _cards.size(); ++i ) { // update existing keyword (with its CONTINUE-cards)
+        if ( !_cards[i].compare(0, kw.size(), kw) ) {
+            auto it = _cards.erase(_cards.begin() + i, _cards.begin() + i + valueCardsNumber(i));
+            _cards.insert(it, cards.begin(), cards.end());
+            return;
+        }
+    }
+
+    _cards.insert(_cards.end(), cards.begin(), cards.end());
+}
+
+
+size_t EagleCamera::FitsStreamWriter::Header::valueCardsNumber(const size_t i) const
+{
+    std::string kw = fits_keyword(EAGLE_CAMERA_FITS_CONTINUE_KEYWORD);
+
+    size_t n = 1;
+    while ( (i + n < _cards.size()) && !_cards[i + n].compare(0, kw.size(), kw) ) ++n;
+
+    return n;
+}
+
+
+            /*  writer  */
+
+EagleCamera::FitsStreamWriter::FitsStreamWriter(): _filename(), _file(-1), _map(nullptr), _mapLen(0), _mapping(0)
+{
+}
+
+
+EagleCamera::FitsStreamWriter::~FitsStreamWriter()
+{
+    close();
+}
+
+
+void EagleCamera::FitsStreamWriter::open(const std::string &filename)
+{
+    close();
+
+    _filename = filename;
+
+#ifdef EAGLE_CAMERA_FITS_WRITER_WIN
+    HANDLE h = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL,
+                           CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if ( h != INVALID_HANDLE_VALUE ) _file = reinterpret_cast<intptr_t>(h);
+#else
+    _file = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+#endif
+
+    if ( _file == -1 ) {
+        throw EagleCameraException(0, EagleCamera::Error_FitsFileIO,
+                                   "Cannot create FITS file '" + filename + "': " + system_error());
+    }
+}
+
+
+void EagleCamera::FitsStreamWriter::close()
+{
+    if ( _file == -1 ) return;
+
+    unmap();
+
+#ifdef EAGLE_CAMERA_FITS_WRITER_WIN
+    CloseHandle(reinterpret_cast<HANDLE>(_file));
+#else
+    ::close(static_cast<int>(_file));
+#endif
+
+    _file = -1;
+}
+
+
+bool EagleCamera::FitsStreamWriter::isOpen() const
+{
+    return _file != -1;
+}
+
+
+void EagleCamera::FitsStreamWriter::write(const void *data, const size_t len, const uint64_t offset)
+{
+    const char *ptr = static_cast<const char*>(data);
+    size_t n = 0;
+
+    while ( n < len ) { // the system can write less than requested
+#ifdef EAGLE_CAMERA_FITS_WRITER_WIN
+        OVERLAPPED ov = {};
+        uint64_t pos = offset + n;
+        ov.Offset = static_cast<DWORD>(pos);
+        ov.OffsetHigh = static_cast<DWORD>(pos >> 32);
+
+        DWORD chunk = static_cast<DWORD>(std::min(len - n, static_cast<size_t>(1U << 30)));
+        DWORD written = 0;
+        if ( !WriteFile(reinterpret_cast<HANDLE>(_file), ptr + n, chunk, &written, &ov) ) written = 0;
+        if ( !written ) {
+#else
+        ssize_t written = pwrite(static_cast<int>(_file), ptr + n, len - n, static_cast<off_t>(offset + n));
+        if ( (written < 0) && (errno == EINTR) ) continue;
+        if ( written <= 0 ) {
+#endif
+            throw EagleCameraException(0, EagleCamera::Error_FitsFileIO,
+                                       "Cannot write into FITS file '" + _filename + "': " + system_error());
+        }
+        n += written;
+    }
+}
+
+
+void EagleCamera::FitsStreamWriter::truncate(const uint64_t len)
+{
+#ifdef EAGLE_CAMERA_FITS_WRITER_WIN
+    LARGE_INTEGER pos;
+    pos.QuadPart = static_cast<LONGLONG>(len);
+    HANDLE h = reinterpret_cast<HANDLE>(_file);
+    bool ok = SetFilePointerEx(h, pos, NULL, FILE_BEGIN) && SetEndOfFile(h);
+#else
+    bool ok = !ftruncate(static_cast<int>(_file), static_cast<off_t>(len));
+#endif
+
+    if ( !ok ) {
+        throw EagleCameraException(0, EagleCamera::Error_FitsFileIO,
+                                   "Cannot set length of FITS file '" + _filename + "': " + system_error());
+    }
+}
+
+
+bool EagleCamera::FitsStreamWriter::allocate(const uint64_t len)
+{
+    // fail early: the data would not fit anyway
+
+    uint64_t avail;
+#ifdef EAGLE_CAMERA_FITS_WRITER_WIN
+    std::string dir;
+    size_t pos = _filename.find_last_of("\\/");
+    if ( pos != std::string::npos ) dir = _filename.substr(0, pos + 1);
+
+    ULARGE_INTEGER free_bytes;
+    bool ok = GetDiskFreeSpaceExA(dir.empty() ? NULL : dir.c_str(), &free_bytes, NULL, NULL);
+    avail = free_bytes.QuadPart;
+#else
+    struct statvfs st;
+    bool ok = !fstatvfs(static_cast<int>(_file), &st);
+    avail = static_cast<uint64_t>(st.f_bavail)*st.f_frsize;
+#endif
+
+    if ( ok && (avail < len) ) {
+        throw EagleCameraException(0, EagleCamera::Error_FitsFileIO,
+                                   "Cannot allocate FITS file '" + _filename + "': not enough disk space (" +
+                                   std::to_string(len) + " bytes are needed, " + std::to_string(avail) + " are available)");
+    }
+
+#ifdef EAGLE_CAMERA_FITS_WRITER_WIN
+    truncate(len); // NTFS allocates the clusters when the file is extended
+    return true;
+#elif defined(__linux__)
+    int err = posix_fallocate(static_cast<int>(_file), 0, static_cast<off_t>(len));
+    if ( !err ) return true;
+    if ( (err != EOPNOTSUPP) && (err != EINVAL) ) { // the filesystem can do it but there is no room
+        throw EagleCameraException(0, EagleCamera::Error_FitsFileIO,
+                                   "Cannot allocate FITS file '" + _filename + "': " + strerror(err));
+    }
+    return false;
+#else
+    return false;
+#endif
+}
+
+
+char* EagleCamera::FitsStreamWriter::map(const uint64_t len)
+{
+    unmap();
+
+#ifdef EAGLE_CAMERA_FITS_WRITER_WIN
+    HANDLE mapping = CreateFileMappingA(reinterpret_cast<HANDLE>(_file), NULL, PAGE_READWRITE,
+                                        static_cast<DWORD>(len >> 32), static_cast<DWORD>(len), NULL);
+    if ( !mapping ) return nullptr;
+
+    void *addr = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, static_cast<SIZE_T>(len));
+    if ( !addr ) {
+        CloseHandle(mapping);
+        return nullptr;
+    }
+    _mapping = reinterpret_cast<intptr_t>(mapping);
+#else
+    if ( len > static_cast<uint64_t>(std::numeric_limits<size_t>::max()) ) return nullptr; // 32-bit system
+
+    void *addr = mmap(NULL, static_cast<size_t>(len), PROT_READ | PROT_WRITE, MAP_SHARED, static_cast<int>(_file), 0);
+    if ( addr == MAP_FAILED ) return nullptr;
+#endif
+
+    _map = static_cast<char*>(addr);
+    _mapLen = len;
+
+    return _map;
+}
+
+
+void EagleCamera::FitsStreamWriter::flush(const uint64_t offset, const uint64_t len)
+{
+    if ( !_map ) return;
+
+#ifdef EAGLE_CAMERA_FITS_WRITER_WIN
+    FlushViewOfFile(_map + offset, static_cast<SIZE_T>(len));
+#else
+    // the start must be aligned to page
+    uint64_t page = sysconf(_SC_PAGESIZE);
+    uint64_t start = offset/page*page;
+    msync(_map + start, static_cast<size_t>(offset + len - start), MS_ASYNC);
+#endif
+}
+
+
+void EagleCamera::FitsStreamWriter::unmap()
+{
+    if ( !_map ) return;
+
+#ifdef EAGLE_CAMERA_FITS_WRITER_WIN
+    UnmapViewOfFile(_map);
+    CloseHandle(reinterpret_cast<HANDLE>(_mapping));
+    _mapping = 0;
+#else
+    munmap(_map, static_cast<size_t>(_mapLen));
+#endif
+
+    _map = nullptr;
+    _mapLen = 0;
+}
+
+
+uint64_t EagleCamera::FitsStreamWriter::padded(const uint64_t bytes)
+{
+    return (bytes + EAGLE_CAMERA_FITS_BLOCK_SIZE - 1)/EAGLE_CAMERA_FITS_BLOCK_SIZE*EAGLE_CAMERA_FITS_BLOCK_SIZE;
+}
@@ -308,10 +308,9 @@ std::string EagleCamera::getShutterState()
             value = EAGLE_CAMERA_FEATURE_SHUTTER_STATE_EXP;
             break;
         default:
-            logMessageStream.str("");
-            logMessageStream << "Unexpected FPGA register value for shutter state (got"  << std::hex
-                             << (int)val[0] << std::dec << ")";
-            throw EagleCameraException(0,EagleCamera::Error_UnexpectedFPGAValue,logMessageStream.str());
+            std::ostringstream msg;
+            msg << "Unexpected FPGA register value for shutter state (got"  << std::hex << (int)val[0] << std::dec << ")";
+            throw EagleCameraException(0,EagleCamera::Error_UnexpectedFPGAValue,msg.str());
     }
 
     return value;
@@ -479,10 +478,10 @@ std::string EagleCamera::getReadoutRate()
     } else if ( (v[0] == 0x43) && (v[1] == 0x80) ) {
         value = EAGLE_CAMERA_FEATURE_READOUT_RATE_SLOW;
     } else {
-        logMessageStream.str("");
-        logMessageStream << "Unexpected FPGA registers values (got [" << std::hex << (int)v[0] << std::dec << ", "
-                         << std::hex << (int)v[1] << std::dec << "])";
-        throw EagleCameraException(0,EagleCamera::Error_UnexpectedFPGAValue,logMessageStream.str());
+        std::ostringstream msg;
+        msg << "Unexpected FPGA registers values (got [" << std::hex << (int)v[0] << std::dec << ", "
+            << std::hex << (int)v[1] << std::dec << "])";
+        throw EagleCameraException(0,EagleCamera::Error_UnexpectedFPGAValue,msg.str());
     }
 
     return value;
@@ -512,9 +511,9 @@ std::string EagleCamera::getReadoutMode()
     } else if ( v[0] == 0x04 ) {
         value = EAGLE_CAMERA_FEATURE_READOUT_MODE_TEST;
     } else {
-        logMessageStream.str("");
-        logMessageStream << "Unexpected FPGA registers values (got " << std::hex << (int)v[0] << std::dec << ")";
-        throw EagleCameraException(0,EagleCamera::Error_UnexpectedFPGAValue,logMessageStream.str());
+        std::ostringstream msg;
+        msg << "Unexpected FPGA registers values (got " << std::hex << (int)v[0] << std::dec << ")";
+        throw EagleCameraException(0,EagleCamera::Error_UnexpectedFPGAValue,msg.str());
     }
 
     return value;
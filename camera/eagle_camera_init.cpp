@@ -257,6 +257,14 @@ void EagleCamera::InitCameraFeatures()
                ));
 
 
+    PREDEFINED_CAMERA_FEATURES[EAGLE_CAMERA_FEATURE_PRE_TRIGGER_FRAMES_NAME] = std::unique_ptr<EagleCamera::CameraAbstractFeature>(
+            new EagleCamera::CameraFeature<EagleCamera::IntegerType>( EAGLE_CAMERA_FEATURE_PRE_TRIGGER_FRAMES_NAME,
+                    EagleCamera::ReadWrite, {1,std::numeric_limits<IntegerType>::max()},
+                    [this]() {return _preTriggerFrames;},
+                    [this](const EagleCamera::IntegerType pf){_preTriggerFrames = pf;}
+               ));
+
+
     PREDEFINED_CAMERA_FEATURES[EAGLE_CAMERA_FEATURE_FITS_FILENAME_NAME] = std::unique_ptr<EagleCamera::CameraAbstractFeature>(
             new EagleCamera::CameraFeature<std::string>( EAGLE_CAMERA_FEATURE_FITS_FILENAME_NAME,
                     EagleCamera::ReadWrite, {},
@@ -275,12 +283,119 @@ void EagleCamera::InitCameraFeatures()
 
     PREDEFINED_CAMERA_FEATURES[EAGLE_CAMERA_FEATURE_FITS_DATA_FORMAT_NAME] = std::unique_ptr<EagleCamera::CameraAbstractFeature>(
             new EagleCamera::CameraFeature<std::string>( EAGLE_CAMERA_FEATURE_FITS_DATA_FORMAT_NAME,
-                    EagleCamera::ReadWrite, {EAGLE_CAMERA_FEATURE_FITS_DATA_FORMAT_EXTEN, EAGLE_CAMERA_FEATURE_FITS_DATA_FORMAT_CUBE},
+                    EagleCamera::ReadWrite, {EAGLE_CAMERA_FEATURE_FITS_DATA_FORMAT_EXTEN, EAGLE_CAMERA_FEATURE_FITS_DATA_FORMAT_CUBE,
+                                             EAGLE_CAMERA_FEATURE_FITS_DATA_FORMAT_RICE},
                     [this]() {return _fitsDataFormat;},
                     [this](const std::string ff){_fitsDataFormat = trim_spaces(ff);}
                ));
 
 
+    PREDEFINED_CAMERA_FEATURES[EAGLE_CAMERA_FEATURE_FITS_WRITER_NAME] = std::unique_ptr<EagleCamera::CameraAbstractFeature>(
+            new EagleCamera::CameraFeature<std::string>( EAGLE_CAMERA_FEATURE_FITS_WRITER_NAME,
+                    EagleCamera::ReadWrite, {EAGLE_CAMERA_FEATURE_FITS_WRITER_CFITSIO, EAGLE_CAMERA_FEATURE_FITS_WRITER_NATIVE},
+                    [this]() {return _fitsWriterMode;},
+                    [this](const std::string fw){_fitsWriterMode = trim_spaces(fw);}
+               ));
+
+
+    PREDEFINED_CAMERA_FEATURES[EAGLE_CAMERA_FEATURE_FITS_WRITER_THREADS_NAME] = std::unique_ptr<EagleCamera::CameraAbstractFeature>(
+            new EagleCamera::CameraFeature<EagleCamera::IntegerType>( EAGLE_CAMERA_FEATURE_FITS_WRITER_THREADS_NAME,
+                    EagleCamera::ReadWrite, {0,std::numeric_limits<IntegerType>::max()},
+                    [this]() {return _fitsWriterThreads;},
+                    [this](const EagleCamera::IntegerType n){_fitsWriterThreads = n;}
+               ));
+
+
+    PREDEFINED_CAMERA_FEATURES[EAGLE_CAMERA_FEATURE_FITS_FILE_MAPPING_NAME] = std::unique_ptr<EagleCamera::CameraAbstractFeature>(
+            new EagleCamera::CameraFeature<std::string>( EAGLE_CAMERA_FEATURE_FITS_FILE_MAPPING_NAME,
+                    EagleCamera::ReadWrite, {EAGLE_CAMERA_FEATURE_FITS_FILE_MAPPING_OFF, EAGLE_CAMERA_FEATURE_FITS_FILE_MAPPING_ON},
+                    [this]() {return _fitsFileMappingMode;},
+                    [this](const std::string fm){_fitsFileMappingMode = trim_spaces(fm);}
+               ));
+
+
+    PREDEFINED_CAMERA_FEATURES[EAGLE_CAMERA_FEATURE_ACQUISITION_MODE_NAME] = std::unique_ptr<EagleCamera::CameraAbstractFeature>(
+            new EagleCamera::CameraFeature<std::string>( EAGLE_CAMERA_FEATURE_ACQUISITION_MODE_NAME,
+                    EagleCamera::ReadWrite, {EAGLE_CAMERA_FEATURE_ACQUISITION_MODE_SNAPSHOT,
+                                             EAGLE_CAMERA_FEATURE_ACQUISITION_MODE_STREAMING,
+                                             EAGLE_CAMERA_FEATURE_ACQUISITION_MODE_RECORDER},
+                    [this]() {return _acquisitionMode;},
+                    [this](const std::string am){_acquisitionMode = trim_spaces(am);}
+               ));
+
+
+    PREDEFINED_CAMERA_FEATURES[EAGLE_CAMERA_FEATURE_BACKPRESSURE_POLICY_NAME] = std::unique_ptr<EagleCamera::CameraAbstractFeature>(
+            new EagleCamera::CameraFeature<std::string>( EAGLE_CAMERA_FEATURE_BACKPRESSURE_POLICY_NAME,
+                    EagleCamera::ReadWrite, {EAGLE_CAMERA_FEATURE_BACKPRESSURE_POLICY_BLOCK,
+                                             EAGLE_CAMERA_FEATURE_BACKPRESSURE_POLICY_DROP_NEWEST,
+                                             EAGLE_CAMERA_FEATURE_BACKPRESSURE_POLICY_DROP_OLDEST,
+                                             EAGLE_CAMERA_FEATURE_BACKPRESSURE_POLICY_SPILL},
+                    [this]() {return _backpressurePolicy;},
+                    [this](const std::string bp){_backpressurePolicy = trim_spaces(bp);}
+               ));
+
+
+    PREDEFINED_CAMERA_FEATURES[EAGLE_CAMERA_FEATURE_SPOOL_FILENAME_NAME] = std::unique_ptr<EagleCamera::CameraAbstractFeature>(
+            new EagleCamera::CameraFeature<std::string>( EAGLE_CAMERA_FEATURE_SPOOL_FILENAME_NAME,
+                    EagleCamera::ReadWrite, {},
+                    [this]() {return _spoolFilename;},
+                    [this](const std::string sf){_spoolFilename = trim_spaces(sf);}
+               ));
+
+
+    // counters of the last acquisition
+
+    PREDEFINED_CAMERA_FEATURES[EAGLE_CAMERA_FEATURE_DROPPED_FRAMES_NAME] = std::unique_ptr<EagleCamera::CameraAbstractFeature>(
+            new EagleCamera::CameraFeature<EagleCamera::IntegerType>( EAGLE_CAMERA_FEATURE_DROPPED_FRAMES_NAME,
+                    EagleCamera::ReadOnly, {},
+                    [this]() {return _droppedFrames.load();}
+               ));
+
+    PREDEFINED_CAMERA_FEATURES[EAGLE_CAMERA_FEATURE_SPILLED_FRAMES_NAME] = std::unique_ptr<EagleCamera::CameraAbstractFeature>(
+            new EagleCamera::CameraFeature<EagleCamera::IntegerType>( EAGLE_CAMERA_FEATURE_SPILLED_FRAMES_NAME,
+                    EagleCamera::ReadOnly, {},
+                    [this]() {return _spilledFrames.load();}
+               ));
+
+    PREDEFINED_CAMERA_FEATURES[EAGLE_CAMERA_FEATURE_LOST_FRAMES_NAME] = std::unique_ptr<EagleCamera::CameraAbstractFeature>(
+            new EagleCamera::CameraFeature<EagleCamera::IntegerType>( EAGLE_CAMERA_FEATURE_LOST_FRAMES_NAME,
+                    EagleCamera::ReadOnly, {},
+                    [this]() {return _lostFrames.load();}
+               ));
+
+
+    PREDEFINED_CAMERA_FEATURES[EAGLE_CAMERA_FEATURE_HUGE_PAGES_NAME] = std::unique_ptr<EagleCamera::CameraAbstractFeature>(
+            new EagleCamera::CameraFeature<std::string>( EAGLE_CAMERA_FEATURE_HUGE_PAGES_NAME,
+                    EagleCamera::ReadWrite, {EAGLE_CAMERA_FEATURE_BUFFERS_MEMORY_OFF, EAGLE_CAMERA_FEATURE_BUFFERS_MEMORY_ON},
+                    [this]() {return _hugePagesMode;},
+                    [this](const std::string hp){_hugePagesMode = trim_spaces(hp);}
+               ));
+
+
+    PREDEFINED_CAMERA_FEATURES[EAGLE_CAMERA_FEATURE_PREFAULT_BUFFERS_NAME] = std::unique_ptr<EagleCamera::CameraAbstractFeature>(
+            new EagleCamera::CameraFeature<std::string>( EAGLE_CAMERA_FEATURE_PREFAULT_BUFFERS_NAME,
+                    EagleCamera::ReadWrite, {EAGLE_CAMERA_FEATURE_BUFFERS_MEMORY_OFF, EAGLE_CAMERA_FEATURE_BUFFERS_MEMORY_ON},
+                    [this]() {return _prefaultBuffersMode;},
+                    [this](const std::string pb){_prefaultBuffersMode = trim_spaces(pb);}
+               ));
+
+
+    PREDEFINED_CAMERA_FEATURES[EAGLE_CAMERA_FEATURE_LOCK_BUFFERS_NAME] = std::unique_ptr<EagleCamera::CameraAbstractFeature>(
+            new EagleCamera::CameraFeature<std::string>( EAGLE_CAMERA_FEATURE_LOCK_BUFFERS_NAME,
+                    EagleCamera::ReadWrite, {EAGLE_CAMERA_FEATURE_BUFFERS_MEMORY_OFF, EAGLE_CAMERA_FEATURE_BUFFERS_MEMORY_ON},
+                    [this]() {return _lockBuffersMode;},
+                    [this](const std::string lb){_lockBuffersMode = trim_spaces(lb);}
+               ));
+
+
+    PREDEFINED_CAMERA_FEATURES[EAGLE_CAMERA_FEATURE_ZERO_COPY_NAME] = std::unique_ptr<EagleCamera::CameraAbstractFeature>(
+            new EagleCamera::CameraFeature<std::string>( EAGLE_CAMERA_FEATURE_ZERO_COPY_NAME,
+                    EagleCamera::ReadWrite, {EAGLE_CAMERA_FEATURE_ZERO_COPY_OFF, EAGLE_CAMERA_FEATURE_ZERO_COPY_ON},
+                    [this]() {return _zeroCopyMode;},
+                    [this](const std::string zc){_zeroCopyMode = trim_spaces(zc);}
+               ));
+
+
     PREDEFINED_CAMERA_FEATURES[EAGLE_CAMERA_FEATURE_FRAME_BUFFERS_NUMBER_NAME] = std::unique_ptr<EagleCamera::CameraAbstractFeature>(
             new EagleCamera::CameraFeature<EagleCamera::IntegerType>( EAGLE_CAMERA_FEATURE_FRAME_BUFFERS_NUMBER_NAME,
                     EagleCamera::ReadWrite, {1,std::numeric_limits<IntegerType>::max()},
@@ -288,6 +403,70 @@ void EagleCamera::InitCameraFeatures()
                     [this](const EagleCamera::IntegerType fn){_frameBuffersNumber = fn;}
                ));
 
+
+    PREDEFINED_CAMERA_FEATURES[EAGLE_CAMERA_FEATURE_NUMA_NODE_NAME] = std::unique_ptr<EagleCamera::CameraAbstractFeature>(
+            new EagleCamera::CameraFeature<EagleCamera::IntegerType>( EAGLE_CAMERA_FEATURE_NUMA_NODE_NAME,
+                    EagleCamera::ReadWrite, {-1,std::numeric_limits<IntegerType>::max()},
+                    [this]() {return _numaNode;},
+                    [this](const EagleCamera::IntegerType node){_numaNode = node;}
+               ));
+
+
+    // scheduling policy, priority and CPU affinity of acquisition threads
+
+    auto add_thread_features = [this](const char *policy_name, const char *priority_name,
+                                      const char *affinity_name, ThreadScheduling *sched) {
+        PREDEFINED_CAMERA_FEATURES[policy_name] = std::unique_ptr<EagleCamera::CameraAbstractFeature>(
+                new EagleCamera::CameraFeature<std::string>( policy_name,
+                        EagleCamera::ReadWrite, {EAGLE_CAMERA_FEATURE_THREAD_POLICY_OTHER,
+                                                 EAGLE_CAMERA_FEATURE_THREAD_POLICY_FIFO,
+                                                 EAGLE_CAMERA_FEATURE_THREAD_POLICY_RR},
+                        [sched]() {return sched->policy;},
+                        [sched](const std::string tp){sched->policy = trim_spaces(tp);}
+                   ));
+
+        PREDEFINED_CAMERA_FEATURES[priority_name] = std::unique_ptr<EagleCamera::CameraAbstractFeature>(
+                new EagleCamera::CameraFeature<EagleCamera::IntegerType>( priority_name,
+                        EagleCamera::ReadWrite, {0, 99},
+                        [sched]() {return sched->priority;},
+                        [sched](const EagleCamera::IntegerType tp){sched->priority = tp;}
+                   ));
+
+        PREDEFINED_CAMERA_FEATURES[affinity_name] = std::unique_ptr<EagleCamera::CameraAbstractFeature>(
+                new EagleCamera::CameraFeature<std::string>( affinity_name,
+                        EagleCamera::ReadWrite, {},
+                        [sched]() {return sched->affinity;},
+                        [sched, affinity_name](const std::string ta){
+                            std::vector<int> cpus;
+                            std::string list = trim_spaces(ta);
+                            if ( !parseCpuList(list, cpus) ) {
+                                throw EagleCameraException(0, EagleCamera::Error_InvalidFeatureValue,
+                                                           std::string("Invalid list of CPUs for '") +
+                                                           affinity_name + "' feature: " + list);
+                            }
+                            sched->affinity = list;
+                        }
+                   ));
+    };
+
+    add_thread_features(EAGLE_CAMERA_FEATURE_CAPTURE_THREAD_POLICY_NAME, EAGLE_CAMERA_FEATURE_CAPTURE_THREAD_PRIORITY_NAME,
+                        EAGLE_CAMERA_FEATURE_CAPTURE_THREAD_AFFINITY_NAME, &_captureThreadScheduling);
+    add_thread_features(EAGLE_CAMERA_FEATURE_WRITER_THREAD_POLICY_NAME, EAGLE_CAMERA_FEATURE_WRITER_THREAD_PRIORITY_NAME,
+                        EAGLE_CAMERA_FEATURE_WRITER_THREAD_AFFINITY_NAME, &_writerThreadScheduling);
+    add_thread_features(EAGLE_CAMERA_FEATURE_TELEMETRY_THREAD_POLICY_NAME, EAGLE_CAMERA_FEATURE_TELEMETRY_THREAD_PRIORITY_NAME,
+                        EAGLE_CAMERA_FEATURE_TELEMETRY_THREAD_AFFINITY_NAME, &_telemetryThreadScheduling);
+    add_thread_features(EAGLE_CAMERA_FEATURE_PROCESSING_THREAD_POLICY_NAME, EAGLE_CAMERA_FEATURE_PROCESSING_THREAD_PRIORITY_NAME,
+                        EAGLE_CAMERA_FEATURE_PROCESSING_THREAD_AFFINITY_NAME, &_processingThreadScheduling);
+
+
+    // in Hz. temperatures are sampled in background during acquisition
+    PREDEFINED_CAMERA_FEATURES[EAGLE_CAMERA_FEATURE_TELEMETRY_RATE_NAME] = std::unique_ptr<EagleCamera::CameraAbstractFeature>(
+            new EagleCamera::CameraFeature<double>( EAGLE_CAMERA_FEATURE_TELEMETRY_RATE_NAME,
+                    EagleCamera::ReadWrite, {1.0E-3, 10.0},
+                    [this]() {return _telemetryRate;},
+                    [this](const double tr){_telemetryRate = tr;}
+               ));
+
 }
 
 
@@ -312,4 +491,9 @@ void EagleCamera::InitCameraCommands()
                 new CameraCommand<>( EAGLE_CAMERA_COMMAND_EXPSTOP, std::bind(static_cast<void(EagleCamera::*)()>
                                  (&EagleCamera::stopAcquisition), this)) );
 
+
+    PREDEFINED_CAMERA_COMMANDS[EAGLE_CAMERA_COMMAND_RECTRIGGER] = std::unique_ptr<CameraAbstractCommand>(
+                new CameraCommand<>( EAGLE_CAMERA_COMMAND_RECTRIGGER, std::bind(static_cast<void(EagleCamera::*)()>
+                                 (&EagleCamera::triggerRecorder), this)) );
+
 }
@@ -0,0 +1,526 @@
+#include <eagle_camera.h>
+
+
+            /***************************************************
+            *                                                  *
+            *   IMPLEMENTATION OF FRAME PROCESSING PIPELINE    *
+            *                                                  *
+            ***************************************************/
+
+
+EagleCamera::FrameProcessingStage::FrameProcessingStage(const std::string &name, const bool modifies_pixels,
+                                                        const size_t queue_capacity):
+    _name(name), _modifiesPixels(modifies_pixels), _queueCapacity(queue_capacity)
+{
+}
+
+
+EagleCamera::FrameProcessingStage::~FrameProcessingStage()
+{
+}
+
+
+std::string EagleCamera::FrameProcessingStage::name() const
+{
+    return _name;
+}
+
+
+bool EagleCamera::FrameProcessingStage::modifiesPixels() const
+{
+    return _modifiesPixels;
+}
+
+
+size_t EagleCamera::FrameProcessingStage::queueCapacity() const
+{
+    return _queueCapacity;
+}
+
+
+void EagleCamera::FrameProcessingStage::begin()
+{
+}
+
+
+void EagleCamera::FrameProcessingStage::end()
+{
+}
+
+
+void EagleCamera::addProcessingStage(const std::shared_ptr<FrameProcessingStage> &stage)
+{
+    if ( !stage ) {
+        throw EagleCameraException(0, EagleCamera::Error_NullPointer, "Processing stage is a null pointer!");
+    }
+
+    if ( !_acquiringFinished ) {
+        throw EagleCameraException(0, EagleCamera::Error_CameraIsAcquiring,
+                                   "Cannot add processing stage during acquisition");
+    }
+
+    _processingStages.push_back(stage);
+}
+
+
+void EagleCamera::clearProcessingStages()
+{
+    if ( !_acquiringFinished ) {
+        throw EagleCameraException(0, EagleCamera::Error_CameraIsAcquiring,
+                                   "Cannot remove processing stages during acquisition");
+    }
+
+    _processingStages.clear();
+}
+
+
+EagleCamera::FrameRing& EagleCamera::pipelineInput(const size_t idx)
+{
+    return idx ? *_stageRings[idx-1] : _frameRing;
+}
+
+
+void EagleCamera::runPipelineStage(const size_t idx, const bool as_extension)
+{
+    bool writer = (idx == _processingStages.size()); // FITS writer is the last stage
+    FrameProcessingStage *stage = writer ? nullptr : _processingStages[idx].get();
+
+    FrameRing &input = pipelineInput(idx);
+
+    if ( writer ) {
+        applyThreadScheduling(_writerThreadScheduling, "FITS writer");
+    } else {
+        applyThreadScheduling(_processingThreadScheduling, "'" + stage->name() + "' stage");
+    }
+
+    IntegerType frame_no, buff_no;
+
+    // concurrent cube writers read spooled frames into their own buffers. the spool file
+    // is read in order of spilling, so such frames are popped and read under the lock
+    bool cube_writer = writer && _fitsCubeWriters;
+    std::vector<ushort> spooled_image;
+
+    auto pop_frame = [&]() -> bool {
+        if ( !cube_writer ) return input.pop(frame_no, buff_no);
+
+        std::lock_guard<std::mutex> lock(_fitsCubeInputMutex);
+        if ( !input.pop(frame_no, buff_no) ) return false;
+        if ( buff_no < 0 ) {
+            if ( spooled_image.size() < static_cast<size_t>(_imagePixelsNumber) ) {
+                spooled_image.resize(_imagePixelsNumber);
+            }
+            readSpooledFrame(buff_no, spooled_image.data());
+        }
+        return true;
+    };
+
+    try {
+        if ( stage ) stage->begin();
+
+        for (;;) {
+            if ( input.discarded() ) break;
+
+            // the frame can be taken by acquisition thread (DROP_OLDEST policy) or by another cube writer
+            if ( !pop_frame() ) {
+                std::unique_lock<std::mutex> lock(_acquisitionStateMutex);
+                _acquisitionStateCond.wait(lock, [&input]{return !input.empty() || input.closed();});
+                if ( input.empty() ) break; // the ring is closed and all frames are processed
+                continue;
+            }
+
+            if ( writer ) {
+                writeFrame(frame_no, buff_no, as_extension, cube_writer ? spooled_image.data() : nullptr);
+            } else {
+                if ( buff_no < 0 ) { // spooled frame (only the first stage gets them)
+                    if ( !restoreSpooledFrame(buff_no, input) ) break;
+                    buff_no = _restoreBuffer;
+                }
+
+                stage->process(frame_no, _imageBuffer[buff_no], _imagePixelsNumber);
+
+                if ( (idx + 1 == _fanOutStage) && (buff_no != _restoreBuffer) ) fanOutFrame(frame_no, buff_no);
+
+                // pass the frame to the next stage. wait if its queue is full
+                FrameRing &output = *_stageRings[idx];
+                if ( output.full() ) {
+                    std::unique_lock<std::mutex> lock(_acquisitionStateMutex);
+                    _acquisitionStateCond.wait(lock, [&output]{return !output.full() || output.discarded();});
+                }
+                if ( output.discarded() ) { // the next stage failed: stop the previous ones too
+                    input.close(true);
+                    break;
+                }
+                output.push(frame_no, buff_no);
+            }
+
+            notifyAcquisitionState();
+        }
+
+        if ( stage ) stage->end();
+    } catch ( ... ) {
+        {
+            std::lock_guard<std::mutex> lock(_acquisitionStateMutex);
+            if ( !_savingError ) _savingError = std::current_exception();
+        }
+        input.close(true); // the previous stages must not wait for this one
+        _acquisitionStateCond.notify_all();
+    }
+}
+
+
+bool EagleCamera::restoreSpooledFrame(const IntegerType buff_no, FrameRing &input)
+{
+    // the buffer is returned by FITS writer stage
+    if ( _restoreBufferBusy ) {
+        std::unique_lock<std::mutex> lock(_acquisitionStateMutex);
+        _acquisitionStateCond.wait(lock, [this, &input]{return !_restoreBufferBusy || input.discarded();});
+        if ( input.discarded() ) return false;
+    }
+
+    _restoreBufferBusy = true;
+
+    readSpooledFrame(buff_no, _imageBuffer[_restoreBuffer]);
+    --_spoolPending; // spool slot can be re-used
+
+    _frameTiming[_restoreBuffer] = FrameTiming(); // the timing of spilled frames is lost
+
+    return true;
+}
+
+
+void EagleCamera::writeFrame(const IntegerType frame_no, const IntegerType buff_no, const bool as_extension,
+                             const ushort *spooled_image)
+{
+    if ( (buff_no < 0) && !spooled_image ) readSpooledFrame(buff_no);
+
+    // the record is still in the ring: the frame is not saved yet
+    FrameMetadata meta = frameMetadata(frame_no);
+    if ( !as_extension ) { // keep it for "CUBE INFO" table (there is no room for dropped frames)
+        std::lock_guard<std::mutex> lock(_fitsCubeMutex);
+        if ( static_cast<size_t>(frame_no) >= _cubeMetadata.size() ) {
+            FrameMetadata dropped = FrameMetadata();
+            dropped.flags = FRAME_FLAG_DROPPED;
+            _cubeMetadata.resize(frame_no + 1, dropped);
+        }
+        _cubeMetadata[frame_no] = meta;
+    }
+
+    auto write_start = std::chrono::steady_clock::now();
+    if ( _fitsCubeWriters ) {
+        saveToMappedCube(frame_no, (buff_no < 0) ? spooled_image : _imageBuffer[buff_no], meta.expTime);
+    } else {
+        saveToFitsFile(frame_no, buff_no, meta.expTime, as_extension);
+    }
+    auto write_stop = std::chrono::steady_clock::now();
+
+    recordLatency(LATENCY_STAGE_FITS_WRITE, write_start, write_stop);
+    if ( buff_no >= 0 ) { // the timing of spilled frames is lost
+        recordLatency(LATENCY_STAGE_SAVE_QUEUE, _frameTiming[buff_no].published, write_start);
+        recordLatency(LATENCY_STAGE_TOTAL, _frameTiming[buff_no].triggered, write_stop);
+    }
+
+    if ( buff_no < 0 ) {
+        --_spoolPending;
+    } else if ( buff_no == _restoreBuffer ) {
+        _restoreBufferBusy = false;
+    } else {
+        releaseFrameBuffer(buff_no); // the buffer can still be used by frame consumers
+    }
+
+    ++_savedFrames; // _bytesWritten is counted by the write path
+
+    notifyProgress(false);
+}
+
+
+
+            /*  FRAME HANDLES AND CONSUMERS  */
+
+
+EagleCamera::FrameHandle::FrameHandle():
+    _camera(nullptr), _frameNo(-1), _buffNo(-1), _metadata()
+{
+}
+
+
+EagleCamera::FrameHandle::FrameHandle(EagleCamera *camera, const IntegerType frame_no, const IntegerType buff_no):
+    _camera(camera), _frameNo(frame_no), _buffNo(buff_no), _metadata(camera->frameMetadata(frame_no))
+{
+    _camera->_bufferRefs[_buffNo].fetch_add(1, std::memory_order_relaxed);
+    ++_camera->_frameHandlesNumber;
+}
+
+
+EagleCamera::FrameHandle::FrameHandle(const FrameHandle &other):
+    _camera(other._camera), _frameNo(other._frameNo), _buffNo(other._buffNo), _metadata(other._metadata)
+{
+    if ( _camera ) {
+        _camera->_bufferRefs[_buffNo].fetch_add(1, std::memory_order_relaxed);
+        ++_camera->_frameHandlesNumber;
+    }
+}
+
+
+EagleCamera::FrameHandle& EagleCamera::FrameHandle::operator=(const FrameHandle &other)
+{
+    if ( this == &other ) return *this;
+
+    // take the new reference first: both handles can refer to the same buffer
+    if ( other._camera ) {
+        other._camera->_bufferRefs[other._buffNo].fetch_add(1, std::memory_order_relaxed);
+        ++other._camera->_frameHandlesNumber;
+    }
+    release();
+
+    _camera = other._camera;
+    _frameNo = other._frameNo;
+    _buffNo = other._buffNo;
+    _metadata = other._metadata;
+
+    return *this;
+}
+
+
+EagleCamera::FrameHandle::~FrameHandle()
+{
+    release();
+}
+
+
+bool EagleCamera::FrameHandle::valid() const
+{
+    return _camera != nullptr;
+}
+
+
+void EagleCamera::FrameHandle::release()
+{
+    if ( !_camera ) return;
+
+    _camera->releaseFrameBuffer(_buffNo);
+    --_camera->_frameHandlesNumber;
+    _camera = nullptr;
+}
+
+
+EagleCamera::IntegerType EagleCamera::FrameHandle::frameNumber() const
+{
+    return _frameNo;
+}
+
+
+const ushort* EagleCamera::FrameHandle::image() const
+{
+    return _camera ? _camera->_imageBuffer[_buffNo] : nullptr;
+}
+
+
+size_t EagleCamera::FrameHandle::imageLength() const
+{
+    return _camera ? _camera->_imagePixelsNumber : 0;
+}
+
+
+std::string EagleCamera::FrameHandle::startTimestamp() const
+{
+    return formatTimestamp(_metadata.startUtc);
+}
+
+
+double EagleCamera::FrameHandle::ccdTemp() const
+{
+    return _metadata.ccdTemp;
+}
+
+
+double EagleCamera::FrameHandle::pcbTemp() const
+{
+    return _metadata.pcbTemp;
+}
+
+
+const EagleCamera::FrameMetadata& EagleCamera::FrameHandle::metadata() const
+{
+    return _metadata;
+}
+
+
+EagleCamera::FrameConsumer::FrameConsumer(const std::string &name, const size_t queue_capacity):
+    _name(name), _queueCapacity(queue_capacity), _skippedFrames(0)
+{
+}
+
+
+EagleCamera::FrameConsumer::~FrameConsumer()
+{
+}
+
+
+std::string EagleCamera::FrameConsumer::name() const
+{
+    return _name;
+}
+
+
+size_t EagleCamera::FrameConsumer::queueCapacity() const
+{
+    return _queueCapacity;
+}
+
+
+EagleCamera::IntegerType EagleCamera::FrameConsumer::skippedFrames() const
+{
+    return _skippedFrames;
+}
+
+
+void EagleCamera::FrameConsumer::begin()
+{
+}
+
+
+void EagleCamera::FrameConsumer::end()
+{
+}
+
+
+EagleCamera::ImageReadyConsumer::ImageReadyConsumer(EagleCamera *camera):
+    FrameConsumer("imageReady"), _camera(camera)
+{
+}
+
+
+void EagleCamera::ImageReadyConsumer::consume(const FrameHandle &frame)
+{
+    _camera->imageReady(frame.frameNumber(), frame.image(), frame.imageLength());
+
+    _camera->recordLatency(LATENCY_STAGE_IMAGE_READY, _camera->_frameTiming[frame._buffNo].copied,
+                           std::chrono::steady_clock::now());
+}
+
+
+void EagleCamera::addFrameConsumer(const std::shared_ptr<FrameConsumer> &consumer)
+{
+    if ( !consumer ) {
+        throw EagleCameraException(0, EagleCamera::Error_NullPointer, "Frame consumer is a null pointer!");
+    }
+
+    if ( !_acquiringFinished ) {
+        throw EagleCameraException(0, EagleCamera::Error_CameraIsAcquiring,
+                                   "Cannot add frame consumer during acquisition");
+    }
+
+    _frameConsumers.push_back(consumer);
+}
+
+
+void EagleCamera::clearFrameConsumers()
+{
+    if ( !_acquiringFinished ) {
+        throw EagleCameraException(0, EagleCamera::Error_CameraIsAcquiring,
+                                   "Cannot remove frame consumers during acquisition");
+    }
+
+    _frameConsumers.clear();
+}
+
+
+void EagleCamera::startFrameConsumers()
+{
+    std::vector<std::shared_ptr<FrameConsumer>> consumers;
+
+    if ( !_zeroCopyFrames ) { // there are no images in memory in zero-copy mode
+        if ( !_imageReadyConsumer ) _imageReadyConsumer = std::shared_ptr<FrameConsumer>(new ImageReadyConsumer(this));
+        consumers.push_back(_imageReadyConsumer);
+    }
+    consumers.insert(consumers.end(), _frameConsumers.begin(), _frameConsumers.end());
+
+    _consumerWorkers.clear();
+
+    for ( auto &consumer: consumers ) {
+        std::unique_ptr<FrameConsumerWorker> worker(new FrameConsumerWorker());
+
+        // a frame holds an image buffer, so a queue for all buffers never overflows
+        size_t capacity = consumer->queueCapacity();
+        if ( !capacity || (capacity > static_cast<size_t>(_acquisitionBuffersNumber)) ) capacity = _acquisitionBuffersNumber;
+
+        consumer->_skippedFrames = 0;
+        worker->consumer = consumer;
+        worker->queue.reset(capacity);
+
+        _consumerWorkers.push_back(std::move(worker));
+    }
+
+    for ( auto &worker: _consumerWorkers ) {
+        worker->thread = std::thread(&EagleCamera::runFrameConsumer, this, worker.get());
+    }
+}
+
+
+void EagleCamera::stopFrameConsumers(const bool abort)
+{
+    for ( auto &worker: _consumerWorkers ) worker->queue.close(abort);
+
+    for ( auto &worker: _consumerWorkers ) {
+        if ( worker->thread.joinable() ) worker->thread.join();
+    }
+
+    for ( auto &worker: _consumerWorkers ) {
+        if ( worker->consumer->skippedFrames() ) {
+            logToFile(EagleCamera::LOG_IDENT_CAMERA_INFO, "Frame consumer '" + worker->consumer->name() +
+                      "' skipped " + std::to_string(worker->consumer->skippedFrames()) + " frames");
+        }
+    }
+
+    _consumerWorkers.clear();
+}
+
+
+void EagleCamera::runFrameConsumer(FrameConsumerWorker *worker)
+{
+    applyThreadScheduling(_processingThreadScheduling, "'" + worker->consumer->name() + "' consumer");
+
+    FrameHandle frame;
+
+    try {
+        worker->consumer->begin();
+
+        while ( worker->queue.pop(frame) ) {
+            worker->consumer->consume(frame);
+            frame.release();
+        }
+
+        worker->consumer->end();
+    } catch ( EagleCameraException &ex ) {
+        logToFile(ex);
+    } catch ( std::exception &ex ) {
+        logToFile(EagleCamera::LOG_IDENT_CAMERA_ERROR, "Frame consumer '" + worker->consumer->name() +
+                  "' failed: " + ex.what());
+    } catch ( ... ) {
+        logToFile(EagleCamera::LOG_IDENT_CAMERA_ERROR, "Frame consumer '" + worker->consumer->name() + "' failed");
+    }
+
+    // failed consumer does not get frames anymore
+    frame.release();
+    worker->queue.close(true);
+}
+
+
+void EagleCamera::fanOutFrame(const IntegerType frame_no, const IntegerType buff_no)
+{
+    for ( auto &worker: _consumerWorkers ) {
+        if ( !worker->queue.push(FrameHandle(this, frame_no, buff_no)) ) ++worker->consumer->_skippedFrames;
+    }
+}
+
+
+void EagleCamera::releaseFrameBuffer(const IntegerType buff_no)
+{
+    if ( _bufferRefs[buff_no].fetch_sub(1, std::memory_order_acq_rel) != 1 ) return;
+
+    {
+        std::lock_guard<std::mutex> lock(_freeBuffersMutex);
+        _freeBuffers.push(-1, buff_no); // return the buffer to acquisition thread
+    }
+    notifyAcquisitionState();
+}
@@ -0,0 +1,171 @@
+#include <eagle_camera.h>
+
+#include <set>
+
+
+extern std::string trim_spaces(const std::string& s, const std::string& whitespace = " \t");
+
+
+            /***************************************************
+            *                                                  *
+            *    IMPLEMENTATION OF ACQUISITION SEQUENCES       *
+            *                                                  *
+            ***************************************************/
+
+
+EagleCamera::SequenceSetting::SequenceSetting(const std::string &feature_name, const IntegerType value):
+    feature(feature_name), type(EagleCamera::IntType), integerValue(value), floatValue(0.0), stringValue()
+{
+}
+
+
+EagleCamera::SequenceSetting::SequenceSetting(const std::string &feature_name, const int value):
+    SequenceSetting(feature_name, static_cast<IntegerType>(value))
+{
+}
+
+
+EagleCamera::SequenceSetting::SequenceSetting(const std::string &feature_name, const double value):
+    feature(feature_name), type(EagleCamera::FloatType), integerValue(0), floatValue(value), stringValue()
+{
+}
+
+
+EagleCamera::SequenceSetting::SequenceSetting(const std::string &feature_name, const std::string &value):
+    feature(feature_name), type(EagleCamera::StringType), integerValue(0), floatValue(0.0), stringValue(value)
+{
+}
+
+
+EagleCamera::SequenceSetting::SequenceSetting(const std::string &feature_name, const char *value):
+    SequenceSetting(feature_name, std::string(value ? value : ""))
+{
+}
+
+
+bool EagleCamera::SequenceSetting::operator==(const SequenceSetting &other) const
+{
+    return (feature == other.feature) && (type == other.type) && (integerValue == other.integerValue) &&
+           (floatValue == other.floatValue) && (stringValue == other.stringValue);
+}
+
+
+void EagleCamera::runSequence(const std::vector<SequenceStep> &plan, const std::string &filename_template)
+{
+    if ( !_acquiringFinished ) throw EagleCameraException(0,EagleCamera::Error_CameraIsAcquiring,"Camera is acquiring");
+
+    if ( cameraUnitmap <= 0 ) {
+        throw EagleCameraException(0,EagleCamera::Error_Uninitialized,"Try to run sequence for uninitialized camera!");
+    }
+
+    // check the whole plan before the camera is touched
+
+    std::set<std::string> filenames;
+
+    for ( size_t i = 0; i < plan.size(); ++i ) {
+        const SequenceStep &step = plan[i];
+
+        if ( step.frames < 1 ) {
+            throw EagleCameraException(0,EagleCamera::Error_FeatureValueIsOutOfRange,
+                                       "Number of frames of sequence step " + std::to_string(i+1) + " must be positive");
+        }
+
+        for ( auto &setting: step.settings ) {
+            auto search = PREDEFINED_CAMERA_FEATURES.find(setting.feature);
+            if ( search == PREDEFINED_CAMERA_FEATURES.end() ) {
+                throw EagleCameraException(0,EagleCamera::Error_UnknowFeature,
+                                           "'" + setting.feature + "' is unknown camera feature!");
+            }
+
+            bool is_string = search->second->type() == EagleCamera::StringType;
+            if ( is_string != (setting.type == EagleCamera::StringType) ) {
+                throw EagleCameraException(0,EagleCamera::Error_FeatureTypeMismatch,
+                                           "Feature type mismatch in sequence step " + std::to_string(i+1) +
+                                           " ('" + setting.feature + "')");
+            }
+        }
+
+        std::string filename = sequenceFilename(filename_template, i+1, step.name);
+        if ( filename.empty() || !filenames.insert(filename).second ) {
+            throw EagleCameraException(0,EagleCamera::Error_InvalidFeatureValue,
+                                       "Filename template gives empty or non-unique FITS filename for sequence step " +
+                                       std::to_string(i+1));
+        }
+    }
+
+    _sequenceStopped = false;
+
+    enableRegisterShadow(true);
+
+    try {
+        for ( size_t i = 0; (i < plan.size()) && !_sequenceStopped; ++i ) {
+            const SequenceStep &step = plan[i];
+
+            logToFile(EagleCamera::LOG_IDENT_CAMERA_INFO, "Start sequence step " + std::to_string(i+1) + " of " +
+                      std::to_string(plan.size()) + (step.name.empty() ? "" : " (" + step.name + ")"));
+
+            size_t hits = _registerShadowHits;
+
+            for ( auto &setting: step.settings ) applySequenceSetting(setting);
+
+            logToFile(EagleCamera::LOG_IDENT_CAMERA_INFO, "Unchanged register groups (not written): " +
+                      std::to_string(_registerShadowHits - hits), 1);
+
+            if ( _sequenceStopped ) break; // stopped during setup of the step
+
+            _frameCounts = step.frames;
+            _fitsFilename = sequenceFilename(filename_template, i+1, step.name);
+
+            startAcquisition();
+
+            // a stop request during the start could be reset by startAcquisition: repeat it
+            if ( _sequenceStopped ) stopAcquisition();
+
+            waitForAcquisition(); // wait for the step (re-throw its error)
+        }
+    } catch ( ... ) {
+        enableRegisterShadow(false);
+        throw;
+    }
+
+    enableRegisterShadow(false);
+
+    if ( _sequenceStopped ) logToFile(EagleCamera::LOG_IDENT_CAMERA_INFO, "Sequence was stopped");
+}
+
+
+void EagleCamera::applySequenceSetting(const SequenceSetting &setting)
+{
+    CameraFeatureProxy &feature = (*this)[setting.feature];
+
+    switch ( setting.type ) {
+        case EagleCamera::IntType:
+            feature = setting.integerValue;
+            break;
+        case EagleCamera::FloatType:
+            feature = setting.floatValue;
+            break;
+        case EagleCamera::StringType:
+            feature = setting.stringValue;
+            break;
+        default:
+            break;
+    }
+}
+
+
+std::string EagleCamera::sequenceFilename(const std::string &filename_template, const size_t step, const std::string &name)
+{
+    std::string filename = trim_spaces(filename_template);
+
+    auto replace = [&filename](const std::string &key, const std::string &value) {
+        for ( size_t pos = filename.find(key); pos != std::string::npos; pos = filename.find(key, pos + value.size()) ) {
+            filename.replace(pos, key.size(), value);
+        }
+    };
+
+    replace("{step}", std::to_string(step));
+    replace("{name}", name);
+
+    return filename;
+}
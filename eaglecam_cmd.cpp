@@ -22,7 +22,12 @@ std::map<std::string, std::string> cmd_map =
     {"-r",EAGLE_CAMERA_FEATURE_READOUT_RATE_NAME},
     {"-fh",EAGLE_CAMERA_FEATURE_FITS_HDR_FILENAME_NAME},
     {"-ff",EAGLE_CAMERA_FEATURE_FITS_FILENAME_NAME},
-    {"-fb",EAGLE_CAMERA_FEATURE_FRAME_BUFFERS_NUMBER_NAME}
+    {"-fb",EAGLE_CAMERA_FEATURE_FRAME_BUFFERS_NUMBER_NAME},
+    {"-fr",EAGLE_CAMERA_FEATURE_FRAME_RATE_NAME},
+    {"-am",EAGLE_CAMERA_FEATURE_ACQUISITION_MODE_NAME},
+    {"-zc",EAGLE_CAMERA_FEATURE_ZERO_COPY_NAME},
+    {"-bp",EAGLE_CAMERA_FEATURE_BACKPRESSURE_POLICY_NAME},
+    {"-pt",EAGLE_CAMERA_FEATURE_PRE_TRIGGER_FRAMES_NAME}
 };
 
 
@@ -93,6 +98,7 @@ int main(int argc, char* argv[])
         EagleCamera_StringFeature sf = cam[EAGLE_CAMERA_FEATURE_FITS_FILENAME_NAME];
         std::cout << "\nFITS FILENAME: " << sf.value() << "\n";
         cam.startAcquisition();
+        cam.waitForAcquisition(); // errors of acquisition thread are re-thrown here
     } catch ( EagleCameraException &ex ) {
         std::cerr << "ERROR: xclib = " << ex.XCLIB_Error() << ", cam_err = " << ex.Camera_Error() << "\n";
         std::cerr << "ERR MSG: " << ex.what() << "\n";
@@ -0,0 +1,104 @@
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+#include <cstdlib>
+
+#include <eagle_camera.h>
+
+// micro-benchmark of conversion of unsigned 16-bit pixels into FITS representation:
+// CFITSIO path (fits_write_img into in-memory file) against the kernels of native writer.
+// the data CFITSIO writes (big-endian, BZERO = 32768) is the reference for the kernels
+
+using namespace std;
+
+#define BENCH_XDIM 2048
+#define BENCH_YDIM 2048
+#define BENCH_DEFAULT_ITERATIONS 100
+
+
+static void report(const string &name, const chrono::steady_clock::duration &dt, const int iter, const size_t npix)
+{
+    double sec = chrono::duration<double>(dt).count()/iter;
+
+    cout << setw(8) << name << ": " << fixed << setprecision(3) << sec*1000.0 << " ms/frame, "
+         << setprecision(2) << npix*sizeof(ushort)/sec/1.0E9 << " GB/s\n";
+}
+
+
+int main(int argc, char* argv[])
+{
+    int iter = BENCH_DEFAULT_ITERATIONS;
+    if ( argc > 1 ) iter = atoi(argv[1]);
+    if ( iter < 1 ) iter = 1;
+
+    const size_t npix = BENCH_XDIM*BENCH_YDIM;
+
+    vector<ushort> image(npix);
+    for ( size_t i = 0; i < npix; ++i ) image[i] = static_cast<ushort>(rand());
+
+    vector<unsigned char> ref(npix*sizeof(ushort)), fits(npix*sizeof(ushort));
+
+    cout << "Frame " << BENCH_XDIM << "x" << BENCH_YDIM << ", " << iter << " iterations\n";
+
+    // CFITSIO
+
+    int status = 0;
+    fitsfile *fptr;
+    long naxes[2] = {BENCH_XDIM, BENCH_YDIM};
+    LONGLONG data_start = 0;
+
+    size_t mem_size = 2880;
+    void *mem_ptr = malloc(mem_size); // the file is in the user buffer, so it is kept after closing
+
+    fits_create_memfile(&fptr, &mem_ptr, &mem_size, 0, realloc, &status);
+    fits_create_img(fptr, USHORT_IMG, 2, naxes, &status);
+    fits_write_img(fptr, TUSHORT, 1, npix, image.data(), &status); // allocate in-memory file
+
+    auto start = chrono::steady_clock::now();
+    for ( int i = 0; i < iter; ++i ) fits_write_img(fptr, TUSHORT, 1, npix, image.data(), &status);
+    auto stop = chrono::steady_clock::now();
+
+    fits_get_hduaddrll(fptr, NULL, &data_start, NULL, &status);
+    fits_close_file(fptr, &status);
+
+    if ( status ) {
+        char err[FLEN_STATUS];
+        fits_get_errstatus(status, err);
+        cerr << "CFITSIO error: " << err << "\n";
+        free(mem_ptr);
+        return status;
+    }
+
+    memcpy(ref.data(), static_cast<unsigned char*>(mem_ptr) + data_start, ref.size());
+    free(mem_ptr);
+
+    report("CFITSIO", stop - start, iter, npix);
+
+    // native writer kernels
+
+    for ( auto kernel: {EagleCamera::FITS_PIXELS_SCALAR, EagleCamera::FITS_PIXELS_SSE2,
+                        EagleCamera::FITS_PIXELS_AVX2, EagleCamera::FITS_PIXELS_AVX512} ) {
+        string name = EagleCamera::fitsPixelsKernelName(kernel);
+        if ( !EagleCamera::fitsPixelsKernelSupported(kernel) ) {
+            cout << setw(8) << name << ": not supported by CPU\n";
+            continue;
+        }
+
+        EagleCamera::convertToFitsPixels(image.data(), npix, fits.data(), kernel); // warm up
+
+        start = chrono::steady_clock::now();
+        for ( int i = 0; i < iter; ++i ) EagleCamera::convertToFitsPixels(image.data(), npix, fits.data(), kernel);
+        stop = chrono::steady_clock::now();
+
+        report(name, stop - start, iter, npix);
+
+        if ( memcmp(fits.data(), ref.data(), fits.size()) ) {
+            cerr << name << " kernel result differs from CFITSIO!\n";
+            return 1;
+        }
+    }
+
+    cout << "Run-time dispatched kernel: " << EagleCamera::fitsPixelsKernelName(EagleCamera::fitsPixelsKernel()) << "\n";
+
+    return 0;
+}